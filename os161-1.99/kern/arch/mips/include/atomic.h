@@ -0,0 +1,150 @@
+#ifndef _MIPS_ATOMIC_H_
+#define _MIPS_ATOMIC_H_
+
+/*
+ * MIPS atomic operations, for <atomic.h>.
+ *
+ * The read-modify-write operations use LL/SC, like the spinlock
+ * code: SC stores only if nothing else has written the word since the
+ * LL, and otherwise fails, in which case we go around again. Nothing
+ * may branch between the LL and the SC, as the compiler may have put
+ * the assembler in noreorder mode, so compare-and-swap always stores:
+ * either the new value, or the value it found.
+ *
+ * Aligned word loads and stores are atomic by themselves.
+ *
+ * The barriers are all SYNC, which orders every load and store
+ * before it against every one after.
+ */
+
+int atomic_data_fetchadd(volatile int *p, int delta);
+int atomic_data_cas(volatile int *p, int oldval, int newval);
+void *atomic_data_casptr(void *volatile *p, void *oldval, void *newval);
+void membar_any_any(void);
+void membar_load_load(void);
+void membar_store_store(void);
+void membar_store_any(void);
+void membar_any_store(void);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+int
+atomic_data_fetchadd(volatile int *p, int delta)
+{
+	int x, y;
+
+	/* Returns the old value. */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%2);"		/*   x = *p */
+			"addu %1, %0, %3;"	/*   y = x + delta */
+			"sc %1, 0(%2);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y) : "r" (p), "r" (delta)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+int
+atomic_data_cas(volatile int *p, int oldval, int newval)
+{
+	int x, y, m;
+
+	/* Returns the value found; the swap happened if it's OLDVAL. */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%3);"		/*   x = *p */
+			"xor %2, %0, %4;"	/*   m = x ^ oldval */
+			"sltiu %2, %2, 1;"	/*   m = (x == oldval) */
+			"subu %2, $0, %2;"	/*   m = m ? ~0 : 0 */
+			"xor %1, %0, %5;"	/*   y = x ^ newval */
+			"and %1, %1, %2;"	/*   y = m ? x ^ newval : 0 */
+			"xor %1, %1, %0;"	/*   y = m ? newval : x */
+			"sc %1, 0(%3);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y), "=&r" (m)
+			: "r" (p), "r" (oldval), "r" (newval)
+			: "memory");
+	} while (y == 0);
+	return x;
+}
+
+ATOMIC_INLINE
+void *
+atomic_data_casptr(void *volatile *p, void *oldval, void *newval)
+{
+	void *x, *y, *m;
+
+	/* Same as atomic_data_cas; pointers are a word too. */
+	do {
+		__asm volatile(
+			".set push;"		/* save assembler mode */
+			".set mips32;"		/* allow MIPS32 instructions */
+			".set volatile;"	/* avoid unwanted optimization */
+			"ll %0, 0(%3);"		/*   x = *p */
+			"xor %2, %0, %4;"	/*   m = x ^ oldval */
+			"sltiu %2, %2, 1;"	/*   m = (x == oldval) */
+			"subu %2, $0, %2;"	/*   m = m ? ~0 : 0 */
+			"xor %1, %0, %5;"	/*   y = x ^ newval */
+			"and %1, %1, %2;"	/*   y = m ? x ^ newval : 0 */
+			"xor %1, %1, %0;"	/*   y = m ? newval : x */
+			"sc %1, 0(%3);"		/*   *p = y; y = success? */
+			".set pop"		/* restore assembler mode */
+			: "=&r" (x), "=&r" (y), "=&r" (m)
+			: "r" (p), "r" (oldval), "r" (newval)
+			: "memory");
+	} while (y == NULL);
+	return x;
+}
+
+ATOMIC_INLINE
+void
+membar_any_any(void)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 instructions */
+		"sync;"			/* do it */
+		".set pop"		/* restore assembler mode */
+		: : : "memory");
+}
+
+ATOMIC_INLINE
+void
+membar_load_load(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+membar_store_store(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+membar_store_any(void)
+{
+	membar_any_any();
+}
+
+ATOMIC_INLINE
+void
+membar_any_store(void)
+{
+	membar_any_any();
+}
+
+
+#endif /* _MIPS_ATOMIC_H_ */
@@ -0,0 +1,50 @@
+#ifndef _MIPS_IPT_H_
+#define _MIPS_IPT_H_
+
+/*
+ * System-wide hashed inverted page table (options ipt).
+ *
+ * With this option, dumbvm keeps no page tables of its own. Every
+ * user translation lives in one table, keyed by (address space,
+ * virtual page). The table's entries come from a pool of whole
+ * pages, sized to physical memory at boot and grown a page at a time
+ * when it runs out, so a process costs no kernel heap for its page
+ * tables.
+ *
+ *    ipt_bootstrap - allocate the table for a machine with NFRAMES
+ *                user frames. Called from vm_bootstrap.
+ *
+ *    ipt_lookup  - return a pointer to the physical address mapped at
+ *                VADDR in AS, or NULL. If CREATE is set, a missing entry
+ *                is added with paddr 0, which the caller fills in; NULL
+ *                then means there was no memory to grow the pool. The
+ *                pointer stays valid until the entry is removed.
+ *
+ *    ipt_remove  - drop the entry for VADDR in AS, if any. The caller
+ *                has already dealt with the frame.
+ *
+ *    ipt_copy    - give NEW an entry for every mapped page in OLD,
+ *                pointing at the same frame, and call SHARE on each
+ *                frame. Returns ENOMEM if the pool can't grow enough.
+ *
+ *    ipt_destroy - remove all of AS's entries, calling RELEASE on each
+ *                mapped frame.
+ *
+ *    ipt_printstats - print pool usage, and entry memory per address
+ *                space given that there are NAS of them.
+ */
+
+struct addrspace;
+
+/* Empty entry index; also the value of an empty as_iptlist */
+#define IPT_NONE	(-1)
+
+void     ipt_bootstrap(unsigned nframes);
+paddr_t *ipt_lookup(struct addrspace *as, vaddr_t vaddr, bool create);
+void     ipt_remove(struct addrspace *as, vaddr_t vaddr);
+int      ipt_copy(struct addrspace *old, struct addrspace *new,
+                  void (*share)(paddr_t));
+void     ipt_destroy(struct addrspace *as, void (*release)(paddr_t));
+void     ipt_printstats(unsigned nas);
+
+#endif /* _MIPS_IPT_H_ */
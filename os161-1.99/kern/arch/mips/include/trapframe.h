@@ -105,6 +105,7 @@ void mips_usermode(struct trapframe *tf);
  */
 extern vaddr_t cpustacks[];
 extern vaddr_t cputhreads[];
+extern vaddr_t cpuemergstacks[];
 
 
 #endif /* _MIPS_TRAPFRAME_H_ */
@@ -117,6 +117,7 @@ struct tlbshootdown {
 	 */
 	struct addrspace *ts_addrspace;
 	vaddr_t ts_vaddr;
+	unsigned ts_gen;		/* vfree's shootdown generation */
 };
 
 #define TLBSHOOTDOWN_MAX 16
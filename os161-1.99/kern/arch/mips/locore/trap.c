@@ -141,6 +141,17 @@ mips_trap(struct trapframe *tf)
 
 	KASSERT(code < NTRAPCODES);
 
+	/*
+	 * On the emergency stack? Then the thread ran into the guard
+	 * page below its kernel stack (see exception-mips1.S).
+	 */
+	if (curthread != NULL && curthread->t_cpu != NULL &&
+	    SAME_STACK(cpuemergstacks[curcpu->c_number] - 1, (vaddr_t)tf)) {
+		panic("Kernel stack overflow in thread %s "
+		      "(sp 0x%x, epc 0x%x, vaddr 0x%x)\n",
+		      curthread->t_name, tf->tf_sp, tf->tf_epc, tf->tf_vaddr);
+	}
+
 	/* Make sure we haven't run off our stack */
 	if (curthread != NULL && curthread->t_stack != NULL) {
 		KASSERT((vaddr_t)tf > (vaddr_t)curthread->t_stack);
@@ -38,6 +38,7 @@
 #include <addrspace.h>
 #include <syscall.h>
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 
 /*
@@ -111,6 +112,23 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_setaffinity:
+		err = sys_setaffinity((unsigned)tf->tf_a0);
+		break;
+
+	    case SYS_getaffinity:
+		err = sys_getaffinity((unsigned *)&retval);
+		break;
+
+	    case SYS_schedstats:
+		err = sys_schedstats((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+		break;
 #ifdef UW
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
@@ -143,6 +161,26 @@ syscall(struct trapframe *tf)
 	  err = sys_execv((char*)tf->tf_a0, (char**)tf->tf_a1);
 	  break;
 #endif // OPT_A2
+
+#if OPT_A3
+	case SYS_mmap:
+	  err = sys_mmap((userptr_t)tf->tf_a0,
+			 (size_t)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int)tf->tf_a3,
+			 (vaddr_t *)&retval);
+	  break;
+
+	case SYS_munmap:
+	  err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+	  break;
+
+	case SYS_madvise:
+	  err = sys_madvise((userptr_t)tf->tf_a0,
+			    (size_t)tf->tf_a1,
+			    (int)tf->tf_a2);
+	  break;
+#endif // OPT_A3
  
 	default:
 	  kprintf("Unknown syscall %d\n", callno);
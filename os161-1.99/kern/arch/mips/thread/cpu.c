@@ -59,6 +59,14 @@
 vaddr_t cpustacks[MAXCPUS];
 vaddr_t cputhreads[MAXCPUS];
 
+/*
+ * Emergency stacks, one per CPU, also indexed by CPU number. The
+ * exception entry code switches to this when a kernel-mode trap
+ * would push its trap frame into the guard page below a thread's
+ * stack, so mips_trap has somewhere to run to report the overflow.
+ */
+vaddr_t cpuemergstacks[MAXCPUS];
+
 /*
  * Do machine-dependent initialization of the cpu structure or things
  * associated with a new cpu. Note that we're not running on the new
@@ -71,6 +79,13 @@ cpu_machdep_init(struct cpu *c)
 
 	KASSERT(c->c_number < MAXCPUS);
 
+	/* kmalloc gives a whole (kseg0) page, so SAME_STACK works on it */
+	stackpointer = (vaddr_t) kmalloc(STACK_SIZE);
+	if (stackpointer == 0) {
+		panic("cpu_machdep_init: Out of memory\n");
+	}
+	cpuemergstacks[c->c_number] = stackpointer + STACK_SIZE;
+
 	if (c->c_curthread->t_stack == NULL) {
 		/* boot cpu; don't need to do anything here */
 	}
@@ -32,15 +32,23 @@
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <atomic.h>
+#include <bitmap.h>
+#include <cpu.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
+#include <platform/maxcpus.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <elf.h>
 #include <syscall.h>
 #include <coremap_entry.h>
+#include <kern/mman.h>
+#include <mips/ipt.h>
 #include "opt-A3.h"
+#include "opt-ipt.h"
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -52,6 +60,29 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+#if OPT_A3
+/* pages mapped ahead of a fault in MADV_SEQUENTIAL regions */
+#define DUMBVM_FAULTAROUND   8
+
+/*
+ * vmalloc arena: the bottom VMALLOC_PAGES pages of kseg2. Each
+ * allocation is preceded by an unmapped guard page, which catches
+ * kernel stack overflows: the exception entry code notices the trap
+ * frame would land in it and panics on the cpu's emergency stack.
+ */
+#define VMALLOC_PAGES        4096
+
+/*
+ * Kernel stacks in kseg2 must never take a TLB miss, since the
+ * exception handler would have nowhere to push the trapframe. tlb_random
+ * only picks slots 8 and up, so slots below DUMBVM_WIREDSLOTS are kept
+ * for stack pages: one bank for the running thread's stack and one for
+ * the thread thread_switch is about to switch to.
+ */
+#define KSTACK_PAGES         ((STACK_SIZE + PAGE_SIZE - 1) / PAGE_SIZE)
+#define DUMBVM_WIREDSLOTS    (2 * KSTACK_PAGES)
+#endif
+
 #if OPT_A3
 paddr_t startaddr;
 paddr_t lastaddr;
@@ -61,8 +92,78 @@ int number_of_pages;
 
 struct spinlock coremap_lock;
 struct coremap_entry* coremap;
+static unsigned coremap_nfree;		/* frames with no owner */
 
 bool vm_is_bootstrapped = false;
+
+/*
+ * madvise counters, printed by vm_printstats.
+ */
+static struct spinlock madvise_lock = SPINLOCK_INITIALIZER;
+static unsigned madvise_calls[MADV_DONTNEED + 1];
+static unsigned madvise_dropped;	/* frames freed by DONTNEED */
+static unsigned madvise_prefaulted;	/* frames allocated by WILLNEED */
+static unsigned madvise_faultaround;	/* pages mapped ahead by SEQUENTIAL */
+
+/*
+ * Address spaces, and second-level page tables, in existence; for the
+ * page table memory vm_printstats reports.
+ */
+static struct atomic vm_naddrspaces = ATOMIC_INITIALIZER(0);
+#if !OPT_IPT
+static struct atomic vm_npagetables = ATOMIC_INITIALIZER(0);
+#endif
+
+/*
+ * Kernel page table for the vmalloc arena. vmalloc_pt is written under
+ * vmalloc_lock but read without it by the fault handler, which can run
+ * with any other lock held. vmalloc_npages records the length of each
+ * allocation at its first page.
+ */
+static struct spinlock vmalloc_lock = SPINLOCK_INITIALIZER;
+static struct bitmap *vmalloc_map;
+static paddr_t vmalloc_pt[VMALLOC_PAGES];
+static uint16_t vmalloc_npages[VMALLOC_PAGES];
+static unsigned vmalloc_rotor;		/* next-fit search starts here */
+static unsigned vmalloc_inuse;		/* pages mapped, for stats */
+
+/* In vmalloc_pt: freed, but other cpus may still have it in their TLB */
+#define VMALLOC_DEAD	1
+
+/*
+ * Freed ranges wait in limbo until every cpu that was sent a shootdown
+ * for them has done it; only then do the frames go back to the
+ * coremap. Each range's record lives in its own first frame, through
+ * kseg0. Generations are handed out, and the shootdowns queued, under
+ * vmalloc_lock, so each cpu gets them in order; tlb_ackgen is the
+ * latest one each cpu has done, and is written only by that cpu.
+ */
+struct vmalloc_limbo {
+    struct vmalloc_limbo *vl_next;
+    unsigned vl_base;			/* first page, after the guard */
+    unsigned vl_gen;			/* generation of its shootdowns */
+    unsigned vl_cpus;			/* mask of cpus they went to */
+};
+static struct vmalloc_limbo *vmalloc_limbo;
+static unsigned tlb_sendgen;
+static volatile unsigned tlb_ackgen[MAXCPUS];
+
+/* Which wired bank holds the running thread's stack, per cpu */
+static unsigned kstack_bank[MAXCPUS];
+
+/*
+ * The region of an address space that contains some address, as found
+ * by as_lookup_region.
+ */
+struct region_info {
+    vaddr_t ri_base;
+    vaddr_t ri_top;
+    int ri_permissions;
+    bool ri_shared;		/* MAP_SHARED: never copy-on-write */
+    bool ri_filebacked;		/* loaded from the executable */
+    struct bitmap **ri_sequential; /* its MADV_SEQUENTIAL pages, or NULL */
+    struct as_mapping *ri_map;	/* NULL unless this is an mmap region */
+};
 #endif // OPT_A3
 
 /*
@@ -74,7 +175,7 @@ static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 void
 vm_bootstrap(void)
 {
-    spinlock_init(&coremap_lock);
+    spinlock_init_ticket(&coremap_lock);
     ram_getsize(&startaddr, &lastaddr);
 
     coremap = (struct coremap_entry*) PADDR_TO_KVADDR(startaddr);
@@ -88,8 +189,19 @@ vm_bootstrap(void)
 	    coremap[i].num_pages_used = 1;
 	}
     }
+    coremap_nfree = number_of_pages - first_page_index;
 
+    // ram_stealmem is empty now, so switch kmalloc over to the coremap first
     vm_is_bootstrapped = true;
+
+    vmalloc_map = bitmap_create(VMALLOC_PAGES);
+    if(vmalloc_map == NULL) {
+	panic("vm_bootstrap: no memory for the vmalloc map\n");
+    }
+
+#if OPT_IPT
+    ipt_bootstrap(number_of_pages - first_page_index);
+#endif
 }
 #else
 vm_bootstrap(void)
@@ -140,6 +252,7 @@ unprotected_page_alloc(unsigned long npages)
 		coremap[j].num_of_owners = 1;
 	    }
 	    coremap[i-n+1].num_pages_used = npages;
+	    coremap_nfree -= npages;
 	    pa = (i-n+1) * PAGE_SIZE + startaddr;
 	    break;
 	}
@@ -176,6 +289,9 @@ free_kpages(vaddr_t addr)
 #if OPT_A3
     addr &= PAGE_FRAME;
 
+    // Frames stolen before vm_bootstrap aren't in the coremap; leak them
+    if(KVADDR_TO_PADDR(addr) < startaddr) return;
+
     int i = (KVADDR_TO_PADDR(addr) - startaddr) / PAGE_SIZE;
     spinlock_acquire(&coremap_lock);
     if(coremap[i].num_of_owners > 1) {
@@ -189,6 +305,7 @@ free_kpages(vaddr_t addr)
 	for(int j = i; j < i + coremap[i].num_pages_used; ++j) {
 	    coremap[j].num_of_owners = 0;
 	}
+	coremap_nfree += coremap[i].num_pages_used;
 	coremap[i].num_pages_used = 0;
     }
     spinlock_release(&coremap_lock);
@@ -197,6 +314,688 @@ free_kpages(vaddr_t addr)
 #endif
 }
 
+#if OPT_A3
+/*
+ * Per-frame slot for kmalloc's bookkeeping on the kernel page at KVA.
+ * Only kmalloc reads or writes it, under its own lock. Both return
+ * false if the page isn't in the coremap (it was stolen before
+ * vm_bootstrap), in which case the caller has to find it some other way.
+ */
+bool
+vm_kpage_getref(vaddr_t kva, void **ret)
+{
+    paddr_t pa = KVADDR_TO_PADDR(kva & PAGE_FRAME);
+
+    if(!vm_is_bootstrapped || pa < startaddr) return false;
+    *ret = coremap[(pa - startaddr) / PAGE_SIZE].kmalloc_ref;
+    return true;
+}
+
+bool
+vm_kpage_setref(vaddr_t kva, void *ref)
+{
+    paddr_t pa = KVADDR_TO_PADDR(kva & PAGE_FRAME);
+
+    if(!vm_is_bootstrapped || pa < startaddr) return false;
+    coremap[(pa - startaddr) / PAGE_SIZE].kmalloc_ref = ref;
+    return true;
+}
+#endif // OPT_A3
+
+#if OPT_A3
+/*
+ * Return a pointer to the page table entry for VADDR in AS. If the
+ * second-level table is missing it is allocated (zero-filled) when
+ * CREATE is set; otherwise, or if that fails, NULL is returned.
+ *
+ * With options ipt the entry lives in the inverted page table instead,
+ * and is created (with paddr 0) when CREATE is set.
+ */
+static
+paddr_t *
+as_pte(struct addrspace *as, vaddr_t vaddr, bool create)
+{
+#if OPT_IPT
+    return ipt_lookup(as, vaddr, create);
+#else
+    int dir_number = vaddr >> 22;
+    int page_number = (vaddr << 10) >> 22;
+
+    if(as->as_pagedir[dir_number] == NULL) {
+	if(!create) return NULL;
+	as->as_pagedir[dir_number] = kmalloc(PAGE_TABLE_SIZE * sizeof(paddr_t));
+	if(as->as_pagedir[dir_number] == NULL) return NULL;
+	bzero(as->as_pagedir[dir_number], PAGE_TABLE_SIZE * sizeof(paddr_t));
+	atomic_add(&vm_npagetables, 1);
+    }
+
+    return &as->as_pagedir[dir_number][page_number];
+#endif // OPT_IPT
+}
+
+/*
+ * Forget the translation for VADDR in AS. The caller has already
+ * released the frame.
+ */
+static
+void
+as_pte_clear(struct addrspace *as, vaddr_t vaddr)
+{
+#if OPT_IPT
+    ipt_remove(as, vaddr);
+#else
+    paddr_t *pte = as_pte(as, vaddr, false);
+    if(pte != NULL) *pte = 0;
+#endif
+}
+
+/*
+ * Take another reference to the user frame at PADDR, for a fork.
+ */
+static
+void
+frame_share(paddr_t paddr)
+{
+    int index = (paddr - startaddr) / PAGE_SIZE;
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[index].num_of_owners > 0);
+    coremap[index].num_of_owners++;
+    spinlock_release(&coremap_lock);
+}
+
+/*
+ * Drop one reference to the user frame at PADDR. Frames that are still
+ * mapped elsewhere (copy-on-write or MAP_SHARED) are left untouched;
+ * the last owner scrubs the frame and hands it back to the coremap.
+ */
+static
+void
+frame_release(paddr_t paddr)
+{
+    int index = (paddr - startaddr) / PAGE_SIZE;
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(coremap[index].num_of_owners > 0);
+    if(coremap[index].num_of_owners > 1) {
+	--coremap[index].num_of_owners;
+	spinlock_release(&coremap_lock);
+	return;
+    }
+    spinlock_release(&coremap_lock);
+
+    // We are the only owner, so nobody else can touch the frame meanwhile
+    bzero((void *)PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+
+    spinlock_acquire(&coremap_lock);
+    coremap[index].num_pages_used = 0;
+    coremap[index].num_of_owners = 0;
+    coremap_nfree++;
+    spinlock_release(&coremap_lock);
+}
+
+/*
+ * Put a new frame behind VADDR, which must not have one yet, and
+ * return its page table entry; NULL if out of memory. The frame is had
+ * before the entry is made, so with options ipt a failure doesn't
+ * leave a frameless entry in the pool.
+ */
+static
+paddr_t *
+as_pte_newframe(struct addrspace *as, vaddr_t vaddr)
+{
+    paddr_t *pte;
+    paddr_t pa;
+
+    pa = page_alloc(1);
+    if(pa == 0) return NULL;
+
+    pte = as_pte(as, vaddr, true);
+    if(pte == NULL) {
+	frame_release(pa);
+	return NULL;
+    }
+    KASSERT(*pte == 0);
+    *pte = pa;
+    return pte;
+}
+
+/*
+ * Find the region of AS containing VADDR. Returns false if VADDR is
+ * not part of any region.
+ */
+static
+bool
+as_lookup_region(struct addrspace *as, vaddr_t vaddr, struct region_info *ri)
+{
+    vaddr_t stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+    struct as_mapping *map;
+
+    ri->ri_shared = false;
+    ri->ri_filebacked = false;
+    ri->ri_map = NULL;
+
+    if(vaddr >= as->as_vbase1 &&
+       vaddr < as->as_vbase1 + as->as_npages1 * PAGE_SIZE) {
+	ri->ri_base = as->as_vbase1;
+	ri->ri_top = as->as_vbase1 + as->as_npages1 * PAGE_SIZE;
+	ri->ri_permissions = as->as_permissions1;
+	ri->ri_filebacked = true;
+	ri->ri_sequential = &as->as_sequential1;
+    }
+    else if(vaddr >= as->as_vbase2 &&
+	    vaddr < as->as_vbase2 + as->as_npages2 * PAGE_SIZE) {
+	ri->ri_base = as->as_vbase2;
+	ri->ri_top = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
+	ri->ri_permissions = as->as_permissions2;
+	ri->ri_filebacked = true;
+	ri->ri_sequential = &as->as_sequential2;
+    }
+    else if(vaddr >= stackbase && vaddr < USERSTACK) {
+	ri->ri_base = stackbase;
+	ri->ri_top = USERSTACK;
+	ri->ri_permissions = PF_R | PF_W;
+	ri->ri_sequential = &as->as_stacksequential;
+    }
+    else if((map = as_find_mapping(as, vaddr)) != NULL) {
+	ri->ri_base = map->map_vbase;
+	ri->ri_top = map->map_vbase + map->map_npages * PAGE_SIZE;
+	ri->ri_permissions = map->map_permissions;
+	ri->ri_shared = map->map_shared;
+	ri->ri_sequential = &map->map_sequential;
+	ri->ri_map = map;
+    }
+    else {
+	return false;
+    }
+    return true;
+}
+
+/*
+ * Has VADDR, in the region RI, been advised MADV_SEQUENTIAL? Each
+ * region keeps a bitmap of such pages, indexed from its base, which
+ * is allocated on the first such advice.
+ */
+static
+bool
+as_sequential(const struct region_info *ri, vaddr_t vaddr)
+{
+    struct bitmap *seq = *ri->ri_sequential;
+
+    return seq != NULL && bitmap_isset(seq, (vaddr - ri->ri_base) / PAGE_SIZE);
+}
+
+/*
+ * Copy a region's MADV_SEQUENTIAL bitmap, for as_copy.
+ */
+static
+int
+as_copy_sequential(struct bitmap *old, size_t npages, struct bitmap **ret)
+{
+    *ret = NULL;
+    if(old == NULL) return 0;
+
+    *ret = bitmap_create(npages);
+    if(*ret == NULL) return ENOMEM;
+    for(unsigned i = 0; i < npages; ++i) {
+	if(bitmap_isset(old, i)) bitmap_mark(*ret, i);
+    }
+    return 0;
+}
+
+/*
+ * Make sure VADDR has a frame behind it, without touching the TLB.
+ * Returns ENOMEM if a page table or frame can't be had.
+ */
+static
+int
+as_populate(struct addrspace *as, vaddr_t vaddr, bool *allocated)
+{
+    paddr_t *pte = as_pte(as, vaddr, false);
+
+    *allocated = false;
+    if(pte == NULL || *pte == 0) {
+	if(as_pte_newframe(as, vaddr) == NULL) return ENOMEM;
+	*allocated = true;
+    }
+    return 0;
+}
+
+/*
+ * Load a translation into a free TLB slot, or a random one if the TLB
+ * is full. Call with interrupts off.
+ */
+static
+void
+tlb_load(uint32_t ehi, uint32_t elo)
+{
+    uint32_t oldehi, oldelo;
+    int i;
+
+    for (i=DUMBVM_WIREDSLOTS; i<NUM_TLB; i++) {
+	tlb_read(&oldehi, &oldelo, i);
+	if(!(oldelo & TLBLO_VALID)) break;
+    }
+
+    if(i==NUM_TLB) tlb_random(ehi, elo); // TLB is full simply overwrite a random entry
+    else	   tlb_write(ehi, elo, i);
+}
+
+/*
+ * Fault-around for MADV_SEQUENTIAL pages: after a fault at
+ * FAULTADDRESS, back the next few advised pages and load them into
+ * the TLB too, so a linear scan takes one fault per
+ * DUMBVM_FAULTAROUND pages instead of one per page. Copy-on-write
+ * frames are skipped; they still need a real fault to be copied.
+ */
+static
+void
+vm_faultaround(struct addrspace *as, struct region_info *ri,
+	       vaddr_t faultaddress, bool writeable)
+{
+    paddr_t pas[DUMBVM_FAULTAROUND];
+    vaddr_t va;
+    int n, i, spl;
+    bool allocated;
+
+    for(n = 0; n < DUMBVM_FAULTAROUND; ++n) {
+	va = faultaddress + (n + 1) * PAGE_SIZE;
+	if(va >= ri->ri_top || va < faultaddress) break;
+	if(!as_sequential(ri, va)) break;
+	if(as_populate(as, va, &allocated)) break;
+
+	pas[n] = *as_pte(as, va, false);
+
+	spinlock_acquire(&coremap_lock);
+	if(coremap[(pas[n] - startaddr) / PAGE_SIZE].num_of_owners > 1 &&
+	   !ri->ri_shared) {
+	    pas[n] = 0;
+	}
+	spinlock_release(&coremap_lock);
+    }
+
+    spl = splhigh();
+    for(i = 0; i < n; ++i) {
+	va = faultaddress + (i + 1) * PAGE_SIZE;
+	if(pas[i] == 0 || tlb_probe(va, 0) >= 0) continue;
+	tlb_load(va, pas[i] | TLBLO_VALID | (writeable ? TLBLO_DIRTY : 0));
+    }
+    splx(spl);
+
+    spinlock_acquire(&madvise_lock);
+    madvise_faultaround += n;
+    spinlock_release(&madvise_lock);
+}
+
+/*
+ * Invalidate the TLB entry (if any) for VADDR on this cpu. Call with
+ * interrupts off.
+ */
+static
+void
+tlb_invalidate(vaddr_t vaddr)
+{
+    int i = tlb_probe(vaddr & PAGE_FRAME, 0);
+    if(i >= 0) tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+}
+
+/*
+ * TLB miss on a kseg2 address. This runs with whatever locks the
+ * faulting code holds, so it only reads vmalloc_pt.
+ */
+static
+int
+vm_kseg2_fault(vaddr_t faultaddress)
+{
+    unsigned index = (faultaddress - MIPS_KSEG2) / PAGE_SIZE;
+    paddr_t paddr;
+    int spl;
+
+    if(index >= VMALLOC_PAGES) return EFAULT;
+    paddr = vmalloc_pt[index];
+    if(paddr == 0 || (paddr & VMALLOC_DEAD)) {
+	return EFAULT; // guard page, unallocated or freed
+    }
+
+    spl = splhigh();
+    tlb_load(faultaddress, paddr | TLBLO_DIRTY | TLBLO_VALID);
+    splx(spl);
+    return 0;
+}
+
+/*
+ * Find NPAGES free pages in a row in the arena, starting from the rotor
+ * so freed addresses are reused as late as possible. Call with
+ * vmalloc_lock held.
+ */
+static
+int
+vmalloc_findrange(unsigned npages, unsigned *ret)
+{
+    unsigned i = vmalloc_rotor, run = 0;
+
+    for(unsigned scanned = 0; scanned < VMALLOC_PAGES + npages; ++scanned) {
+	if(i == VMALLOC_PAGES) {
+	    i = 0; // ranges don't wrap around the end
+	    run = 0;
+	}
+	if(bitmap_isset(vmalloc_map, i)) {
+	    run = 0;
+	} else if(++run == npages) {
+	    *ret = i - npages + 1;
+	    return 0;
+	}
+	++i;
+    }
+    return ENOMEM;
+}
+
+/* True once every cpu VL's shootdowns went to has done them. */
+static
+bool
+vmalloc_limbo_done(const struct vmalloc_limbo *vl)
+{
+    for(unsigned i = 0; i < MAXCPUS; ++i) {
+	if((vl->vl_cpus & (1U << i)) &&
+	   (int)(tlb_ackgen[i] - vl->vl_gen) < 0) {
+	    return false;
+	}
+    }
+    return true;
+}
+
+/*
+ * Give back the frames and address space of freed ranges whose
+ * shootdowns are all done.
+ */
+static
+void
+vmalloc_reap(void)
+{
+    struct vmalloc_limbo *vl, **pvl, *done = NULL;
+    unsigned base, npages;
+    paddr_t pa;
+
+    spinlock_acquire(&vmalloc_lock);
+    pvl = &vmalloc_limbo;
+    while((vl = *pvl) != NULL) {
+	if(vmalloc_limbo_done(vl)) {
+	    *pvl = vl->vl_next;
+	    vl->vl_next = done;
+	    done = vl;
+	} else {
+	    pvl = &vl->vl_next;
+	}
+    }
+    spinlock_release(&vmalloc_lock);
+
+    while((vl = done) != NULL) {
+	// The record goes with the first frame, so read it all first
+	done = vl->vl_next;
+	base = vl->vl_base;
+	npages = vmalloc_npages[base];
+	for(unsigned i = 0; i < npages; ++i) {
+	    pa = vmalloc_pt[base + i];
+	    KASSERT(pa & VMALLOC_DEAD);
+	    vmalloc_pt[base + i] = 0;
+	    free_kpages(PADDR_TO_KVADDR(pa & PAGE_FRAME));
+	}
+
+	spinlock_acquire(&vmalloc_lock);
+	vmalloc_npages[base] = 0;
+	vmalloc_inuse -= npages;
+	for(unsigned i = base - 1; i < base + npages; ++i) {
+	    bitmap_unmark(vmalloc_map, i);
+	}
+	spinlock_release(&vmalloc_lock);
+    }
+}
+
+void *
+vmalloc(size_t size)
+{
+    unsigned npages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    unsigned base;
+    paddr_t pa;
+
+    KASSERT(npages > 0);
+
+    // Before vm_bootstrap there is no arena; stolen pages will have to do
+    if(!vm_is_bootstrapped) return (void *)alloc_kpages(npages);
+    if(npages >= VMALLOC_PAGES) return NULL;
+
+    vmalloc_reap();
+
+    spinlock_acquire(&vmalloc_lock);
+    if(vmalloc_findrange(npages + 1, &base)) {
+	spinlock_release(&vmalloc_lock);
+	return NULL;
+    }
+    for(unsigned i = base; i <= base + npages; ++i) {
+	bitmap_mark(vmalloc_map, i);
+    }
+    vmalloc_rotor = base + npages + 1;
+    spinlock_release(&vmalloc_lock);
+
+    // Page base is the guard; the allocation itself starts after it
+    ++base;
+    for(unsigned i = 0; i < npages; ++i) {
+	pa = page_alloc(1);
+	if(pa == 0) {
+	    for(unsigned j = 0; j < i; ++j) {
+		free_kpages(PADDR_TO_KVADDR(vmalloc_pt[base + j]));
+		vmalloc_pt[base + j] = 0;
+	    }
+	    spinlock_acquire(&vmalloc_lock);
+	    for(unsigned j = base - 1; j < base + npages; ++j) {
+		bitmap_unmark(vmalloc_map, j);
+	    }
+	    spinlock_release(&vmalloc_lock);
+	    return NULL;
+	}
+	vmalloc_pt[base + i] = pa;
+    }
+
+    spinlock_acquire(&vmalloc_lock);
+    vmalloc_npages[base] = npages;
+    vmalloc_inuse += npages;
+    spinlock_release(&vmalloc_lock);
+
+    return (void *)(MIPS_KSEG2 + base * PAGE_SIZE);
+}
+
+bool
+vm_isvmalloc(const void *ptr)
+{
+    return (vaddr_t)ptr >= MIPS_KSEG2;
+}
+
+void
+vfree(void *ptr)
+{
+    vaddr_t va = (vaddr_t) ptr;
+    struct tlbshootdown ts;
+    struct vmalloc_limbo *vl;
+    unsigned base, npages;
+
+    if(ptr == NULL) return;
+    if(!vm_isvmalloc(ptr)) {
+	kfree(ptr);
+	return;
+    }
+
+    KASSERT((va & ~(vaddr_t)PAGE_FRAME) == 0);
+    base = (va - MIPS_KSEG2) / PAGE_SIZE;
+    KASSERT(base > 0 && base < VMALLOC_PAGES);
+    npages = vmalloc_npages[base];
+    KASSERT(npages > 0);
+
+    // Stop TLB misses mapping the pages again, before any shootdown
+    for(unsigned i = 0; i < npages; ++i) {
+	KASSERT(vmalloc_pt[base + i] != 0);
+	vmalloc_pt[base + i] |= VMALLOC_DEAD;
+    }
+
+    /*
+     * Unmap everywhere. Other cpus handle the shootdown the next time
+     * they take an interrupt, so the frames wait in limbo until then.
+     */
+    vl = (struct vmalloc_limbo *)
+	PADDR_TO_KVADDR(vmalloc_pt[base] & PAGE_FRAME);
+    vl->vl_base = base;
+    vl->vl_cpus = 0;
+
+    spinlock_acquire(&vmalloc_lock);
+    vl->vl_gen = ++tlb_sendgen;
+    for(unsigned i = 0; i < npages; ++i) {
+	vaddr_t pva = va + i * PAGE_SIZE;
+	tlb_invalidate(pva);
+	ts.ts_addrspace = NULL;
+	ts.ts_vaddr = pva;
+	ts.ts_gen = vl->vl_gen;
+	vl->vl_cpus |= ipi_tlbshootdown_broadcast(&ts);
+    }
+    vl->vl_next = vmalloc_limbo;
+    vmalloc_limbo = vl;
+    spinlock_release(&vmalloc_lock);
+
+    vmalloc_reap();
+}
+
+/*
+ * Called from thread_switch, with interrupts off, just before switching
+ * onto the stack STACK. Stacks in kseg2 are loaded into the wired bank
+ * the running stack isn't using.
+ */
+void
+vm_wire_kstack(void *stack)
+{
+    vaddr_t va = (vaddr_t) stack;
+    unsigned cur = kstack_bank[curcpu->c_number];
+    unsigned bank = 1 - cur;
+    int old;
+
+    if(!vm_isvmalloc(stack)) return; // kseg0 needs no translations
+
+    // Switching back to the stack we are on (no other thread was ready)
+    old = tlb_probe(va, 0);
+    if(old >= 0 && (unsigned)old >= cur * KSTACK_PAGES &&
+       (unsigned)old < (cur + 1) * KSTACK_PAGES) {
+	return;
+    }
+
+    for(unsigned i = 0; i < KSTACK_PAGES; ++i, va += PAGE_SIZE) {
+	paddr_t pa = vmalloc_pt[(va - MIPS_KSEG2) / PAGE_SIZE];
+	unsigned slot = bank * KSTACK_PAGES + i;
+
+	KASSERT(pa != 0);
+	// The same page must never be in two slots at once
+	old = tlb_probe(va, 0);
+	if(old >= 0 && (unsigned)old != slot) {
+	    tlb_write(TLBHI_INVALID(old), TLBLO_INVALID(), old);
+	}
+	tlb_write(va, pa | TLBLO_DIRTY | TLBLO_VALID, slot);
+    }
+    kstack_bank[curcpu->c_number] = bank;
+}
+
+/*
+ * Number of frames nobody owns. It's only a snapshot, for callers
+ * deciding whether to hang on to memory they could give back.
+ */
+unsigned
+vm_freepages(void)
+{
+    return coremap_nfree;
+}
+
+void
+vm_printstats(void)
+{
+    kprintf("coremap: %u of %d frames free\n",
+	    coremap_nfree, number_of_pages - first_page_index);
+    spinlock_acquire(&vmalloc_lock);
+    kprintf("vmalloc: %u of %u kseg2 pages mapped\n",
+	    vmalloc_inuse, VMALLOC_PAGES);
+    spinlock_release(&vmalloc_lock);
+
+#if OPT_IPT
+    ipt_printstats(atomic_load(&vm_naddrspaces));
+#else
+    unsigned nas = atomic_load(&vm_naddrspaces);
+    unsigned ntables = atomic_load(&vm_npagetables);
+    unsigned bytes = nas * PAGE_DIR_SIZE * sizeof(paddr_t *) +
+		     ntables * PAGE_TABLE_SIZE * sizeof(paddr_t);
+    kprintf("page tables: %u address spaces, %u tables, %u bytes, "
+	    "%u per address space\n",
+	    nas, ntables, bytes, nas == 0 ? 0 : bytes / nas);
+#endif
+
+    spinlock_acquire(&madvise_lock);
+    kprintf("madvise calls: normal %u, random %u, sequential %u, "
+	    "willneed %u, dontneed %u\n",
+	    madvise_calls[MADV_NORMAL], madvise_calls[MADV_RANDOM],
+	    madvise_calls[MADV_SEQUENTIAL], madvise_calls[MADV_WILLNEED],
+	    madvise_calls[MADV_DONTNEED]);
+    kprintf("madvise pages: %u dropped, %u prefaulted, %u faulted around\n",
+	    madvise_dropped, madvise_prefaulted, madvise_faultaround);
+    spinlock_release(&madvise_lock);
+}
+#endif // OPT_A3
+
+#if OPT_A3
+/* Note that this cpu has done the shootdowns up to generation GEN. */
+static
+void
+vm_tlbshootdown_ack(unsigned gen)
+{
+	unsigned me = curcpu->c_number;
+
+	if ((int)(gen - tlb_ackgen[me]) > 0) {
+		tlb_ackgen[me] = gen;
+	}
+}
+
+/*
+ * Shootdowns come from vfree. Flushing everything has to spare the bank
+ * holding the running stack; the other bank only ever holds stacks of
+ * threads that aren't running here, so it can go.
+ *
+ * A flush done after a range was marked dead covers its shootdowns
+ * whether or not they were among those dropped to ask for the flush,
+ * so it acknowledges every generation handed out before it started.
+ */
+void
+vm_tlbshootdown_all(void)
+{
+	unsigned cur = kstack_bank[curcpu->c_number];
+	unsigned gen;
+	int i, spl;
+
+	spl = splhigh();
+	gen = tlb_sendgen;
+	for (i=0; i<NUM_TLB; i++) {
+		if (i >= (int)(cur * KSTACK_PAGES) &&
+		    i < (int)((cur + 1) * KSTACK_PAGES)) {
+			continue;
+		}
+		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+	}
+	vm_tlbshootdown_ack(gen);
+	splx(spl);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+	int spl;
+
+	spl = splhigh();
+	tlb_invalidate(ts->ts_vaddr);
+	vm_tlbshootdown_ack(ts->ts_gen);
+	splx(spl);
+}
+#else
 void
 vm_tlbshootdown_all(void)
 {
@@ -209,13 +1008,12 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	(void)ts;
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
+#endif // OPT_A3
 
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
-	int i;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
@@ -224,6 +1022,17 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
 
+#if OPT_A3
+	/* Kernel virtual memory; handled the same for every process. */
+	if (faultaddress >= MIPS_KSEG2) {
+		if (faulttype == VM_FAULT_READONLY) {
+			panic("dumbvm: readonly fault on kseg2 0x%x\n",
+			      faultaddress);
+		}
+		return vm_kseg2_fault(faultaddress);
+	}
+#endif
+
 	switch (faulttype) {
 	    case VM_FAULT_READONLY:
 #if OPT_A3
@@ -259,7 +1068,9 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 
 	/* Assert that the address space has been set up properly. */
 #if OPT_A3
+#if !OPT_IPT
 	KASSERT(as->as_pagedir != 0);
+#endif
 	KASSERT(as->as_vbase1 != 0);
 	KASSERT(as->as_npages1 != 0);
 	KASSERT(as->as_vbase2 != 0);
@@ -267,60 +1078,49 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
 	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
 
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	bool writeable;
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		writeable = (as->as_permissions1 & PF_W) != 0;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		writeable = (as->as_permissions2 & PF_W) != 0;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		writeable = true;
-	}
-	else {
+	struct region_info ri;
+	if (!as_lookup_region(as, faultaddress, &ri)) {
 		return EFAULT;
 	}
-
-	int dir_number = faultaddress >> 22;
-	int page_number = (faultaddress << 10) >> 22;
-
-	if(as->as_pagedir[dir_number] == NULL) {
-	    as->as_pagedir[dir_number] = kmalloc(PAGE_TABLE_SIZE * sizeof(paddr_t));
-	}
-	if(as->as_pagedir[dir_number] == NULL) {
-	    return ENOMEM;
+	if (ri.ri_map != NULL && ri.ri_map->map_permissions == 0) {
+		return EFAULT; // PROT_NONE
 	}
+	bool writeable = (ri.ri_permissions & PF_W) != 0;
+	bool shared = ri.ri_shared;
 
-	if(as->as_pagedir[dir_number][page_number] == 0) {
-	    as->as_pagedir[dir_number][page_number] = page_alloc(1);
-	    if(as->as_pagedir[dir_number][page_number] == 0) {
+	paddr_t *pte = as_pte(as, faultaddress, false);
+	if(pte == NULL || *pte == 0) {
+	    pte = as_pte_newframe(as, faultaddress);
+	    if(pte == NULL) {
 		return ENOMEM;
 	    }
 	}
-	paddr = as->as_pagedir[dir_number][page_number];
+	paddr = *pte;
 
+	/*
+	 * Frames with more than one owner are copy-on-write, except in
+	 * MAP_SHARED regions where every owner sees the same frame.
+	 */
 	int index = (paddr - startaddr) / PAGE_SIZE;
 	spinlock_acquire(&coremap_lock);
-	if(coremap[index].num_of_owners > 1) {
-	    as->as_pagedir[dir_number][page_number] = unprotected_page_alloc(1);
-	    if(as->as_pagedir[dir_number][page_number] == 0) {
+	if(coremap[index].num_of_owners > 1 && !shared) {
+	    *pte = unprotected_page_alloc(1);
+	    if(*pte == 0) {
+		*pte = paddr;
+		spinlock_release(&coremap_lock);
 		return ENOMEM;
 	    }
-	    memmove((void*) PADDR_TO_KVADDR(as->as_pagedir[dir_number][page_number]),
+	    memmove((void*) PADDR_TO_KVADDR(*pte),
 		    (const void*) PADDR_TO_KVADDR(paddr),
 		    PAGE_SIZE);
-	    paddr = as->as_pagedir[dir_number][page_number];
+	    paddr = *pte;
 	    --coremap[index].num_of_owners;
 	}
 	spinlock_release(&coremap_lock);
 #else
+	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
+	int i;
+
 	KASSERT(as->as_vbase1 != 0);
 	KASSERT(as->as_pbase1 != 0);
 	KASSERT(as->as_npages1 != 0);
@@ -362,20 +1162,18 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	spl = splhigh();
 
 #if OPT_A3
-    for (i=0; i<NUM_TLB; i++) {
-	tlb_read(&ehi, &elo, i);
-	if(!(elo & TLBLO_VALID)) break;
-    }
-
     ehi = faultaddress;
     elo = paddr | TLBLO_VALID;
     if(writeable) elo |= TLBLO_DIRTY;
 
     DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-    if(i==NUM_TLB) tlb_random(ehi, elo); // TLB is full simply overwrite a random entry
-    else	   tlb_write(ehi, elo, i);
+    tlb_load(ehi, elo);
 
     splx(spl);
+
+    if(as_sequential(&ri, faultaddress)) {
+	vm_faultaround(as, &ri, faultaddress, writeable);
+    }
     return 0;
 #else
 	for (i=0; i<NUM_TLB; i++) {
@@ -425,19 +1223,38 @@ as_create(void)
     struct addrspace* as = kmalloc(sizeof(struct addrspace));
     if(as == NULL) return NULL;
 
+#if OPT_IPT
+    as->as_iptlist = IPT_NONE;
+#else
     as->as_pagedir = kmalloc(PAGE_DIR_SIZE * sizeof(paddr_t*));
     if(as->as_pagedir == NULL) {
 	kfree(as);
 	return NULL;
     }
+    bzero(as->as_pagedir, PAGE_DIR_SIZE * sizeof(paddr_t*));
+#endif
+    atomic_add(&vm_naddrspaces, 1);
 
     as->as_vbase1 = 0;
     as->as_npages1 = 0;
     as->as_permissions1 = 0;
+    as->as_sequential1 = NULL;
 
     as->as_vbase2 = 0;
     as->as_npages2 = 0;
     as->as_permissions2 = 0;
+    as->as_sequential2 = NULL;
+
+    as->as_stacksequential = NULL;
+
+    for(int i = 0; i < AS_MAXMAPS; ++i) {
+	as->as_maps[i].map_vbase = 0;
+	as->as_maps[i].map_npages = 0;
+	as->as_maps[i].map_permissions = 0;
+	as->as_maps[i].map_shared = false;
+	as->as_maps[i].map_sequential = NULL;
+    }
+    as->as_mmapnext = AS_MMAPBASE;
 
     return as;
 #else
@@ -464,27 +1281,34 @@ void
 as_destroy(struct addrspace *as)
 {
 #if OPT_A3
+#if OPT_IPT
+	ipt_destroy(as, frame_release);
+#else
 	for(int  i = 0; i < PAGE_DIR_SIZE; ++i) {
 	    if(as->as_pagedir[i] != NULL) {
-		spinlock_acquire(&coremap_lock);
 		for(int j = 0; j < PAGE_TABLE_SIZE; ++j) {
 		    if(as->as_pagedir[i][j] != 0) {
-			int k = (as->as_pagedir[i][j] - startaddr) / PAGE_SIZE;
-			if(coremap[k].num_of_owners == 1) {
-			    coremap[k].num_pages_used = 0;
-			}
-			--coremap[k].num_of_owners;
-			spinlock_release(&coremap_lock);
-			bzero((void *)PADDR_TO_KVADDR(as->as_pagedir[i][j]), PAGE_SIZE);
-			spinlock_acquire(&coremap_lock);
+			frame_release(as->as_pagedir[i][j]);
 		    }
 		}
-		spinlock_release(&coremap_lock);
 		kfree(as->as_pagedir[i]);
+		atomic_add(&vm_npagetables, -1);
 	    }
 	}
 
 	kfree(as->as_pagedir);
+#endif // OPT_IPT
+	if(as->as_sequential1 != NULL) bitmap_destroy(as->as_sequential1);
+	if(as->as_sequential2 != NULL) bitmap_destroy(as->as_sequential2);
+	if(as->as_stacksequential != NULL) {
+	    bitmap_destroy(as->as_stacksequential);
+	}
+	for(int i = 0; i < AS_MAXMAPS; ++i) {
+	    if(as->as_maps[i].map_sequential != NULL) {
+		bitmap_destroy(as->as_maps[i].map_sequential);
+	    }
+	}
+	atomic_add(&vm_naddrspaces, -1);
 #endif //OPT_A3
 	kfree(as);
 }
@@ -506,7 +1330,12 @@ as_activate(void)
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
+#if OPT_A3
+	/* Leave the wired kernel stack entries alone. */
+	for (i=DUMBVM_WIREDSLOTS; i<NUM_TLB; i++) {
+#else
 	for (i=0; i<NUM_TLB; i++) {
+#endif
 		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
 	}
 
@@ -629,6 +1458,188 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+#if OPT_A3
+struct as_mapping *
+as_find_mapping(struct addrspace *as, vaddr_t vaddr)
+{
+    for(int i = 0; i < AS_MAXMAPS; ++i) {
+	struct as_mapping *map = &as->as_maps[i];
+	if(map->map_vbase != 0 && vaddr >= map->map_vbase &&
+	   vaddr < map->map_vbase + map->map_npages * PAGE_SIZE) {
+	    return map;
+	}
+    }
+    return NULL;
+}
+
+int
+as_define_mapping(struct addrspace *as, size_t npages, int permissions,
+		  bool shared, vaddr_t *ret)
+{
+    struct as_mapping *map = NULL;
+    vaddr_t stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+    vaddr_t vbase = as->as_mmapnext;
+
+    KASSERT(npages > 0);
+
+    for(int i = 0; i < AS_MAXMAPS; ++i) {
+	if(as->as_maps[i].map_vbase == 0) {
+	    map = &as->as_maps[i];
+	    break;
+	}
+    }
+    if(map == NULL) return ENOMEM;
+
+    // Address space is never reused, so just check we stay below the stack
+    if(npages > (stackbase - vbase) / PAGE_SIZE) return ENOMEM;
+
+    /*
+     * Populate the whole region now rather than on first touch, so a
+     * child forked before the pages are used still shares them.
+     */
+    for(size_t i = 0; i < npages; ++i) {
+	vaddr_t va = vbase + i * PAGE_SIZE;
+	paddr_t *pte = as_pte_newframe(as, va);
+	if(pte == NULL) {
+	    // Unwind what we already mapped
+	    for(size_t j = 0; j < i; ++j) {
+		pte = as_pte(as, vbase + j * PAGE_SIZE, false);
+		frame_release(*pte);
+		as_pte_clear(as, vbase + j * PAGE_SIZE);
+	    }
+	    return ENOMEM;
+	}
+	bzero((void *)PADDR_TO_KVADDR(*pte), PAGE_SIZE);
+    }
+
+    map->map_vbase = vbase;
+    map->map_npages = npages;
+    map->map_permissions = permissions;
+    map->map_shared = shared;
+    map->map_sequential = NULL;
+    as->as_mmapnext = vbase + npages * PAGE_SIZE;
+
+    *ret = vbase;
+    return 0;
+}
+
+int
+as_remove_mapping(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+    struct as_mapping *map = as_find_mapping(as, vaddr);
+
+    // Only whole mappings can be removed
+    if(map == NULL || map->map_vbase != vaddr || map->map_npages != npages) {
+	return EINVAL;
+    }
+
+    for(size_t i = 0; i < npages; ++i) {
+	paddr_t *pte = as_pte(as, vaddr + i * PAGE_SIZE, false);
+	if(pte != NULL && *pte != 0) {
+	    frame_release(*pte);
+	}
+	as_pte_clear(as, vaddr + i * PAGE_SIZE);
+    }
+
+    map->map_vbase = 0;
+    map->map_npages = 0;
+    map->map_permissions = 0;
+    map->map_shared = false;
+    if(map->map_sequential != NULL) {
+	bitmap_destroy(map->map_sequential);
+	map->map_sequential = NULL;
+    }
+
+    as_activate(); // Drop any stale translations for the region
+    return 0;
+}
+
+/*
+ * madvise. Each kind of advice applies to just the pages named, even
+ * where a region holds more. There is no backing store, so DONTNEED
+ * simply discards the pages; the next touch sees a zero-filled page.
+ * That would lose the contents of the regions loaded from the
+ * executable, so it is only allowed on the stack and on mmap regions,
+ * and is ignored on MAP_SHARED ones, whose frames belong to every
+ * process sharing them. With nothing to reclaim, NORMAL and RANDOM
+ * only turn SEQUENTIAL's fault-around off again.
+ */
+int
+as_advise(struct addrspace *as, vaddr_t vaddr, size_t npages, int advice)
+{
+    struct region_info ri;
+    struct bitmap **seq;
+    unsigned count = 0;
+    unsigned page;
+    bool allocated;
+    int result = 0;
+
+    KASSERT(advice >= MADV_NORMAL && advice <= MADV_DONTNEED);
+
+    // Check the whole range first so a bad range has no partial effect
+    for(size_t i = 0; i < npages; ++i) {
+	if(!as_lookup_region(as, vaddr + i * PAGE_SIZE, &ri)) return ENOMEM;
+	if(advice == MADV_DONTNEED && ri.ri_filebacked) return EINVAL;
+    }
+
+    for(size_t i = 0; i < npages; ++i) {
+	vaddr_t va = vaddr + i * PAGE_SIZE;
+	paddr_t *pte;
+
+	as_lookup_region(as, va, &ri);
+	seq = ri.ri_sequential;
+	page = (va - ri.ri_base) / PAGE_SIZE;
+	switch(advice) {
+	    case MADV_NORMAL:
+	    case MADV_RANDOM:
+		if(*seq != NULL && bitmap_isset(*seq, page)) {
+		    bitmap_unmark(*seq, page);
+		}
+		break;
+	    case MADV_SEQUENTIAL:
+		if(*seq == NULL) {
+		    *seq = bitmap_create((ri.ri_top - ri.ri_base) / PAGE_SIZE);
+		    if(*seq == NULL) {
+			result = EAGAIN;
+			goto done;
+		    }
+		}
+		if(!bitmap_isset(*seq, page)) bitmap_mark(*seq, page);
+		break;
+	    case MADV_WILLNEED:
+		if(as_populate(as, va, &allocated)) {
+		    result = EAGAIN;
+		    goto done;
+		}
+		if(allocated) ++count;
+		break;
+	    case MADV_DONTNEED:
+		if(ri.ri_shared) break;
+		pte = as_pte(as, va, false);
+		if(pte != NULL && *pte != 0) {
+		    frame_release(*pte);
+		    as_pte_clear(as, va);
+		    ++count;
+		}
+		break;
+	}
+    }
+
+ done:
+    if(advice == MADV_DONTNEED && count > 0) {
+	as_activate(); // Forget translations to the frames we just freed
+    }
+
+    spinlock_acquire(&madvise_lock);
+    ++madvise_calls[advice];
+    if(advice == MADV_WILLNEED) madvise_prefaulted += count;
+    if(advice == MADV_DONTNEED) madvise_dropped += count;
+    spinlock_release(&madvise_lock);
+
+    return result;
+}
+#endif // OPT_A3
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -645,6 +1656,48 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 	new->as_npages2 = old->as_npages2;
 
 #if OPT_A3
+	new->as_permissions1 = old->as_permissions1;
+	new->as_permissions2 = old->as_permissions2;
+
+	/*
+	 * mmap regions come along too. Their frames are shared through
+	 * the page table copy below; whether a write then copies them is
+	 * decided per region in vm_fault.
+	 */
+	for(int i = 0; i < AS_MAXMAPS; ++i) {
+	    new->as_maps[i] = old->as_maps[i];
+	    new->as_maps[i].map_sequential = NULL;
+	}
+	new->as_mmapnext = old->as_mmapnext;
+
+	// So does the madvise state; the bitmaps can't be shared
+	int result = as_copy_sequential(old->as_sequential1,
+					old->as_npages1, &new->as_sequential1);
+	if(!result) {
+	    result = as_copy_sequential(old->as_sequential2, old->as_npages2,
+					&new->as_sequential2);
+	}
+	if(!result) {
+	    result = as_copy_sequential(old->as_stacksequential,
+					DUMBVM_STACKPAGES,
+					&new->as_stacksequential);
+	}
+	for(int i = 0; i < AS_MAXMAPS && !result; ++i) {
+	    result = as_copy_sequential(old->as_maps[i].map_sequential,
+					old->as_maps[i].map_npages,
+					&new->as_maps[i].map_sequential);
+	}
+	if(result) {
+	    as_destroy(new);
+	    return result;
+	}
+
+#if OPT_IPT
+	if(ipt_copy(old, new, frame_share)) {
+	    as_destroy(new);
+	    return ENOMEM;
+	}
+#else
 	for(int i = 0; i < PAGE_DIR_SIZE; ++i) {
 	    if(old->as_pagedir[i] != NULL) {
 		new->as_pagedir[i] = kmalloc(PAGE_TABLE_SIZE * sizeof(paddr_t));
@@ -652,17 +1705,17 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 		    as_destroy(new);
 		    return ENOMEM;
 		}
+		bzero(new->as_pagedir[i], PAGE_TABLE_SIZE * sizeof(paddr_t));
+		atomic_add(&vm_npagetables, 1);
 		for(int j = 0; j < PAGE_TABLE_SIZE; ++j) {
 		    if(old->as_pagedir[i][j] != 0) {
 			new->as_pagedir[i][j] = old->as_pagedir[i][j];
-			int index = (new->as_pagedir[i][j] - startaddr) / PAGE_SIZE;
-			spinlock_acquire(&coremap_lock);
-			coremap[index].num_of_owners++;
-			spinlock_release(&coremap_lock);
+			frame_share(new->as_pagedir[i][j]);
 		    }
 		}
 	    }
 	}
+#endif // OPT_IPT
 
 	as_activate(); // Clear TLB so on next write Copy-on-Write will take effect
 #else
@@ -0,0 +1,330 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <mips/ipt.h>
+
+/*
+ * Hashed inverted page table (see <mips/ipt.h>).
+ *
+ * Entries are numbered and linked by number: ie_next chains a hash
+ * bucket (or the free list), ie_asnext/ie_asprev chain all entries of
+ * one address space so copy and destroy don't have to search the whole
+ * table. Everything is protected by ipt_lock.
+ *
+ * Entries come in chunks of a page each, found through ipt_chunks.
+ * The pool starts with about one entry per user frame and grows by a
+ * chunk whenever it runs out, since copy-on-write and MAP_SHARED
+ * frames can be mapped by any number of address spaces. Chunks never
+ * move, so pointers to entries stay good, and are never given back.
+ * ipt_chunks has a slot for every user frame, more chunks than memory
+ * could hold, so the pool only stops growing when memory runs out.
+ *
+ * Kernel memory for page tables, per address space, is printed by the
+ * "vm" menu command, for this and for the two-level tables.
+ */
+
+struct ipt_entry {
+    struct addrspace *ie_as;	/* owner; NULL if free */
+    vaddr_t ie_vpn;		/* virtual page number */
+    paddr_t ie_paddr;		/* frame, or 0 if not yet filled in */
+    int ie_next;		/* hash chain or free list */
+    int ie_asnext;		/* owner's entry list */
+    int ie_asprev;
+};
+
+#define IPT_PERCHUNK	(PAGE_SIZE / sizeof(struct ipt_entry))
+
+static struct spinlock ipt_lock = SPINLOCK_INITIALIZER;
+static struct ipt_entry **ipt_chunks;
+static unsigned ipt_nchunks;
+static unsigned ipt_maxchunks;
+static int *ipt_buckets;
+static unsigned ipt_nentries;
+static unsigned ipt_nbuckets;	/* power of two */
+static int ipt_freelist;
+static unsigned ipt_inuse;
+
+static
+struct ipt_entry *
+ipt_entry(int i)
+{
+    return &ipt_chunks[(unsigned)i / IPT_PERCHUNK][(unsigned)i % IPT_PERCHUNK];
+}
+
+static
+unsigned
+ipt_hash(struct addrspace *as, vaddr_t vpn)
+{
+    uint32_t h = (uint32_t)as ^ (vpn * 0x9e3779b1);
+    return (h ^ (h >> 16)) & (ipt_nbuckets - 1);
+}
+
+/*
+ * Number the entries in CHUNK and put them on the free list. Call with
+ * ipt_lock held.
+ */
+static
+void
+ipt_addchunk(struct ipt_entry *chunk)
+{
+    unsigned base = ipt_nchunks * IPT_PERCHUNK;
+
+    KASSERT(ipt_nchunks < ipt_maxchunks);
+    ipt_chunks[ipt_nchunks++] = chunk;
+    for(unsigned i = 0; i < IPT_PERCHUNK; ++i) {
+	chunk[i].ie_as = NULL;
+	chunk[i].ie_next = (i + 1 < IPT_PERCHUNK) ? (int)(base + i + 1)
+						   : ipt_freelist;
+    }
+    ipt_freelist = base;
+    ipt_nentries += IPT_PERCHUNK;
+}
+
+/*
+ * Make sure at least N entries are free, adding chunks if need be, and
+ * return with ipt_lock held. Returns false, without the lock, if
+ * memory runs out first. The lock is dropped to allocate, so anything
+ * looked up before calling has to be looked up again.
+ */
+static
+bool
+ipt_reserve(unsigned n)
+{
+    vaddr_t va;
+
+    spinlock_acquire(&ipt_lock);
+    while(ipt_nentries - ipt_inuse < n) {
+	spinlock_release(&ipt_lock);
+	va = alloc_kpages(1);
+	if(va == 0) return false;
+	spinlock_acquire(&ipt_lock);
+	if(ipt_nchunks == ipt_maxchunks) {
+	    spinlock_release(&ipt_lock);
+	    free_kpages(va);
+	    return false;
+	}
+	ipt_addchunk((struct ipt_entry *) va);
+    }
+    return true;
+}
+
+void
+ipt_bootstrap(unsigned nframes)
+{
+    size_t bytes;
+    vaddr_t va;
+
+    ipt_maxchunks = nframes;
+    for(ipt_nbuckets = 1; ipt_nbuckets < nframes; ipt_nbuckets <<= 1);
+
+    bytes = ipt_maxchunks * sizeof(struct ipt_entry *) +
+	    ipt_nbuckets * sizeof(int);
+    va = alloc_kpages((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    if(va == 0) {
+	panic("ipt_bootstrap: no memory for %u buckets\n", ipt_nbuckets);
+    }
+    ipt_chunks = (struct ipt_entry **) va;
+    ipt_buckets = (int *)(ipt_chunks + ipt_maxchunks);
+
+    for(unsigned i = 0; i < ipt_nbuckets; ++i) {
+	ipt_buckets[i] = IPT_NONE;
+    }
+    ipt_nchunks = 0;
+    ipt_nentries = 0;
+    ipt_freelist = IPT_NONE;
+    ipt_inuse = 0;
+
+    if(!ipt_reserve(nframes)) {
+	panic("ipt_bootstrap: no memory for %u entries\n", nframes);
+    }
+    spinlock_release(&ipt_lock);
+}
+
+/*
+ * Find the entry for (AS, VPN). Call with ipt_lock held.
+ */
+static
+int
+ipt_find(struct addrspace *as, vaddr_t vpn)
+{
+    int i = ipt_buckets[ipt_hash(as, vpn)];
+
+    while(i != IPT_NONE) {
+	if(ipt_entry(i)->ie_as == as && ipt_entry(i)->ie_vpn == vpn) break;
+	i = ipt_entry(i)->ie_next;
+    }
+    return i;
+}
+
+/*
+ * Take an entry off the free list and link it in for (AS, VPN). Call
+ * with ipt_lock held. Returns IPT_NONE if the pool is empty.
+ */
+static
+int
+ipt_insert(struct addrspace *as, vaddr_t vpn, paddr_t paddr)
+{
+    int i = ipt_freelist;
+    struct ipt_entry *e;
+    unsigned b;
+
+    if(i == IPT_NONE) return IPT_NONE;
+    e = ipt_entry(i);
+    ipt_freelist = e->ie_next;
+
+    b = ipt_hash(as, vpn);
+    e->ie_as = as;
+    e->ie_vpn = vpn;
+    e->ie_paddr = paddr;
+    e->ie_next = ipt_buckets[b];
+    ipt_buckets[b] = i;
+
+    e->ie_asprev = IPT_NONE;
+    e->ie_asnext = as->as_iptlist;
+    if(as->as_iptlist != IPT_NONE) {
+	ipt_entry(as->as_iptlist)->ie_asprev = i;
+    }
+    as->as_iptlist = i;
+
+    ++ipt_inuse;
+    return i;
+}
+
+/*
+ * Unlink entry I and put it back on the free list. Call with ipt_lock
+ * held.
+ */
+static
+void
+ipt_unlink(int i)
+{
+    struct ipt_entry *e = ipt_entry(i);
+    struct addrspace *as = e->ie_as;
+    int *p;
+
+    for(p = &ipt_buckets[ipt_hash(as, e->ie_vpn)]; *p != i;
+	p = &ipt_entry(*p)->ie_next) {
+	KASSERT(*p != IPT_NONE);
+    }
+    *p = e->ie_next;
+
+    if(e->ie_asprev != IPT_NONE) {
+	ipt_entry(e->ie_asprev)->ie_asnext = e->ie_asnext;
+    } else {
+	as->as_iptlist = e->ie_asnext;
+    }
+    if(e->ie_asnext != IPT_NONE) {
+	ipt_entry(e->ie_asnext)->ie_asprev = e->ie_asprev;
+    }
+
+    e->ie_as = NULL;
+    e->ie_next = ipt_freelist;
+    ipt_freelist = i;
+    --ipt_inuse;
+}
+
+paddr_t *
+ipt_lookup(struct addrspace *as, vaddr_t vaddr, bool create)
+{
+    vaddr_t vpn = vaddr / PAGE_SIZE;
+    paddr_t *ret = NULL;
+    int i;
+
+    spinlock_acquire(&ipt_lock);
+    i = ipt_find(as, vpn);
+    if(i == IPT_NONE && create) {
+	if(ipt_freelist == IPT_NONE) {
+	    // Out of entries; grow the pool and look again
+	    spinlock_release(&ipt_lock);
+	    if(!ipt_reserve(1)) return NULL;
+	    i = ipt_find(as, vpn);
+	}
+	if(i == IPT_NONE) i = ipt_insert(as, vpn, 0);
+    }
+    if(i != IPT_NONE) ret = &ipt_entry(i)->ie_paddr;
+    spinlock_release(&ipt_lock);
+
+    return ret;
+}
+
+void
+ipt_remove(struct addrspace *as, vaddr_t vaddr)
+{
+    int i;
+
+    spinlock_acquire(&ipt_lock);
+    i = ipt_find(as, vaddr / PAGE_SIZE);
+    if(i != IPT_NONE) ipt_unlink(i);
+    spinlock_release(&ipt_lock);
+}
+
+int
+ipt_copy(struct addrspace *old, struct addrspace *new,
+	 void (*share)(paddr_t))
+{
+    unsigned n = 0;
+    int result = 0;
+
+    // Count what's needed, then make sure the pool has that many
+    spinlock_acquire(&ipt_lock);
+    for(int i = old->as_iptlist; i != IPT_NONE; i = ipt_entry(i)->ie_asnext) {
+	if(ipt_entry(i)->ie_paddr != 0) ++n;
+    }
+    spinlock_release(&ipt_lock);
+    if(!ipt_reserve(n)) return ENOMEM;
+
+    for(int i = old->as_iptlist; i != IPT_NONE; i = ipt_entry(i)->ie_asnext) {
+	paddr_t paddr = ipt_entry(i)->ie_paddr;
+	if(paddr == 0) continue;
+	if(ipt_insert(new, ipt_entry(i)->ie_vpn, paddr) == IPT_NONE) {
+	    result = ENOMEM;
+	    break;
+	}
+	share(paddr);
+    }
+    spinlock_release(&ipt_lock);
+
+    return result;
+}
+
+void
+ipt_destroy(struct addrspace *as, void (*release)(paddr_t))
+{
+    paddr_t paddr;
+    int i;
+
+    spinlock_acquire(&ipt_lock);
+    while((i = as->as_iptlist) != IPT_NONE) {
+	paddr = ipt_entry(i)->ie_paddr;
+	ipt_unlink(i);
+	if(paddr != 0) {
+	    // Releasing may zero the frame; don't do that under the lock
+	    spinlock_release(&ipt_lock);
+	    release(paddr);
+	    spinlock_acquire(&ipt_lock);
+	}
+    }
+    spinlock_release(&ipt_lock);
+}
+
+void
+ipt_printstats(unsigned nas)
+{
+    unsigned used, pool;
+
+    spinlock_acquire(&ipt_lock);
+    used = ipt_inuse * sizeof(struct ipt_entry);
+    pool = ipt_nchunks * PAGE_SIZE +
+	   ipt_maxchunks * sizeof(struct ipt_entry *) +
+	   ipt_nbuckets * sizeof(int);
+    kprintf("ipt: %u of %u entries in use in %u chunks (%u buckets), "
+	    "%u bytes in all\n",
+	    ipt_inuse, ipt_nentries, ipt_nchunks, ipt_nbuckets, pool);
+    kprintf("page tables: %u address spaces, %u bytes of entries, "
+	    "%u per address space\n",
+	    nas, used, nas == 0 ? 0 : used / nas);
+    spinlock_release(&ipt_lock);
+}
@@ -55,8 +55,25 @@
  *
  * The c0_count register increments on every cycle; when the value
  * matches the c0_compare register, the timer interrupt line is
- * asserted. Writing to c0_compare again clears the interrupt.
+ * asserted, and System/161 resets c0_count to 0. Writing to
+ * c0_compare again clears the interrupt.
  */
+static
+uint32_t
+mips_timer_get(void)
+{
+	uint32_t count;
+
+	/* $9 == c0_count */
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mfc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		: "=r" (count));
+	return count;
+}
+
 static
 void
 mips_timer_set(uint32_t count)
@@ -73,6 +90,29 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Start and stop hardclock on this cpu, for the tickless option. The
+ * on-chip timer can't be switched off, so stopping it means setting it
+ * as far ahead as it goes (about three minutes); if it does go off,
+ * hardclock just stops it again.
+ *
+ * While stopped, c0_count keeps counting up from the last tick and is
+ * likely past CPU_FREQUENCY / HZ by now, so restarting sets the next
+ * tick that far from the current count. Once it goes off, c0_count is
+ * reset and the ticks are evenly spaced again.
+ */
+void
+mainbus_hardclock_start(void)
+{
+	mips_timer_set(mips_timer_get() + CPU_FREQUENCY / HZ);
+}
+
+void
+mainbus_hardclock_stop(void)
+{
+	mips_timer_set(0xffffffff);
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -71,8 +71,10 @@ static struct con_softc *the_console = NULL;
  * Lock so user I/Os are atomic.
  * We use two locks so readers waiting for input don't lock out writers.
  */
-static struct lock *con_userlock_read = NULL;
-static struct lock *con_userlock_write = NULL;
+static struct lock con_userlock_read =
+	LOCK_INITIALIZER(con_userlock_read, "console-lock-read");
+static struct lock con_userlock_write =
+	LOCK_INITIALIZER(con_userlock_write, "console-lock-write");
 
 //////////////////////////////////////////////////
 
@@ -149,7 +151,7 @@ static
 void
 putch_intr(struct con_softc *cs, int ch)
 {
-	P(cs->cs_wsem);
+	P(&cs->cs_wsem);
 	cs->cs_send(cs->cs_devdata, ch);
 }
 
@@ -162,7 +164,7 @@ getch_intr(struct con_softc *cs)
 {
 	unsigned char ret;
 
-	P(cs->cs_rsem);
+	P(&cs->cs_rsem);
 	ret = cs->cs_gotchars[cs->cs_gotchars_tail];
 	cs->cs_gotchars_tail =
 		(cs->cs_gotchars_tail + 1) % CONSOLE_INPUT_BUFFER_SIZE;
@@ -193,7 +195,7 @@ con_input(void *vcs, int ch)
 	cs->cs_gotchars[cs->cs_gotchars_head] = ch;
 	cs->cs_gotchars_head = nexthead;
 		
-	V(cs->cs_rsem);
+	V(&cs->cs_rsem);
 }
 
 /*
@@ -204,7 +206,7 @@ con_start(void *vcs)
 {
 	struct con_softc *cs = vcs;
 
-	V(cs->cs_wsem);
+	V(&cs->cs_wsem);
 }
 
 //////////////////////////////////////////////////
@@ -309,13 +311,13 @@ con_io(struct device *dev, struct uio *uio)
 	(void)dev;  // unused
 
 	if (uio->uio_rw==UIO_READ) {
-		lk = con_userlock_read;
+		lk = &con_userlock_read;
 	}
 	else {
-		lk = con_userlock_write;
+		lk = &con_userlock_write;
 	}
 
-	KASSERT(lk != NULL);
+	KASSERT(the_console != NULL);
 	lock_acquire(lk);
 
 	while (uio->uio_resid > 0) {
@@ -398,9 +400,6 @@ attach_console_to_vfs(struct con_softc *cs)
 int
 config_con(struct con_softc *cs, int unit)
 {
-	struct semaphore *rsem, *wsem;
-	struct lock *rlk, *wlk;
-
 	/*
 	 * Only allow one system console.
 	 * Further devices that could be the system console are ignored.
@@ -414,37 +413,12 @@ config_con(struct con_softc *cs, int unit)
 	}
 	KASSERT(the_console==NULL);
 
-	rsem = sem_create("console read", 0);
-	if (rsem == NULL) {
-		return ENOMEM;
-	}
-	wsem = sem_create("console write", 1);
-	if (wsem == NULL) {
-		sem_destroy(rsem);
-		return ENOMEM;
-	}
-	rlk = lock_create("console-lock-read");
-	if (rlk == NULL) {
-		sem_destroy(rsem);
-		sem_destroy(wsem);
-		return ENOMEM;
-	}
-	wlk = lock_create("console-lock-write");
-	if (wlk == NULL) {
-		lock_destroy(rlk);
-		sem_destroy(rsem);
-		sem_destroy(wsem);
-		return ENOMEM;
-	}
-
-	cs->cs_rsem = rsem; 
-	cs->cs_wsem = wsem; 
+	sem_init(&cs->cs_rsem, "console read", 0);
+	sem_init(&cs->cs_wsem, "console write", 1);
 	cs->cs_gotchars_head = 0;
 	cs->cs_gotchars_tail = 0;
 
 	the_console = cs;
-	con_userlock_read = rlk;
-	con_userlock_write = wlk;
 
 	flush_delay_buf();
 
@@ -479,7 +479,9 @@ emufs_reclaim(struct vnode *v)
 	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
 
-	if (ev->ev_v.vn_refcount != 1) {
+	if (atomic_load(&ev->ev_v.vn_refcount) != 1) {
+		/* consume the reference VOP_DECREF gave us */
+		atomic_add(&ev->ev_v.vn_refcount, -1);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
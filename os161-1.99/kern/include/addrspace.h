@@ -37,9 +37,32 @@
 
 #include <vm.h>
 #include "opt-A3.h"
+#include "opt-ipt.h"
 struct vnode;
+struct bitmap;
 
 
+#if OPT_A3
+/*
+ * Anonymous regions created with mmap(). The frames behind a mapping
+ * are allocated when it is created. If map_shared is set, fork hands
+ * the same frames to the child and neither side ever copies them;
+ * otherwise they are copy-on-write like the rest of the address space.
+ *
+ * Mappings are placed upward from AS_MMAPBASE, below the stack.
+ */
+#define AS_MAXMAPS	8
+#define AS_MMAPBASE	0x60000000
+
+struct as_mapping {
+    vaddr_t map_vbase;		/* 0 if this slot is unused */
+    size_t map_npages;
+    int map_permissions;	/* PF_R/PF_W/PF_X */
+    bool map_shared;		/* MAP_SHARED rather than MAP_PRIVATE */
+    struct bitmap *map_sequential; /* pages advised MADV_SEQUENTIAL */
+};
+#endif // OPT_A3
+
 /* 
  * Address space - data structure associated with the virtual memory
  * space of a process.
@@ -49,15 +72,26 @@ struct vnode;
 
 struct addrspace {
 #if OPT_A3
+#if OPT_IPT
+    int as_iptlist;		/* our entries in the inverted page table */
+#else
     paddr_t** as_pagedir;
+#endif
 
     vaddr_t as_vbase1;
     size_t as_npages1;
     int as_permissions1;
+    struct bitmap *as_sequential1;
 
     vaddr_t as_vbase2;
     size_t as_npages2;
     int as_permissions2;
+    struct bitmap *as_sequential2;
+
+    struct bitmap *as_stacksequential;
+
+    struct as_mapping as_maps[AS_MAXMAPS];
+    vaddr_t as_mmapnext;	/* where the next mapping is placed */
 #else
   vaddr_t as_vbase1;
   paddr_t as_pbase1;
@@ -120,6 +154,28 @@ int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
 
+#if OPT_A3
+/*
+ *    as_define_mapping - create an anonymous, zero-filled mmap region of
+ *                NPAGES pages and hand back its base address.
+ *
+ *    as_remove_mapping - tear down the mmap region starting at VADDR,
+ *                which must be exactly NPAGES long.
+ *
+ *    as_find_mapping - return the mmap region containing VADDR, or NULL.
+ *
+ *    as_advise - apply madvise() ADVICE to NPAGES pages starting at VADDR.
+ */
+int               as_define_mapping(struct addrspace *as, size_t npages,
+                                    int permissions, bool shared,
+                                    vaddr_t *ret);
+int               as_remove_mapping(struct addrspace *as, vaddr_t vaddr,
+                                    size_t npages);
+struct as_mapping *as_find_mapping(struct addrspace *as, vaddr_t vaddr);
+int               as_advise(struct addrspace *as, vaddr_t vaddr,
+                            size_t npages, int advice);
+#endif // OPT_A3
+
 
 /*
  * Functions in loadelf.c
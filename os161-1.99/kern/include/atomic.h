@@ -0,0 +1,135 @@
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+/*
+ * Atomic integers, for counters and reference counts that would
+ * otherwise need a lock of their own. The guts are machine-dependent.
+ *
+ * The structure is exposed so atomics can be embedded in other
+ * structures or be static; its contents should only be touched with
+ * the functions below.
+ *
+ * The read-modify-write operations are atomic but are not barriers:
+ * they don't order other loads and stores around them. Where that
+ * matters (say, publishing a structure and then a pointer to it) use
+ * the membar_* functions, which order the loads and/or stores named
+ * before the barrier against those named after it:
+ *
+ *    membar_any_any     - full barrier.
+ *    membar_load_load   - loads before vs. loads after.
+ *    membar_store_store - stores before vs. stores after.
+ *    membar_store_any   - stores before vs. everything after
+ *                         (on taking a lock).
+ *    membar_any_store   - everything before vs. stores after
+ *                         (on releasing a lock).
+ */
+
+#include <cdefs.h>
+
+/* Inlining support - for making sure an out-of-line copy gets built */
+#ifndef ATOMIC_INLINE
+#define ATOMIC_INLINE INLINE
+#endif
+
+/* Get the machine-dependent bits. */
+#include <machine/atomic.h>
+
+struct atomic {
+	volatile int a_val;
+};
+
+#define ATOMIC_INITIALIZER(val) { .a_val = (val) }
+
+/* Atomic pointers, for lock-free lists. */
+struct atomicptr {
+	void *volatile ap_val;
+};
+
+#define ATOMICPTR_INITIALIZER(val) { .ap_val = (val) }
+
+/*
+ * Operations:
+ *    atomic_load     - get the value.
+ *    atomic_store    - set the value.
+ *    atomic_add      - add DELTA (which may be negative); returns the
+ *                      new value.
+ *    atomic_fetchadd - add DELTA; returns the old value.
+ *    atomic_cas      - compare-and-swap: if the value is OLDVAL, make
+ *                      it NEWVAL. Returns the value found, so it
+ *                      worked if that is OLDVAL.
+ */
+int atomic_load(const struct atomic *a);
+void atomic_store(struct atomic *a, int val);
+int atomic_add(struct atomic *a, int delta);
+int atomic_fetchadd(struct atomic *a, int delta);
+int atomic_cas(struct atomic *a, int oldval, int newval);
+
+/*
+ * The same for pointers:
+ *    atomicptr_load  - get the pointer.
+ *    atomicptr_store - set the pointer.
+ *    atomicptr_cas   - compare-and-swap, as for atomic_cas.
+ */
+void *atomicptr_load(const struct atomicptr *a);
+void atomicptr_store(struct atomicptr *a, void *val);
+void *atomicptr_cas(struct atomicptr *a, void *oldval, void *newval);
+
+////////////////////////////////////////////////////////////
+
+ATOMIC_INLINE
+int
+atomic_load(const struct atomic *a)
+{
+	return a->a_val;
+}
+
+ATOMIC_INLINE
+void
+atomic_store(struct atomic *a, int val)
+{
+	a->a_val = val;
+}
+
+ATOMIC_INLINE
+int
+atomic_add(struct atomic *a, int delta)
+{
+	return atomic_data_fetchadd(&a->a_val, delta) + delta;
+}
+
+ATOMIC_INLINE
+int
+atomic_fetchadd(struct atomic *a, int delta)
+{
+	return atomic_data_fetchadd(&a->a_val, delta);
+}
+
+ATOMIC_INLINE
+int
+atomic_cas(struct atomic *a, int oldval, int newval)
+{
+	return atomic_data_cas(&a->a_val, oldval, newval);
+}
+
+ATOMIC_INLINE
+void *
+atomicptr_load(const struct atomicptr *a)
+{
+	return a->ap_val;
+}
+
+ATOMIC_INLINE
+void
+atomicptr_store(struct atomicptr *a, void *val)
+{
+	a->ap_val = val;
+}
+
+ATOMIC_INLINE
+void *
+atomicptr_cas(struct atomicptr *a, void *oldval, void *newval)
+{
+	return atomic_data_casptr(&a->ap_val, oldval, newval);
+}
+
+#endif /* _ATOMIC_H_ */
@@ -36,12 +36,15 @@
  * Time-related definitions.
  *
  * hardclock() is called on every CPU HZ times a second, possibly only
- * when the CPU is not idle, for scheduling.
+ * when the CPU is not idle, for scheduling. With the tickless option,
+ * it is only called on CPUs that have threads waiting to run.
  *
  * timerclock() is called on one CPU once a second to allow simple
  * timed operations. (This is a fairly simpleminded interface.)
  *
  * gettime() may be used to fetch the current time of day.
+ * gettime_ns() returns it in nanoseconds, or 0 before the clock is
+ * attached; it is cheap and precise enough for timestamps.
  * getinterval() computes the time from time1 to time2.
  *
  * XXX we have struct timespec now, let's use it.
@@ -62,6 +65,7 @@ void hardclock(void);
 void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
+uint64_t gettime_ns(void);
 
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
@@ -70,8 +74,14 @@ void getinterval(time_t secs1, uint32_t nsecs,
 /*
  * clocksleep() suspends execution for the requested number of seconds,
  * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * clocksleep_ticks() does the same for a number of hardclocks; see
+ * <timer.h>.
  */
 void clocksleep(int seconds);
+void clocksleep_ticks(unsigned ticks);
+
+/* Hardclocks in MS milliseconds, rounded up. */
+#define MSTOTICKS(ms)  (((ms) * HZ + 999) / 1000)
 
 
 #endif /* _CLOCK_H_ */
@@ -6,7 +6,8 @@
 struct coremap_entry {
     int num_of_owners;
     int num_pages_used;
-} coremap_entry_default = {0, 0};
+    void *kmalloc_ref;		/* kmalloc's pageref, if a subpage page */
+} coremap_entry_default = {0, 0, NULL};
 
 #endif /* _COREMAP_ENTRY_H_ */
 
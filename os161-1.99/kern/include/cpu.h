@@ -33,7 +33,23 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <mpscq.h>
+#include <kern/schedstats.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
+#include "opt-mlfq.h"
+#include "opt-idlepoll.h"
+#include "opt-tickless.h"
+#include "opt-schedstats.h"
+
+
+#if OPT_MLFQ
+/*
+ * Multi-level feedback queue. Level 0 is the highest priority. Bit N
+ * of c_runbitmap is set when c_runqueue[N] is nonempty, so the next
+ * thread to run can be found without scanning the levels.
+ */
+#define MLFQ_NLEVELS	4
+#endif
 
 
 /*
@@ -59,15 +75,52 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_leaving;	/* Threads to send to other cpus */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
 
+	/*
+	 * Accessed only by this cpu, with interrupts off, but reported
+	 * by others.
+	 */
+	struct threadlist c_spares;	/* Exited threads kept for reuse */
+	unsigned c_sparesreused;	/* Forks that got a spare */
+	unsigned c_stacksmade;		/* Forks that had to allocate */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+#if OPT_IDLEPOLL
+	bool c_polling;			/* Idle and watching c_runqueue */
+#endif
+#if OPT_TICKLESS
+	bool c_tickless;		/* Hardclock stopped */
+	unsigned c_tickstops;		/* Times it was stopped */
+#endif
+#if OPT_MLFQ
+	struct threadlist c_runqueue[MLFQ_NLEVELS]; /* One per level */
+	unsigned c_runbitmap;		/* Which levels are nonempty */
+	unsigned c_runcount;		/* Total threads on all levels */
+#else
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+#endif
 	struct spinlock c_runqueue_lock;
+	unsigned c_stolenfrom;		/* Threads other cpus took from us */
+	unsigned c_inboxed;		/* Threads other cpus posted us */
+#if OPT_SCHEDSTATS
+	struct schedstats c_stats;	/* Updated by thread_switch */
+#endif
+
+	/*
+	 * Accessed only by this cpu, but reported by others.
+	 */
+	unsigned c_stolen;		/* Threads we took from other cpus */
+
+	/*
+	 * Accessed by other cpus without locking.
+	 */
+	struct mpscq c_inbox;		/* Threads posted to run here */
 
 	/*
 	 * Accessed by other cpus.
@@ -152,6 +205,8 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_broadcast sends one to all CPUs except the current
+ * one, and returns a mask of the CPU numbers it was sent to.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -162,10 +217,12 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_INBOX		4	/* Threads have been posted to us */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping);
 
 void interprocessor_interrupt(void);
 
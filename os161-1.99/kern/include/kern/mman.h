@@ -0,0 +1,37 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Constants for mmap() and munmap(), shared between the kernel and
+ * <sys/mman.h> in userland.
+ *
+ * Only anonymous mappings are supported; there is no file-backed
+ * mmap. MAP_SHARED regions stay shared with children across fork();
+ * MAP_PRIVATE regions are copy-on-write like the rest of the address
+ * space.
+ */
+
+/* Page protections (third argument to mmap) */
+#define PROT_NONE     0x0    /* Page cannot be accessed */
+#define PROT_READ     0x1    /* Page can be read */
+#define PROT_WRITE    0x2    /* Page can be written */
+#define PROT_EXEC     0x4    /* Page can be executed */
+
+/* Mapping flags (fourth argument to mmap) */
+#define MAP_SHARED    0x0001 /* Share the pages with forked children */
+#define MAP_PRIVATE   0x0002 /* Copy-on-write across fork */
+#define MAP_ANON      0x1000 /* Not backed by a file; fd is ignored */
+#define MAP_ANONYMOUS MAP_ANON
+
+/*
+ * Advice for madvise(). All of it acts on just the pages in the range.
+ * DONTNEED is refused (EINVAL) on the regions loaded from the
+ * executable, since their contents can't be got back.
+ */
+#define MADV_NORMAL     0    /* No particular access pattern */
+#define MADV_RANDOM     1    /* Random access; no fault-around */
+#define MADV_SEQUENTIAL 2    /* Sequential access; map ahead on faults */
+#define MADV_WILLNEED   3    /* Pages will be needed soon; prefault them */
+#define MADV_DONTNEED   4    /* Contents can be discarded; free the frames */
+
+#endif /* _KERN_MMAN_H_ */
@@ -0,0 +1,41 @@
+#ifndef _KERN_SCHEDSTATS_H_
+#define _KERN_SCHEDSTATS_H_
+
+/*
+ * Scheduler statistics, kept per cpu and per thread with the
+ * schedstats kernel option, and returned by the schedstats() system
+ * call.
+ *
+ * Times are in nanoseconds. Run time is time spent running threads
+ * (for a thread, itself); wait time is time threads spent on a run
+ * queue before running. Switches are voluntary if the thread went to
+ * sleep or exited, involuntary if it was preempted or yielded.
+ *
+ * ss_lathist is a histogram of wakeup latency, the time from a
+ * sleeping thread being made runnable to it running. Bucket 0 counts
+ * latencies under 2 microseconds, bucket K those from 2^K up to
+ * 2^(K+1) microseconds, and the last bucket everything longer.
+ *
+ * For a cpu, ss_migrations counts threads that came to run on it from
+ * another cpu and ss_idletime is the time it spent with nothing to run;
+ * for a thread, ss_migrations counts the times it was moved between
+ * cpus and ss_idletime is unused.
+ */
+
+#define SCHEDSTATS_LATBUCKETS  16
+
+/* Pass as the cpu number to schedstats() to get the calling thread's. */
+#define SCHEDSTATS_SELF  (-1)
+
+struct schedstats {
+	__u64 ss_runtime;
+	__u64 ss_waittime;
+	__u64 ss_idletime;
+	__u32 ss_nvcsw;		/* voluntary switches */
+	__u32 ss_nivcsw;	/* involuntary switches */
+	__u32 ss_migrations;
+	__u32 ss_wakeups;
+	__u32 ss_lathist[SCHEDSTATS_LATBUCKETS];
+};
+
+#endif /* _KERN_SCHEDSTATS_H_ */
@@ -0,0 +1,82 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+/*
+ * Object caches for fixed-size kernel structures.
+ *
+ * A cache hands out objects of one size, carved out of one-page slabs.
+ * If the cache has a constructor, every object on a slab is
+ * constructed when the slab is made, and the destructor runs only when
+ * the slab is given back. Objects therefore come out of
+ * kmem_cache_alloc in their constructed state, and must be put back
+ * into that state before kmem_cache_free. For a process, say, that
+ * means its wait lock and CV are set up once and reused, rather than
+ * set up and torn down for every process.
+ *
+ * The constructor returns 0 or an error code; if it fails, the slab
+ * being made is abandoned and kmem_cache_alloc returns NULL.
+ *
+ * Caches may be created with kmem_cache_create, or defined statically
+ * with KMEM_CACHE_INITIALIZER, which needs no setup and so can be used
+ * before anything else in the kernel is running:
+ *
+ *    static struct kmem_cache proc_cache =
+ *       KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc),
+ *                              proc_ctor, proc_dtor);
+ *
+ * The structure is exposed only so this is possible; its contents are
+ * private to kmem_cache.c.
+ */
+
+#include <spinlock.h>
+
+struct kmem_slab;		/* Private. */
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+
+	struct spinlock kc_lock;
+	struct kmem_slab *kc_partial;	/* slabs with some objects free */
+	struct kmem_slab *kc_full;	/* slabs with none free */
+	struct kmem_slab *kc_empty;	/* slabs with all free */
+	unsigned kc_nempty;
+
+	struct kmem_cache *kc_next;	/* on the list of all caches */
+	bool kc_listed;
+
+	/* statistics */
+	unsigned kc_nslabs;
+	unsigned kc_inuse;
+	unsigned kc_allocs;
+	unsigned kc_frees;
+	unsigned kc_slabsmade;
+	unsigned kc_slabsfreed;
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor, dtor) \
+	{ name, size, ctor, dtor, SPINLOCK_INITIALIZER, \
+	  NULL, NULL, NULL, 0, NULL, false, 0, 0, 0, 0, 0, 0 }
+
+/*
+ * Operations:
+ *    kmem_cache_create  - make a cache for objects of SIZE bytes. CTOR
+ *                         and DTOR may be NULL. Returns NULL if out of
+ *                         memory or if SIZE won't fit on a slab.
+ *    kmem_cache_destroy - destroy a cache. All its objects must have
+ *                         been freed.
+ *    kmem_cache_alloc   - get an object, or NULL if out of memory.
+ *    kmem_cache_free    - return an object in its constructed state.
+ *    kmem_cache_printstats - print a line about every cache in use.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *cache);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+void kmem_cache_printstats(void);
+
+#endif /* _KMEM_CACHE_H_ */
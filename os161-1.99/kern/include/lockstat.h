@@ -0,0 +1,53 @@
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention profiler (options lockstat).
+ *
+ * spinlock.c and synch.c report every acquire and release of a
+ * spinlock or sleep lock here. Each cpu counts, per lock, acquires,
+ * contended acquires, spin iterations, sleeps, and time spent waiting
+ * for and holding the lock. Spinlocks are counted by address; sleep
+ * locks by name, so that (say) all the vnode locks add up together.
+ *
+ * The counts are in a per-cpu table that is only touched by its own
+ * cpu with interrupts off, so recording takes no locks. lockstat_print
+ * adds the tables up. Without the option none of this is compiled and
+ * the lock code is unchanged.
+ */
+
+#include "opt-lockstat.h"
+
+#if OPT_LOCKSTAT
+
+/*
+ * Operations:
+ *    lockstat_cpu_init   - make the table for cpu CPUNUM. Called from
+ *                          cpu_create. If out of memory, that cpu
+ *                          records nothing.
+ *    lockstat_acquired   - record an acquire of the lock at LOCK, named
+ *                          NAME (NULL for a spinlock), by code at PC.
+ *                          SPINS is how many times it spun; if it had
+ *                          to wait, CONTENDED is true and START is the
+ *                          gettime_ns() time it began, and SLEPT says
+ *                          whether it went to sleep. Returns the time
+ *                          now, for the lock to keep until release.
+ *    lockstat_released   - record a release; STAMP is what
+ *                          lockstat_acquired returned.
+ *    lockstat_print      - print the N locks waited for longest.
+ *    lockstat_clear      - start counting again from zero.
+ *
+ * lockstat_acquired and lockstat_released must be called with
+ * interrupts off.
+ */
+void lockstat_cpu_init(unsigned cpunum);
+uint64_t lockstat_acquired(const void *lock, const char *name, vaddr_t pc,
+			   unsigned spins, bool contended, bool slept,
+			   uint64_t start);
+void lockstat_released(const void *lock, const char *name, uint64_t stamp);
+void lockstat_print(unsigned n);
+void lockstat_clear(void);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
@@ -55,6 +55,10 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/* Start or stop the hardclock timer on the current cpu. */
+void mainbus_hardclock_start(void);
+void mainbus_hardclock_stop(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
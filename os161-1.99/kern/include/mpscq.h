@@ -0,0 +1,55 @@
+#ifndef _MPSCQ_H_
+#define _MPSCQ_H_
+
+/*
+ * Lock-free multiple-producer, single-consumer queue.
+ *
+ * Any number of producers may add items at once, from any cpu and
+ * from interrupt handlers, without locking. The consumer takes the
+ * whole queue in one go. Items are linked through an mpscq_node
+ * embedded in them, like threadlistnode; mn_self points back to the
+ * item. A node may be on only one queue at a time.
+ *
+ * Underneath it is a stack: pushing is a compare-and-swap on the
+ * head, and taking is a compare-and-swap of the head to NULL. Taking
+ * everything at once is what makes this safe without counters
+ * against ABA. The taker reverses the list so items come out in the
+ * order they were added.
+ *
+ * Functions:
+ *       mpscq_init      - initialize a queue.
+ *       mpscq_cleanup   - clean up a queue. Must be empty.
+ *       mpscq_node_init - initialize a node to point at SELF.
+ *       mpscq_isempty   - true if the queue is empty. Only a hint
+ *                         unless nobody else is adding.
+ *       mpscq_push      - add a node. Returns true if the queue was
+ *                         empty before, so whoever needs to be told
+ *                         about new items can be told once per batch.
+ *       mpscq_takeall   - empty the queue, returning its nodes oldest
+ *                         first, linked through mn_next, or NULL.
+ *
+ * mpscq_push makes sure the stores made to an item before it is
+ * pushed are seen by whoever takes it.
+ */
+
+#include <atomic.h>
+
+struct mpscq_node {
+	struct mpscq_node *mn_next;
+	void *mn_self;
+};
+
+struct mpscq {
+	struct atomicptr mq_head;	/* newest node first */
+};
+
+#define MPSCQ_INITIALIZER { ATOMICPTR_INITIALIZER(NULL) }
+
+void mpscq_init(struct mpscq *q);
+void mpscq_cleanup(struct mpscq *q);
+void mpscq_node_init(struct mpscq_node *n, void *self);
+bool mpscq_isempty(const struct mpscq *q);
+bool mpscq_push(struct mpscq *q, struct mpscq_node *n);
+struct mpscq_node *mpscq_takeall(struct mpscq *q);
+
+#endif /* _MPSCQ_H_ */
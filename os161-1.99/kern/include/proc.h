@@ -54,7 +54,7 @@ struct proc {
 	char *p_name;			/* Name of this process */
 #if OPT_A2
 	struct spinlock p_lock;
-	struct lock* p_cvlock;
+	struct lock p_cvlock;
 #endif
 	struct threadarray p_threads;	/* Threads in this process */
 
@@ -79,7 +79,7 @@ struct proc {
 	struct pidarray p_cpids;           /* Process's children pid's */
 	struct intarray p_cpids_exitcodes; /* Process's children exitcoes */
 
-	struct cv* p_cv;
+	struct cv p_cv;
 	int p_exitcode;
 	/* add more material here as needed */
 #endif // OPT_A2
@@ -99,7 +99,7 @@ extern struct proc *kproc;
 
 /* Semaphore used to signal when there are no more processes */
 #ifdef UW
-extern struct semaphore *no_proc_sem;
+extern struct semaphore no_proc_sem;
 #endif // UW
 
 /* Call once during system startup to allocate data structures. */
@@ -36,6 +36,7 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -53,21 +54,45 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ *
+ * A spinlock is either a plain test-and-set lock or a ticket lock,
+ * chosen when it is initialized. Waiters for a ticket lock each take
+ * a number from lk_lock and get the lock in that order, when
+ * lk_serving reaches their number, so no cpu can be starved. Ticket
+ * locks cost a little more when uncontended; use them for hot locks
+ * shared by many cpus.
  */
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
+	volatile spinlock_data_t lk_serving; /* Ticket now served. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+	bool lk_ticket;			/* True for a ticket lock. */
+#if OPT_LOCKSTAT
+	uint64_t lk_stamp;		/* When acquired; see <lockstat.h> */
+#endif
 };
 
 /*
- * Initializer for cases where a spinlock needs to be static or global.
+ * Initializers for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#define SPINLOCK_INITIALIZER { \
+	.lk_lock = SPINLOCK_DATA_INITIALIZER, \
+	.lk_serving = SPINLOCK_DATA_INITIALIZER, \
+	.lk_holder = NULL, \
+	.lk_ticket = false, \
+}
+#define SPINLOCK_TICKET_INITIALIZER { \
+	.lk_lock = SPINLOCK_DATA_INITIALIZER, \
+	.lk_serving = SPINLOCK_DATA_INITIALIZER, \
+	.lk_holder = NULL, \
+	.lk_ticket = true, \
+}
 
 /*
  * Spinlock functions.
  *
  * init		Initialize the contents of a spinlock.
+ * init_ticket	Same, but make it a ticket lock.
  * cleanup	Opposite of init. Lock must be unlocked.
  *
  * acquire	Get the lock, spinning as necessary. Also disables interrupts.
@@ -77,6 +102,7 @@ struct spinlock {
  */
 
 void spinlock_init(struct spinlock *lk);
+void spinlock_init_ticket(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
 
 void spinlock_acquire(struct spinlock *lk);
@@ -36,31 +36,65 @@
 
 
 #include <spinlock.h>
+#include <wchan.h>
+#include <cpu.h>		/* for MLFQ_NLEVELS */
+#include "opt-mlfq.h"
+#include "opt-lockstat.h"
+
+/*
+ * Each primitive below can be had in three ways:
+ *
+ *    - from X_create, which allocates it and makes a copy of the name,
+ *      and X_destroy;
+ *    - embedded in another structure, set up with X_init and torn down
+ *      with X_cleanup, which allocate nothing and cannot fail;
+ *    - statically allocated and set up with X_INITIALIZER, which also
+ *      gives the variable's own name so the wait channel inside can
+ *      point to itself, e.g.
+ *
+ *         static struct lock biglock = LOCK_INITIALIZER(biglock, "big");
+ *
+ * With X_init and X_INITIALIZER the name is not copied, so it should
+ * be a string constant.
+ */
 
 /*
  * Dijkstra-style semaphore.
  *
- * The name field is for easier debugging. A copy of the name is made
- * internally.
+ * The name field is for easier debugging.
  */
 struct semaphore {
-        char *sem_name;
-	struct wchan *sem_wchan;
+        const char *sem_name;
+	struct wchan sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
 };
 
+#define SEMAPHORE_INITIALIZER(sem, name, initial_count) { \
+	.sem_name = name, \
+	.sem_wchan = WCHAN_INITIALIZER((sem).sem_wchan, name), \
+	.sem_lock = SPINLOCK_INITIALIZER, \
+	.sem_count = initial_count, \
+}
+
 struct semaphore *sem_create(const char *name, int initial_count);
 void sem_destroy(struct semaphore *);
+void sem_init(struct semaphore *, const char *name, int initial_count);
+void sem_cleanup(struct semaphore *);
 
 /*
  * Operations (both atomic):
  *     P (proberen): decrement count. If the count is 0, block until
  *                   the count is 1 again before decrementing.
  *     V (verhogen): increment count.
+ *
+ * sem_timed_P is P that gives up after TICKS hardclocks (see
+ * MSTOTICKS in <clock.h>) and returns ETIMEDOUT; it returns 0 if it
+ * decremented the count.
  */
 void P(struct semaphore *);
 void V(struct semaphore *);
+int sem_timed_P(struct semaphore *, unsigned ticks);
 
 
 /*
@@ -69,18 +103,49 @@ void V(struct semaphore *);
  * When the lock is created, no thread should be holding it. Likewise,
  * when the lock is destroyed, no thread should be holding it.
  *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
+ * The name field is for easier debugging.
+ *
+ * If the lock is held by a thread that is running on another cpu,
+ * lock_acquire spins for a while before going to sleep, since the
+ * holder is likely to let go soon. The counters record how often the
+ * lock was found held and how each such acquire ended; they're
+ * protected by lk_lock.
+ *
+ * With the MLFQ scheduler, threads waiting for the lock lend their
+ * priority to the holder (and on to whatever the holder is waiting
+ * for), until the holder releases it; see synch.c.
  */
 struct lock {
-        char *lk_name;
-	struct wchan *lk_wchan;
+        const char *lk_name;
+	struct wchan lk_wchan;
 	struct spinlock lk_lock;
 	volatile bool locked;
 	struct thread *holder;
+
+	unsigned lk_acquires;		/* total acquires */
+	unsigned lk_contended;		/* acquires that found it held */
+	unsigned lk_spinwins;		/* ...and got it by spinning */
+	unsigned lk_sleeps;		/* times a waiter slept */
+
+#if OPT_MLFQ
+	/* Priority inheritance; protected by synch.c's pi_lock. */
+	unsigned lk_waiters[MLFQ_NLEVELS]; /* sleeping waiters per level */
+	struct lock *lk_nextheld;	/* next on holder's t_locksheld */
+#endif
+#if OPT_LOCKSTAT
+	uint64_t lk_stamp;		/* When acquired; see <lockstat.h> */
+#endif
 };
 
+#define LOCK_INITIALIZER(lock, name) { \
+	.lk_name = name, \
+	.lk_wchan = WCHAN_INITIALIZER((lock).lk_wchan, name), \
+	.lk_lock = SPINLOCK_INITIALIZER, \
+}
+
 struct lock *lock_create(const char *name);
+void lock_init(struct lock *, const char *name);
+void lock_cleanup(struct lock *);
 void lock_acquire(struct lock *);
 
 /*
@@ -109,18 +174,25 @@ void lock_destroy(struct lock *);
  * These CVs are expected to support Mesa semantics, that is, no
  * guarantees are made about scheduling.
  *
- * The name field is for easier debugging. A copy of the name is
- * (should be) made internally.
+ * The name field is for easier debugging.
  */
 
 struct cv {
-        char *cv_name;
-	struct wchan *cv_wchan;
+        const char *cv_name;
+	struct wchan cv_wchan;
 	struct spinlock cv_lock;
 };
 
+#define CV_INITIALIZER(cv, name) { \
+	.cv_name = name, \
+	.cv_wchan = WCHAN_INITIALIZER((cv).cv_wchan, name), \
+	.cv_lock = SPINLOCK_INITIALIZER, \
+}
+
 struct cv *cv_create(const char *name);
 void cv_destroy(struct cv *);
+void cv_init(struct cv *, const char *name);
+void cv_cleanup(struct cv *);
 
 /*
  * Operations:
@@ -128,16 +200,71 @@ void cv_destroy(struct cv *);
  *                   waking up again, re-acquire the lock.
  *    cv_signal    - Wake up one thread that's sleeping on this CV.
  *    cv_broadcast - Wake up all threads sleeping on this CV.
+ *    cv_timedwait - cv_wait, but return ETIMEDOUT if TICKS hardclocks
+ *                   pass first (the lock is re-acquired either way).
+ *                   Returns 0 if woken by cv_signal or cv_broadcast.
  *
- * For all three operations, the current thread must hold the lock passed 
+ * For all of these operations, the current thread must hold the lock passed 
  * in. Note that under normal circumstances the same lock should be used
  * on all operations with any particular CV.
  *
  * These operations must be atomic. You get to write them.
  */
 void cv_wait(struct cv *cv, struct lock *lock);
+int cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks);
 void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers may hold the lock at once, or one writer.
+ * Writers are preferred: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers can't starve writers. (A
+ * reader must therefore not try to take the lock again for reading
+ * while it already holds it, as a writer may have arrived in between.)
+ *
+ * The name field is for easier debugging.
+ */
+struct rwlock {
+        const char *rw_name;
+	struct wchan rw_readwchan;	/* readers waiting */
+	struct wchan rw_writewchan;	/* writers waiting */
+	struct spinlock rw_lock;
+	unsigned rw_readers;		/* readers holding the lock */
+	unsigned rw_writerswaiting;	/* writers asleep or about to be */
+	struct thread *rw_writer;	/* writer holding the lock */
+};
+
+#define RWLOCK_INITIALIZER(rw, name) { \
+	.rw_name = name, \
+	.rw_readwchan = WCHAN_INITIALIZER((rw).rw_readwchan, name), \
+	.rw_writewchan = WCHAN_INITIALIZER((rw).rw_writewchan, name), \
+	.rw_lock = SPINLOCK_INITIALIZER, \
+}
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+void rwlock_init(struct rwlock *, const char *name);
+void rwlock_cleanup(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading. Blocks while a
+ *                           writer holds the lock or is waiting for it.
+ *    rwlock_acquire_write - Get the lock for writing. Blocks while
+ *                           anyone else holds it.
+ *    rwlock_release       - Give up the lock, whichever way it was
+ *                           taken.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                           the lock for writing. (There's no way to
+ *                           tell which threads hold it for reading.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
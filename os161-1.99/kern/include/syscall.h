@@ -30,6 +30,7 @@
 #ifndef _SYSCALL_H_
 #define _SYSCALL_H_
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 struct trapframe; /* from <machine/trapframe.h> */
 
@@ -61,6 +62,10 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
+int sys_setaffinity(unsigned mask);
+int sys_getaffinity(unsigned *retval);
+int sys_schedstats(int cpu, userptr_t user_stats);
 
 #ifdef UW
 int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
@@ -72,6 +77,12 @@ pid_t sys_fork(struct trapframe* ctf, pid_t* retval);
 int sys_execv(char* program, char** args);
 #endif // OPT_A2
 
+#if OPT_A3
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, vaddr_t *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+#endif // OPT_A3
+
 #endif // UW
 
 #endif /* _SYSCALL_H_ */
@@ -52,15 +52,25 @@ int catmouse(int, char **);
 /* lib tests */
 int arraytest(int, char **);
 int bitmaptest(int, char **);
+int mpscqtest(int, char **);
 int queuetest(int, char **);
 
 /* thread tests */
 int threadtest(int, char **);
 int threadtest2(int, char **);
 int threadtest3(int, char **);
+int threadtest4(int, char **);
+int threadtest5(int, char **);
+int threadtest6(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int lockbench(int, char **);
+int spinbench(int, char **);
+int pitest(int, char **);
+int timedwaittest(int, char **);
+int atomicbench(int, char **);
+int rwbench(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
@@ -39,6 +39,10 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <mpscq.h>
+#include <kern/schedstats.h>
+#include "opt-mlfq.h"
+#include "opt-schedstats.h"
 
 struct cpu;
 
@@ -79,10 +83,14 @@ struct thread {
 	 */
 	struct thread_machdep t_machdep; /* Any machine-dependent goo */
 	struct threadlistnode t_listnode; /* Link for run/sleep/zombie lists */
+	struct mpscq_node t_inboxnode;	/* Link for another cpu's inbox */
 	void *t_stack;			/* Kernel-level stack */
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	unsigned t_affinity;		/* Mask of cpus we may run on */
+	unsigned t_migrations;		/* Times moved to another cpu */
+	bool t_forwarded;		/* Posted on by placement; stay put */
 
 	/*
 	 * Interrupt state fields.
@@ -101,6 +109,37 @@ struct thread {
 	int t_curspl;			/* Current spl*() state */
 	int t_iplhigh_count;		/* # of times IPL has been raised */
 
+#if OPT_MLFQ
+	/*
+	 * Scheduler fields. Changed only by the thread itself while
+	 * running, or under its cpu's run queue lock while queued.
+	 */
+	unsigned t_priority;		/* MLFQ level; 0 is highest */
+	unsigned t_ticks;		/* Hardclocks used at this level */
+	unsigned t_readysince;		/* c_hardclocks when last queued */
+	unsigned t_level;		/* Level queued at, if queued */
+
+	/*
+	 * Priority inheritance through sleep locks; see synch.c.
+	 * Protected by the priority inheritance lock there.
+	 */
+	unsigned t_boost;		/* Level inherited from waiters */
+	struct lock *t_locksheld;	/* Locks we hold */
+	struct lock *t_blockedon;	/* Lock we're waiting for */
+	unsigned t_donation;		/* Level we lend its holder */
+#endif
+
+#if OPT_SCHEDSTATS
+	/*
+	 * Scheduler statistics; see <kern/schedstats.h>. Updated by
+	 * thread_switch and thread_make_runnable.
+	 */
+	struct schedstats t_stats;
+	uint64_t t_stamp;		/* When last switched in or queued */
+	bool t_wakeup;			/* Queued by a wakeup */
+	struct cpu *t_lastran;		/* CPU we last ran on */
+#endif
+
 	/*
 	 * Public fields
 	 */
@@ -150,6 +189,17 @@ int thread_fork(const char *name, struct proc *proc,
  */
 void thread_exit(void);
 
+/*
+ * Get and set the CPU affinity of the current thread: a mask with bit
+ * N set for each CPU number N the thread may run on. Threads start
+ * with all bits set, and forked threads inherit their parent's mask,
+ * so a kernel thread can pin a worker by forking it with its own mask
+ * set, or the worker can pin itself. thread_setaffinity returns
+ * EINVAL if MASK names no CPU that exists.
+ */
+int thread_setaffinity(unsigned mask);
+unsigned thread_getaffinity(void);
+
 /*
  * Cause the current thread to yield to the next runnable thread, but
  * itself stay runnable.
@@ -157,16 +207,68 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Return true if the thread is running on a cpu right now. Only a
+ * hint, since it may change at any moment; the caller must make sure
+ * the thread can't be destroyed while it looks.
+ */
+bool thread_isrunning(const struct thread *t);
+
+#if OPT_MLFQ
+/*
+ * Priority inheritance hooks for synch.c. A thread's priority is the
+ * better of its own MLFQ level and the level it has inherited from
+ * threads waiting on locks it holds (t_boost); thread_setboost changes
+ * the latter, moving the thread to the right run queue level if it is
+ * queued.
+ */
+unsigned thread_priority(const struct thread *t);
+void thread_setboost(struct thread *t, unsigned boost);
+#endif
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Charge the current thread for one hardclock, and preempt it if its
+ * time slice is used up or a higher-priority thread is waiting. Called
+ * from the timer interrupt in place of thread_yield().
+ */
+void thread_timeslice(void);
+
+/*
+ * Potentially migrate ready threads from other CPUs to this one.
+ * Called from the timer interrupt.
  */
 void thread_consider_migration(void);
 
+/*
+ * Stop the timer interrupt on this CPU if nothing is waiting to run
+ * here. Called from the timer interrupt.
+ */
+void thread_consider_tickless(void);
+
+/*
+ * Restart the timer interrupt on this CPU if it was stopped. Call with
+ * interrupts off.
+ */
+void thread_starttick(void);
+
+/*
+ * Print per-CPU scheduler statistics, and with the schedstats option,
+ * histograms of wakeup latency.
+ */
+void thread_printstats(void);
+void thread_printlatency(void);
+
+/*
+ * Get the scheduler statistics of a CPU, or with SCHEDSTATS_SELF of
+ * the current thread. Returns EINVAL for no such CPU, or ENOSYS
+ * without the schedstats option.
+ */
+int thread_getschedstats(int cpu, struct schedstats *ss);
+
 
 #endif /* _THREAD_H_ */
@@ -66,7 +66,14 @@ struct threadlist {
 void threadlistnode_init(struct threadlistnode *tln, struct thread *self);
 void threadlistnode_cleanup(struct threadlistnode *tln);
 
-/* Initialize and clean up a thread list. Must be empty at cleanup. */
+/*
+ * Initialize and clean up a thread list. Must be empty at cleanup.
+ * A statically allocated list may instead be initialized with
+ * THREADLIST_INITIALIZER, giving the list itself as the argument.
+ */
+#define THREADLIST_INITIALIZER(tl) \
+	{ { NULL, &(tl).tl_tail, NULL }, { &(tl).tl_head, NULL, NULL }, 0 }
+
 void threadlist_init(struct threadlist *tl);
 void threadlist_cleanup(struct threadlist *tl);
 
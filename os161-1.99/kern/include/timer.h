@@ -0,0 +1,64 @@
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+/*
+ * Kernel timers.
+ *
+ * A timer calls a function a given number of hardclocks from now. The
+ * function runs in the timer interrupt on the cpu that started the
+ * timer, so it must not sleep; typically it wakes someone up.
+ *
+ * Each cpu has a hashed timer wheel (see Varghese and Lauck, "Hashed
+ * and Hierarchical Timing Wheels", SOSP 1987): TIMER_SLOTS lists,
+ * indexed by expiry time modulo TIMER_SLOTS. Starting and stopping a
+ * timer are O(1); each hardclock looks at one slot.
+ *
+ * The structure is exposed so timers can be embedded in other
+ * structures or put on the stack; its contents are private to timer.c.
+ */
+
+struct timerwheel;		/* Private. */
+
+struct timer {
+	struct timer *tm_next;
+	struct timer **tm_pprev;	/* NULL unless pending */
+	struct timerwheel *tm_wheel;	/* wheel last started on */
+	unsigned tm_expires;		/* in that wheel's ticks */
+	void (*tm_func)(void *data);
+	void *tm_data;
+};
+
+#define TIMER_INITIALIZER(func, data) { \
+	.tm_next = NULL, \
+	.tm_pprev = NULL, \
+	.tm_wheel = NULL, \
+	.tm_expires = 0, \
+	.tm_func = func, \
+	.tm_data = data, \
+}
+
+/*
+ * Operations:
+ *    timer_bootstrap - set up the wheels. Called from hardclock_bootstrap.
+ *    timer_init      - set up a timer to call FUNC(DATA).
+ *    timer_start     - arrange for the timer to go off TICKS hardclocks
+ *                      from now, on this cpu. It must not be pending.
+ *    timer_stop      - cancel the timer. Returns true if it was pending
+ *                      and now won't go off; false if it never started
+ *                      or has already gone off. If its function is
+ *                      running on another cpu, waits for it to finish,
+ *                      so afterwards the timer can be freed. Must not be
+ *                      called from the timer's own function, or at the
+ *                      same time as timer_start on the same timer.
+ *    timer_hardclock - run this cpu's expired timers. Called from
+ *                      hardclock.
+ *    timer_npending  - number of timers pending on this cpu.
+ */
+void timer_bootstrap(void);
+void timer_init(struct timer *t, void (*func)(void *data), void *data);
+void timer_start(struct timer *t, unsigned ticks);
+bool timer_stop(struct timer *t);
+void timer_hardclock(void);
+unsigned timer_npending(void);
+
+#endif /* _TIMER_H_ */
@@ -56,6 +56,30 @@ int vm_fault(int faulttype, vaddr_t faultaddress);
 void update_readonly_tlb(struct addrspace* as);
 paddr_t page_alloc(unsigned long npages);
 paddr_t unprotected_page_alloc(unsigned long npages);
+void vm_printstats(void);
+unsigned vm_freepages(void);
+
+/*
+ * Kernel virtual allocator. vmalloc maps individual frames into kseg2,
+ * so large allocations don't need physically contiguous memory. Before
+ * vm_bootstrap it falls back to alloc_kpages; vfree takes either kind of
+ * pointer, and kfree passes kseg2 pointers on to vfree.
+ *
+ * vm_wire_kstack is called by thread_switch to make sure the stack it
+ * is about to switch onto can't take a TLB miss.
+ */
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+bool vm_isvmalloc(const void *ptr);
+void vm_wire_kstack(void *stack);
+
+/*
+ * One pointer of kmalloc bookkeeping per kernel page, kept in the
+ * coremap so kfree can find a block's page without searching. These
+ * return false for pages the coremap doesn't cover.
+ */
+bool vm_kpage_getref(vaddr_t kva, void **ret);
+bool vm_kpage_setref(vaddr_t kva, void *ref);
 #endif
 
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
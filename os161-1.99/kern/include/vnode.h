@@ -30,6 +30,7 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include <atomic.h>
 
 struct uio;
 struct stat;
@@ -52,7 +53,7 @@ struct stat;
  * need to worry about it.
  */
 struct vnode {
-	int vn_refcount;                /* Reference count */
+	struct atomic vn_refcount;      /* Reference count */
 	int vn_opencount;
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
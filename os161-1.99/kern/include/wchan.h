@@ -32,10 +32,30 @@
 
 /*
  * Wait channel.
+ *
+ * The structure is exposed only so wait channels can be embedded in
+ * other structures (see synch.h); its contents are private to
+ * thread.c.
  */
 
+#include <spinlock.h>
+#include <threadlist.h>
+#include <timer.h>
+
+struct wchan {
+	const char *wc_name;		/* name for this channel */
+	struct threadlist wc_threads;	/* list of waiting threads */
+	struct spinlock wc_lock;	/* lock for mutual exclusion */
+};
 
-struct wchan; /* Opaque */
+/*
+ * Static initializer for a wait channel WC named NAME, for example:
+ *
+ *    static struct wchan mywchan = WCHAN_INITIALIZER(mywchan, "mine");
+ */
+#define WCHAN_INITIALIZER(wc, name) \
+	{ name, THREADLIST_INITIALIZER((wc).wc_threads), \
+	  SPINLOCK_INITIALIZER }
 
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
@@ -49,6 +69,21 @@ struct wchan *wchan_create(const char *name);
  */
 void wchan_destroy(struct wchan *wc);
 
+/*
+ * Initialize and clean up a wait channel in memory that belongs to the
+ * caller, rather than allocating one. Same rules as wchan_create and
+ * wchan_destroy.
+ */
+void wchan_init(struct wchan *wc, const char *name);
+void wchan_cleanup(struct wchan *wc);
+
+/*
+ * Change the symbolic name of a wait channel, for one that is being
+ * reused for a new purpose (see kmem_cache.h). Same rules for NAME as
+ * wchan_create.
+ */
+void wchan_setname(struct wchan *wc, const char *name);
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -81,5 +116,33 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Timed sleeps. wchan_timeout_start arranges for the current thread to
+ * be woken from WC, if it is sleeping there, TICKS hardclocks from now,
+ * and for wt_expired to be set then. Check wt_expired with the channel
+ * locked before each wchan_sleep, and stop sleeping once it is set;
+ * either way, call wchan_timeout_stop before WT goes out of scope.
+ * A timeout of 0 is expired from the start.
+ *
+ * The one timeout covers any number of sleeps, so a caller that goes
+ * back to sleep after a wakeup it can't use still times out on time.
+ *
+ * wt_woke is set only if the timeout found the thread still asleep
+ * and woke it. If a wakeup got there first, wt_expired may be set
+ * but wt_woke is not, and the wakeup shouldn't be reported as a
+ * timeout. Both are stable once wchan_timeout_stop returns.
+ */
+struct wchan_timeout {
+	struct timer wt_timer;
+	struct wchan *wt_wchan;
+	struct thread *wt_thread;
+	volatile bool wt_expired;	/* protected by the channel lock */
+	volatile bool wt_woke;		/* protected by the channel lock */
+};
+
+void wchan_timeout_start(struct wchan_timeout *wt, struct wchan *wc,
+			 unsigned ticks);
+void wchan_timeout_stop(struct wchan_timeout *wt);
+
 
 #endif /* _WCHAN_H_ */
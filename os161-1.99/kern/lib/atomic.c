@@ -0,0 +1,8 @@
+/*
+ * Out-of-line copies of the atomic operations; see <atomic.h>.
+ */
+
+#define ATOMIC_INLINE	/* empty */
+
+#include <types.h>
+#include <atomic.h>
@@ -42,11 +42,13 @@
 /* Flags word for DEBUG() macro. */
 uint32_t dbflags = 0;
 
-/* Lock for non-polled kprintfs */
-static struct lock *kprintf_lock;
+/* Lock for non-polled kprintfs, once kprintf_bootstrap has run */
+static struct lock kprintf_lock =
+	LOCK_INITIALIZER(kprintf_lock, "kprintf_lock");
+static bool kprintf_uselock;
 
 /* Lock for polled kprintfs */
-static struct spinlock kprintf_spinlock;
+static struct spinlock kprintf_spinlock = SPINLOCK_INITIALIZER;
 
 
 /*
@@ -56,19 +58,15 @@ static struct spinlock kprintf_spinlock;
 
 
 /*
- * Create the kprintf lock. Must be called before creating a second
+ * Start using the kprintf lock. Must be called before creating a second
  * thread or enabling a second CPU.
  */
 void
 kprintf_bootstrap(void)
 {
-	KASSERT(kprintf_lock == NULL);
+	KASSERT(!kprintf_uselock);
 
-	kprintf_lock = lock_create("kprintf_lock");
-	if (kprintf_lock == NULL) {
-		panic("Could not create kprintf_lock\n");
-	}
-	spinlock_init(&kprintf_spinlock);
+	kprintf_uselock = true;
 }
 
 /*
@@ -97,12 +95,12 @@ kprintf(const char *fmt, ...)
 	va_list ap;
 	bool dolock;
 
-	dolock = kprintf_lock != NULL
+	dolock = kprintf_uselock
 		&& curthread->t_in_interrupt == false
 		&& curthread->t_iplhigh_count == 0;
 
 	if (dolock) {
-		lock_acquire(kprintf_lock);
+		lock_acquire(&kprintf_lock);
 	}
 	else {
 		spinlock_acquire(&kprintf_spinlock);
@@ -115,7 +113,7 @@ kprintf(const char *fmt, ...)
 
 	putch_complete();
 	if (dolock) {
-		lock_release(kprintf_lock);
+		lock_release(&kprintf_lock);
 	}
 	else {
 		spinlock_release(&kprintf_spinlock);
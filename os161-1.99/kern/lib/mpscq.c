@@ -0,0 +1,71 @@
+/*
+ * Lock-free multiple-producer, single-consumer queue. See mpscq.h.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <mpscq.h>
+
+void
+mpscq_init(struct mpscq *q)
+{
+	atomicptr_store(&q->mq_head, NULL);
+}
+
+void
+mpscq_cleanup(struct mpscq *q)
+{
+	KASSERT(mpscq_isempty(q));
+}
+
+void
+mpscq_node_init(struct mpscq_node *n, void *self)
+{
+	n->mn_next = NULL;
+	n->mn_self = self;
+}
+
+bool
+mpscq_isempty(const struct mpscq *q)
+{
+	return atomicptr_load(&q->mq_head) == NULL;
+}
+
+bool
+mpscq_push(struct mpscq *q, struct mpscq_node *n)
+{
+	struct mpscq_node *head;
+
+	do {
+		head = atomicptr_load(&q->mq_head);
+		n->mn_next = head;
+		/* Publish the node only once it's filled in. */
+		membar_store_store();
+	} while (atomicptr_cas(&q->mq_head, head, n) != head);
+
+	return head == NULL;
+}
+
+struct mpscq_node *
+mpscq_takeall(struct mpscq *q)
+{
+	struct mpscq_node *head, *next, *prev;
+
+	do {
+		head = atomicptr_load(&q->mq_head);
+		if (head == NULL) {
+			return NULL;
+		}
+	} while (atomicptr_cas(&q->mq_head, head, NULL) != head);
+	membar_load_load();
+
+	/* Newest first; turn it around. */
+	prev = NULL;
+	while (head != NULL) {
+		next = head->mn_next;
+		head->mn_next = prev;
+		prev = head;
+		head = next;
+	}
+	return prev;
+}
@@ -45,6 +45,7 @@
 #define PROCINLINE
 
 #include <types.h>
+#include <kern/errno.h>
 #include <kern/wait.h>
 #include <proc.h>
 #include <current.h>
@@ -52,6 +53,8 @@
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <atomic.h>
+#include <kmem_cache.h>
 #include <kern/fcntl.h>
 
 /*
@@ -64,20 +67,61 @@ struct proc *kproc;
  */
 #ifdef UW
 /* count of the number of processes, excluding kproc */
-static unsigned int proc_count;
-/* provides mutual exclusion for proc_count */
-/* it would be better to use a lock here, but we use a semaphore because locks are not implemented in the base kernel */ 
-static struct semaphore *proc_count_mutex;
+static struct atomic proc_count = ATOMIC_INITIALIZER(0);
 /* used to signal the kernel menu thread when there are no processes */
-struct semaphore *no_proc_sem;   
+struct semaphore no_proc_sem =
+	SEMAPHORE_INITIALIZER(no_proc_sem, "no_proc_sem", 0);
 #endif  // UW
 #if OPT_A2
+/*
+ * Pid lookups far outnumber changes to the table (which happen only on
+ * fork and when a process goes away), so it's behind a reader-writer
+ * lock rather than a mutex.
+ */
 static struct procarray procs;
-static struct semaphore *procs_mutex;
+static struct rwlock procs_rwlock =
+	RWLOCK_INITIALIZER(procs_rwlock, "procs_rwlock");
 #endif
 
 
 
+#if OPT_A2
+/*
+ * Proc structures come from an object cache. The wait lock, cv and
+ * spinlock are part of the structure and are set up once by the
+ * constructor, and survive in the cache.
+ */
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	lock_init(&proc->p_cvlock, "proc wait lock");
+	cv_init(&proc->p_cv, "proc wait channel");
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	spinlock_cleanup(&proc->p_lock);
+	cv_cleanup(&proc->p_cv);
+	lock_cleanup(&proc->p_cvlock);
+}
+
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc),
+			       proc_ctor, proc_dtor);
+#else
+static struct kmem_cache proc_cache =
+	KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc), NULL, NULL);
+#endif // OPT_A2
+
 /*
  * Create a proc structure.
  */
@@ -87,29 +131,18 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(&proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(&proc_cache, proc);
 		return NULL;
 	}
 
 	threadarray_init(&proc->p_threads);
 #if OPT_A2
-	char* lock_name = kmalloc(strlen(proc->p_name) + strlen("_lock") + 1);
-	if(lock_name == NULL) {
-	    kfree(proc->p_name);
-	    kfree(proc);
-	    return NULL;
-	}
-	strcpy(lock_name, proc->p_name);
-	strcat(lock_name, "_lock");
-	proc->p_cvlock = lock_create(lock_name);
-
-	spinlock_init(&proc->p_lock);
 	proc->p_exitcode = _MKWAIT_STOP(0);
 #endif
 
@@ -128,18 +161,6 @@ proc_create(const char *name)
 
 	pidarray_init(&proc->p_cpids);
 	intarray_init(&proc->p_cpids_exitcodes);
-
-	char* cv_name = kmalloc(strlen(proc->p_name) + strlen("_wait_channel") + 1);
-	if(cv_name == NULL) {
-	    lock_destroy(proc->p_cvlock);
-	    spinlock_cleanup(&proc->p_lock);
-	    kfree(proc->p_name);
-	    kfree(proc);
-	    return NULL;
-	}
-	strcpy(cv_name, proc->p_name);
-	strcat(cv_name, "wait_channel");
-	proc->p_cv = cv_create(cv_name);
 #endif // OPT_A2
 
 	return proc;
@@ -151,6 +172,10 @@ proc_create(const char *name)
 void
 proc_destroy(struct proc *proc)
 {
+#ifdef UW
+	int count;
+#endif
+
 	/*
          * note: some parts of the process structure, such as the address space,
          *  are destroyed in sys_exit, before we get here
@@ -169,9 +194,9 @@ proc_destroy(struct proc *proc)
 	spinlock_release(&proc->p_lock);
 
 	if(parent_pid != NULL) {
-	    P(procs_mutex);
+	    rwlock_acquire_read(&procs_rwlock);
 	    struct proc *parent = procarray_get(&procs, *parent_pid);
-	    V(procs_mutex);
+	    rwlock_release(&procs_rwlock);
 
 	    spinlock_acquire(&proc->p_lock);
 	    pid_t pid = proc->p_pid;
@@ -207,9 +232,9 @@ proc_destroy(struct proc *proc)
 	    pid_t pid = *pidarray_get(&proc->p_cpids, i);
 	    spinlock_release(&proc->p_lock);
 
-	    P(procs_mutex);
+	    rwlock_acquire_read(&procs_rwlock);
 	    struct proc* child = procarray_get(&procs, pid);
-	    V(procs_mutex);
+	    rwlock_release(&procs_rwlock);
 
 	    spinlock_acquire(&child->p_lock);
 	    kfree(child->p_ppid);
@@ -226,9 +251,9 @@ proc_destroy(struct proc *proc)
 	    pid_t pid = proc->p_pid;
 	    spinlock_release(&proc->p_lock);
 
-	    P(procs_mutex);
+	    rwlock_acquire_write(&procs_rwlock);
 	    procarray_set(&procs, pid, NULL);
-	    V(procs_mutex);
+	    rwlock_release(&procs_rwlock);
 	}
 
 	spinlock_acquire(&proc->p_lock);
@@ -240,9 +265,9 @@ proc_destroy(struct proc *proc)
 	    pid_t* pid = pidarray_get(&proc->p_cpids, i);
 	    spinlock_release(&proc->p_lock);
 	    if(!is_running) {
-		P(procs_mutex);
+		rwlock_acquire_write(&procs_rwlock);
 		procarray_set(&procs, *pid, NULL);
-		V(procs_mutex);
+		rwlock_release(&procs_rwlock);
 	    }
 	}
 
@@ -251,13 +276,13 @@ proc_destroy(struct proc *proc)
 	spinlock_release(&proc->p_lock);
 
 	if(parent_is_alive) {
-	    P(procs_mutex);
+	    rwlock_acquire_read(&procs_rwlock);
 	    struct proc *parent = procarray_get(&procs, *proc->p_ppid);
-	    V(procs_mutex);
+	    rwlock_release(&procs_rwlock);
 
-	    lock_acquire(parent->p_cvlock);
-	    cv_signal(parent->p_cv, parent->p_cvlock);
-	    lock_release(parent->p_cvlock);
+	    lock_acquire(&parent->p_cvlock);
+	    cv_signal(&parent->p_cv, &parent->p_cvlock);
+	    lock_release(&parent->p_cvlock);
 	}
 #endif // OPT_A2
 
@@ -303,9 +328,7 @@ proc_destroy(struct proc *proc)
 	threadarray_cleanup(&proc->p_threads);
 	kfree(proc->p_name);
 #if OPT_A2
-	lock_destroy(proc->p_cvlock);
-
-	spinlock_cleanup(&proc->p_lock);
+	// p_cvlock, p_cv and p_lock stay with the structure in proc_cache
 	if(proc->p_ppid != NULL) kfree(proc->p_ppid);
 
 	while(pidarray_num(&proc->p_cpids) > 0) {
@@ -319,24 +342,20 @@ proc_destroy(struct proc *proc)
 	    intarray_remove(&proc->p_cpids_exitcodes, 0);
 	}
 	intarray_cleanup(&proc->p_cpids_exitcodes);
-
-	cv_destroy(proc->p_cv);
 #endif // OPT_A2
-	kfree(proc);
+	kmem_cache_free(&proc_cache, proc);
 
 #ifdef UW
 	/* decrement the process count */
         /* note: kproc is not included in the process count, but proc_destroy
 	   is never called on kproc (see KASSERT above), so we're OK to decrement
 	   the proc_count unconditionally here */
-	P(proc_count_mutex); 
-	KASSERT(proc_count > 0);
-	proc_count--;
+	count = atomic_add(&proc_count, -1);
+	KASSERT(count >= 0);
 	/* signal the kernel menu thread if the process count has reached zero */
-	if (proc_count == 0) {
-	  V(no_proc_sem);
+	if (count == 0) {
+	  V(&no_proc_sem);
 	}
-	V(proc_count_mutex);
 #endif // UW
 	
 
@@ -353,18 +372,9 @@ proc_bootstrap(void)
     panic("proc_create for kproc failed\n");
   }
 #ifdef UW
-  proc_count = 0;
-  proc_count_mutex = sem_create("proc_count_mutex",1);
-  if (proc_count_mutex == NULL) {
-    panic("could not create proc_count_mutex semaphore\n");
-  }
-  no_proc_sem = sem_create("no_proc_sem",0);
-  if (no_proc_sem == NULL) {
-    panic("could not create no_proc_sem semaphore\n");
-  }
+  atomic_store(&proc_count, 0);
 #endif // UW 
 #if OPT_A2
-  procs_mutex = sem_create("procs_mutex", 1);
   procarray_init(&procs);
   procarray_add(&procs, kproc, NULL);
   procarray_add(&procs, kproc, NULL);
@@ -424,7 +434,7 @@ proc_create_runprogram(const char *name)
 #endif // UW
 
 #if OPT_A2
-	P(procs_mutex);
+	rwlock_acquire_write(&procs_rwlock);
 	int num = procarray_num(&procs);
 	int i = 1;	
 	for(i = 1; i < num; ++i) {
@@ -432,7 +442,7 @@ proc_create_runprogram(const char *name)
 	}
 	if(i == num) procarray_add(&procs, proc, NULL);
 	else         procarray_set(&procs, i, proc);
-	V(procs_mutex);
+	rwlock_release(&procs_rwlock);
 
 	pid_t *temp = kmalloc(sizeof(pid_t));
 	if(temp == NULL) return NULL;
@@ -464,9 +474,7 @@ proc_create_runprogram(const char *name)
 	/* increment the count of processes */
         /* we are assuming that all procs, including those created by fork(),
            are created using a call to proc_create_runprogram  */
-	P(proc_count_mutex); 
-	proc_count++;
-	V(proc_count_mutex);
+	atomic_add(&proc_count, 1);
 #endif // UW
 
 	return proc;
@@ -581,9 +589,9 @@ proc_update_exitcode(int exitcode)
 bool
 is_valid_proc(pid_t pid)
 {
-    P(procs_mutex);
+    rwlock_acquire_read(&procs_rwlock);
     bool is_valid = procarray_get(&procs, pid) != NULL;
-    V(procs_mutex);
+    rwlock_release(&procs_rwlock);
 
     return is_valid;
 }
@@ -615,17 +623,17 @@ int
 proc_wait_for_child_to_die(pid_t pid)
 {
     unsigned int i;
-    lock_acquire(curproc->p_cvlock);
+    lock_acquire(&curproc->p_cvlock);
     for(i = 0; i < pidarray_num(&curproc->p_cpids); ++i) {
 	if(*pidarray_get(&curproc->p_cpids, i) == pid) break;
     }
 
     while(intarray_get(&curproc->p_cpids_exitcodes, i) == NULL) {
-	cv_wait(curproc->p_cv, curproc->p_cvlock);
+	cv_wait(&curproc->p_cv, &curproc->p_cvlock);
     }
 
     int exitcode = *intarray_get(&curproc->p_cpids_exitcodes, i);
-    lock_release(curproc->p_cvlock);
+    lock_release(&curproc->p_cvlock);
 
     return exitcode;
 }
@@ -42,10 +42,14 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <vm.h>
+#include <kmem_cache.h>
+#include <lockstat.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-A3.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -163,7 +167,7 @@ common_prog(int nargs, char **args)
 #ifdef UW
 	/* wait until the process we have just launched - and any others that it 
 	   may fork - is finished before proceeding */
-	P(no_proc_sem);
+	P(&no_proc_sem);
 #endif // UW
 
 	return 0;
@@ -415,10 +419,81 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+	kmem_cache_printstats();
 	
 	return 0;
 }
 
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_schedlatency(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printlatency();
+
+	return 0;
+}
+
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_printprofile();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "clear")) {
+		lockstat_clear();
+		return 0;
+	}
+	if (nargs > 2) {
+		kprintf("Usage: lk [count | clear]\n");
+		return EINVAL;
+	}
+
+	lockstat_print(nargs == 2 ? (unsigned)atoi(args[1]) : 0);
+
+	return 0;
+}
+#endif
+
+#if OPT_A3
+static
+int
+cmd_vmstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printstats();
+
+	return 0;
+}
+#endif
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -478,17 +553,27 @@ cmd_opsmenu(int n, char **a)
 static const char *testmenu[] = {
 	"[at]  Array test                    ",
 	"[bt]  Bitmap test                   ",
+	"[mq]  MPSC queue test               ",
 	"[km1] Kernel malloc test            ",
 	"[km2] kmalloc stress test           ",
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tt4] Wakeup latency test           ",
+	"[tt5] Thread creation benchmark     ",
+	"[tt6] Load balancing benchmark      ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Lock contention benchmark     ",
+	"[sy5] Spinlock contention benchmark ",
+	"[sy6] Priority inversion test       ",
+	"[sy7] Timed wait test               ",
+	"[sy8] Atomic counter benchmark      ",
+	"[sy9] Reader-writer lock benchmark  ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -528,6 +613,15 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[kp] Kernel heap profile            ",
+	"[ss] Scheduler stats                ",
+	"[sl] Scheduler wakeup latency       ",
+#if OPT_LOCKSTAT
+	"[lk] Lock contention [n|clear]      ",
+#endif
+#if OPT_A3
+	"[vm] VM (madvise) stats             ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -584,10 +678,20 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "kp",		cmd_kheapprofile },
+	{ "ss",		cmd_schedstats },
+	{ "sl",		cmd_schedlatency },
+#if OPT_LOCKSTAT
+	{ "lk",		cmd_lockstat },
+#endif
+#if OPT_A3
+	{ "vm",		cmd_vmstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
 	{ "bt",		bitmaptest },
+	{ "mq",		mpscqtest },
 	{ "km1",	malloctest },
 	{ "km2",	mallocstress },
 #if OPT_NET
@@ -596,11 +700,20 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tt4",	threadtest4 },
+	{ "tt5",	threadtest5 },
+	{ "tt6",	threadtest6 },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	lockbench },
+	{ "sy5",	spinbench },
+	{ "sy6",	pitest },
+	{ "sy7",	timedwaittest },
+	{ "sy8",	atomicbench },
+	{ "sy9",	rwbench },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
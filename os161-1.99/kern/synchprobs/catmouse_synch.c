@@ -16,9 +16,11 @@
 static volatile int number_of_cats_eating;
 static volatile int number_of_mice_eating;
 
-static struct lock **bowl_locks;
-static struct cv *cats_done_eating;
-static struct cv *mice_done_eating;
+static struct lock *bowl_locks;
+static struct cv cats_done_eating =
+  CV_INITIALIZER(cats_done_eating, "cats done eating");
+static struct cv mice_done_eating =
+  CV_INITIALIZER(mice_done_eating, "mice done eating");
 
 
 /* 
@@ -36,16 +38,13 @@ catmouse_sync_init(int bowls)
   number_of_mice_eating = 0;
 
   bowl_locks = kmalloc(sizeof(struct lock) * bowls);
+  if(bowl_locks == NULL) {
+    panic("could not create bowl locks");
+  }
   for(int i = 0; i < bowls; ++i) {
-    bowl_locks[i] = lock_create("bowl " + i);
-    if(bowl_locks[i] == NULL) {
-      panic("could not create bowl " + i);
-    }
+    lock_init(&bowl_locks[i], "bowl");
   }
 
-  cats_done_eating = cv_create("cats done eating");
-  mice_done_eating = cv_create("mice done eatting");
-
   return;
 }
 
@@ -63,16 +62,9 @@ catmouse_sync_cleanup(int bowls)
   KASSERT(bowl_locks != NULL);
 
   for(int i = 0; i < bowls; ++i) {
-    KASSERT(bowl_locks[i] != NULL);
-    lock_destroy(bowl_locks[i]);
+    lock_cleanup(&bowl_locks[i]);
   }
   kfree(bowl_locks);
-
-  KASSERT(cats_done_eating != NULL);
-  cv_destroy(cats_done_eating);
-
-  KASSERT(mice_done_eating != NULL);
-  cv_destroy(mice_done_eating);
 }
 
 
@@ -91,9 +83,9 @@ catmouse_sync_cleanup(int bowls)
 void
 cat_before_eating(unsigned int bowl) 
 {
-  lock_acquire(bowl_locks[bowl-1]);
+  lock_acquire(&bowl_locks[bowl-1]);
   while(number_of_mice_eating > 0) {
-    cv_wait(mice_done_eating, bowl_locks[bowl-1]);
+    cv_wait(&mice_done_eating, &bowl_locks[bowl-1]);
   }
 
   number_of_cats_eating++;
@@ -117,9 +109,9 @@ cat_after_eating(unsigned int bowl)
 {
   number_of_cats_eating--;
   if(number_of_cats_eating == 0) {
-      cv_broadcast(cats_done_eating, bowl_locks[bowl - 1]);
+      cv_broadcast(&cats_done_eating, &bowl_locks[bowl - 1]);
   }
-  lock_release(bowl_locks[bowl-1]);
+  lock_release(&bowl_locks[bowl-1]);
 }
 
 /*
@@ -137,9 +129,9 @@ cat_after_eating(unsigned int bowl)
 void
 mouse_before_eating(unsigned int bowl) 
 {
-  lock_acquire(bowl_locks[bowl-1]);
+  lock_acquire(&bowl_locks[bowl-1]);
   while(number_of_cats_eating > 0) {
-    cv_wait(cats_done_eating, bowl_locks[bowl-1]);
+    cv_wait(&cats_done_eating, &bowl_locks[bowl-1]);
   }
 
   number_of_mice_eating++;
@@ -163,7 +155,7 @@ mouse_after_eating(unsigned int bowl)
 {
   number_of_mice_eating--;
   if(number_of_mice_eating == 0) {
-      cv_broadcast(mice_done_eating, bowl_locks[bowl - 1]);
+      cv_broadcast(&mice_done_eating, &bowl_locks[bowl - 1]);
   }
-  lock_release(bowl_locks[bowl-1]);
+  lock_release(&bowl_locks[bowl-1]);
 }
@@ -0,0 +1,47 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/schedstats.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <syscall.h>
+#include <thread.h>
+
+/*
+ * setaffinity - restrict the calling process to the cpus in MASK (bit
+ * N for cpu N). Like the rest of the thread's state, the mask is kept
+ * across execv and inherited by fork, so a process can pin a program
+ * by setting it and then exec'ing.
+ */
+int
+sys_setaffinity(unsigned mask)
+{
+    return thread_setaffinity(mask);
+}
+
+/*
+ * getaffinity - return the calling process's cpu mask.
+ */
+int
+sys_getaffinity(unsigned *retval)
+{
+    *retval = thread_getaffinity();
+    return 0;
+}
+
+/*
+ * schedstats - copy out the scheduler statistics of cpu CPU, or of the
+ * calling thread if CPU is SCHEDSTATS_SELF. Fails with ENOSYS unless
+ * the kernel was built with the schedstats option.
+ */
+int
+sys_schedstats(int cpu, userptr_t user_stats)
+{
+    struct schedstats ss;
+    int result;
+
+    result = thread_getschedstats(cpu, &ss);
+    if (result) {
+        return result;
+    }
+    return copyout(&ss, user_stats, sizeof(ss));
+}
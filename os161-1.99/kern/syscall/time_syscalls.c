@@ -28,6 +28,8 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +58,48 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * Sleep for the time in the struct timespec at USER_REQ. Sleeps are
+ * in whole hardclocks, rounded up, plus one, since the first hardclock
+ * may come at any moment. Nothing can cut a sleep short, so the time
+ * left, stored at USER_REM if it isn't NULL, is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec ts;
+	unsigned ticks;
+	int result;
+
+	result = copyin(user_req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	if (ts.tv_sec >= ~0U / HZ - 2) {
+		ticks = ~0U;
+	}
+	else {
+		ticks = (unsigned)ts.tv_sec * HZ
+			+ ((unsigned)ts.tv_nsec + 1000000000 / HZ - 1)
+			/ (1000000000 / HZ);
+		if (ticks > 0) {
+			ticks++;
+		}
+	}
+	clocksleep_ticks(ticks);
+
+	if (user_rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, user_rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,74 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/mman.h>
+#include <lib.h>
+#include <syscall.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <elf.h>
+#include "opt-A3.h"
+
+#if OPT_A3
+/*
+ * mmap - only anonymous mappings are supported. The fd and offset
+ * arguments live on the user stack; since they are meaningless for
+ * MAP_ANON we never fetch them. ADDR is only a hint and is ignored.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, vaddr_t *retval)
+{
+    (void) addr;
+
+    if(len == 0) return EINVAL;
+    if(len > (size_t)(USERSPACETOP - AS_MMAPBASE)) return ENOMEM;
+    if((flags & MAP_ANON) == 0) return ENODEV; // No file-backed mappings
+
+    int share = flags & (MAP_SHARED | MAP_PRIVATE);
+    if(share != MAP_SHARED && share != MAP_PRIVATE) return EINVAL;
+    if(prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) return EINVAL;
+
+    int permissions = 0;
+    if(prot & PROT_READ)  permissions |= PF_R;
+    if(prot & PROT_WRITE) permissions |= PF_W;
+    if(prot & PROT_EXEC)  permissions |= PF_X;
+
+    size_t npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    struct addrspace *as = curproc_getas();
+    KASSERT(as != NULL);
+
+    return as_define_mapping(as, npages, permissions, share == MAP_SHARED,
+			     retval);
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+    vaddr_t vaddr = (vaddr_t) addr;
+
+    if(len == 0 || (vaddr & ~(vaddr_t)PAGE_FRAME) != 0) return EINVAL;
+    if(len > (size_t)(USERSPACETOP - AS_MMAPBASE)) return EINVAL;
+
+    struct addrspace *as = curproc_getas();
+    KASSERT(as != NULL);
+
+    return as_remove_mapping(as, vaddr, (len + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+int
+sys_madvise(userptr_t addr, size_t len, int advice)
+{
+    vaddr_t vaddr = (vaddr_t) addr;
+
+    if((vaddr & ~(vaddr_t)PAGE_FRAME) != 0) return EINVAL;
+    if(advice < MADV_NORMAL || advice > MADV_DONTNEED) return EINVAL;
+    if(len == 0) return 0;
+    if(vaddr >= USERSPACETOP || len > USERSPACETOP - vaddr) return ENOMEM;
+
+    struct addrspace *as = curproc_getas();
+    KASSERT(as != NULL);
+
+    return as_advise(as, vaddr, (len + PAGE_SIZE - 1) / PAGE_SIZE, advice);
+}
+#endif // OPT_A3
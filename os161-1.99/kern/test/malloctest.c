@@ -31,9 +31,11 @@
  * Test code for kmalloc.
  */
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <test.h>
 
 /*
@@ -45,11 +47,26 @@
  *
  * mallocstress does the same thing, but from NTHREADS different
  * threads at once.
+ *
+ * "km2 big" instead has each thread keep its last NHOLD blocks live,
+ * so that together they hold more than the 256 pages of subpage heap
+ * the allocator used to be limited to. This needs well over 1M of
+ * RAM (ramsize=4194304 in sys161.conf is plenty).
+ *
+ * "km2 bench" measures throughput instead: each thread does NBENCH
+ * rounds of allocating and freeing a block of every subpage size,
+ * which is the per-CPU magazines' best case. Run it with several CPUs
+ * and compare against one.
  */
 
 #define NTRIES   1200
 #define ITEMSIZE  997
 #define NTHREADS  8
+#define NHOLD     160
+#define NBENCH    2000
+
+static const size_t benchsizes[] = { 16, 24, 48, 100, 200, 400, 1000 };
+#define NBENCHSIZES (sizeof(benchsizes) / sizeof(benchsizes[0]))
 
 static
 void
@@ -90,6 +107,64 @@ mallocthread(void *sm, unsigned long num)
 	}
 }
 
+static
+void
+mallocholdthread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	void *held[NHOLD];
+	void *ptr;
+	int i;
+
+	for (i=0; i<NHOLD; i++) {
+		held[i] = NULL;
+	}
+
+	for (i=0; i<NTRIES; i++) {
+		ptr = kmalloc(ITEMSIZE);
+		if (ptr==NULL) {
+			kprintf("thread %lu: kmalloc returned NULL after "
+				"%d tries\n", num, i);
+			break;
+		}
+		kfree(held[i % NHOLD]);
+		held[i % NHOLD] = ptr;
+	}
+
+	for (i=0; i<NHOLD; i++) {
+		kfree(held[i]);
+	}
+	V(sem);
+}
+
+static
+void
+mallocbenchthread(void *sm, unsigned long num)
+{
+	struct semaphore *sem = sm;
+	void *ptrs[NBENCHSIZES];
+	unsigned i, j;
+
+	for (i=0; i<NBENCH; i++) {
+		for (j=0; j<NBENCHSIZES; j++) {
+			ptrs[j] = kmalloc(benchsizes[j]);
+			if (ptrs[j] == NULL) {
+				kprintf("thread %lu: kmalloc returned NULL\n",
+					num);
+				while (j-- > 0) {
+					kfree(ptrs[j]);
+				}
+				V(sem);
+				return;
+			}
+		}
+		for (j=0; j<NBENCHSIZES; j++) {
+			kfree(ptrs[j]);
+		}
+	}
+	V(sem);
+}
+
 int
 malloctest(int nargs, char **args)
 {
@@ -108,20 +183,45 @@ mallocstress(int nargs, char **args)
 {
 	struct semaphore *sem;
 	int i, result;
+	bool big = false, bench = false;
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
+	unsigned ms, ops;
 
-	(void)nargs;
-	(void)args;
+	if (nargs == 2 && !strcmp(args[1], "big")) {
+		big = true;
+	}
+	else if (nargs == 2 && !strcmp(args[1], "bench")) {
+		bench = true;
+	}
+	else if (nargs != 1) {
+		kprintf("Usage: km2 [big|bench]\n");
+		return EINVAL;
+	}
 
 	sem = sem_create("mallocstress", 0);
 	if (sem == NULL) {
 		panic("mallocstress: sem_create failed\n");
 	}
 
-	kprintf("Starting kmalloc stress test...\n");
+	if (big) {
+		kprintf("Starting kmalloc stress test (%d blocks held per "
+			"thread)...\n", NHOLD);
+	}
+	else if (bench) {
+		kprintf("Starting kmalloc throughput test...\n");
+	}
+	else {
+		kprintf("Starting kmalloc stress test...\n");
+	}
+
+	gettime(&secs1, &nsecs1);
 
 	for (i=0; i<NTHREADS; i++) {
 		result = thread_fork("mallocstress", NULL,
-				     mallocthread, sem, i);
+				     big ? mallocholdthread :
+				     bench ? mallocbenchthread : mallocthread,
+				     sem, i);
 		if (result) {
 			panic("mallocstress: thread_fork failed: %s\n",
 			      strerror(result));
@@ -132,6 +232,20 @@ mallocstress(int nargs, char **args)
 		P(sem);
 	}
 
+	gettime(&secs2, &nsecs2);
+	if (nsecs2 < nsecs1) {
+		secs2--;
+		nsecs2 += 1000000000;
+	}
+	ms = (secs2 - secs1) * 1000 + (nsecs2 - nsecs1) / 1000000;
+
+	if (bench) {
+		/* one kmalloc and one kfree per size per round */
+		ops = NTHREADS * NBENCH * NBENCHSIZES * 2;
+		kprintf("%u kmalloc/kfree calls in %u ms: %u calls/ms\n",
+			ops, ms, ms ? ops / ms : ops);
+	}
+
 	sem_destroy(sem);
 	kprintf("kmalloc stress test done\n");
 
@@ -0,0 +1,144 @@
+/*
+ * Test for the lock-free MPSC queue (see <mpscq.h>).
+ *
+ * One producer thread per cpu (up to MQ_NPRODUCERS) pushes MQ_NITEMS
+ * numbered items while this thread takes them off as they come. Each
+ * producer's items must come out in order, none may be lost or come
+ * out twice, and a push should find the queue empty only when the
+ * consumer has emptied it since the last one.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <thread.h>
+#include <synch.h>
+#include <mpscq.h>
+#include <test.h>
+
+#define MQ_NPRODUCERS	8
+#define MQ_NITEMS	500
+
+struct mqitem {
+	struct mpscq_node mi_node;
+	unsigned mi_producer;
+	unsigned mi_seq;
+};
+
+static struct mpscq mqtestq;
+static struct semaphore *mqdone;
+static struct mqitem *mqitems[MQ_NPRODUCERS];
+static unsigned mqfirsts[MQ_NPRODUCERS];	/* pushes that found it empty */
+
+static
+void
+mqproducer(void *junk, unsigned long num)
+{
+	struct mqitem *mi;
+	unsigned i;
+
+	(void)junk;
+
+	/* Spread out over the cpus, if there are enough. */
+	thread_setaffinity(1U << num);
+
+	for (i=0; i<MQ_NITEMS; i++) {
+		mi = &mqitems[num][i];
+		mi->mi_producer = num;
+		mi->mi_seq = i;
+		mpscq_node_init(&mi->mi_node, mi);
+		if (mpscq_push(&mqtestq, &mi->mi_node)) {
+			mqfirsts[num]++;
+		}
+		if (i % 64 == 0) {
+			thread_yield();
+		}
+	}
+	V(mqdone);
+}
+
+int
+mpscqtest(int nargs, char **args)
+{
+	struct mpscq_node *n;
+	struct mqitem *mi;
+	unsigned next[MQ_NPRODUCERS];
+	unsigned i, got, takes, firsts;
+	bool ok = true;
+	int result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting MPSC queue test...\n");
+
+	mpscq_init(&mqtestq);
+	mqdone = sem_create("mqdone", 0);
+	if (mqdone == NULL) {
+		panic("mpscqtest: sem_create failed\n");
+	}
+	for (i=0; i<MQ_NPRODUCERS; i++) {
+		mqitems[i] = kmalloc(MQ_NITEMS * sizeof(struct mqitem));
+		if (mqitems[i] == NULL) {
+			panic("mpscqtest: out of memory\n");
+		}
+		mqfirsts[i] = 0;
+		next[i] = 0;
+	}
+
+	for (i=0; i<MQ_NPRODUCERS; i++) {
+		result = thread_fork("mqproducer", NULL, mqproducer, NULL, i);
+		if (result) {
+			panic("mpscqtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	got = takes = 0;
+	while (got < MQ_NPRODUCERS * MQ_NITEMS) {
+		n = mpscq_takeall(&mqtestq);
+		if (n == NULL) {
+			thread_yield();
+			continue;
+		}
+		takes++;
+		for (; n != NULL; n = n->mn_next) {
+			mi = n->mn_self;
+			KASSERT(mi->mi_producer < MQ_NPRODUCERS);
+			if (mi->mi_seq != next[mi->mi_producer]) {
+				kprintf("producer %u: got item %u, expected "
+					"%u\n", mi->mi_producer, mi->mi_seq,
+					next[mi->mi_producer]);
+				ok = false;
+			}
+			next[mi->mi_producer] = mi->mi_seq + 1;
+			got++;
+		}
+	}
+	for (i=0; i<MQ_NPRODUCERS; i++) {
+		P(mqdone);
+	}
+
+	if (!mpscq_isempty(&mqtestq)) {
+		kprintf("Queue not empty at the end\n");
+		ok = false;
+	}
+	firsts = 0;
+	for (i=0; i<MQ_NPRODUCERS; i++) {
+		firsts += mqfirsts[i];
+	}
+	kprintf("%u items in %u takes; %u pushes found it empty\n",
+		got, takes, firsts);
+	if (firsts != takes) {
+		/* Each take empties what one empty-finding push began. */
+		ok = false;
+	}
+
+	for (i=0; i<MQ_NPRODUCERS; i++) {
+		kfree(mqitems[i]);
+	}
+	sem_destroy(mqdone);
+	mpscq_cleanup(&mqtestq);
+
+	kprintf("MPSC queue test %s.\n", ok ? "done" : "FAILED");
+	return 0;
+}
@@ -32,11 +32,17 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
+#include <spl.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <synch.h>
+#include <spinlock.h>
+#include <atomic.h>
 #include <test.h>
+#include "opt-mlfq.h"
 
 #define NSEMLOOPS     63
 #define NLOCKLOOPS    120
@@ -347,3 +353,771 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Lock contention benchmark. NBENCHTHREADS threads, each pinned to a
+ * different cpu where there are enough, take and release one lock
+ * NBENCHLOOPS times with a short critical section, as with
+ * vfs_biglock or kprintf_lock. Reports how long that took and how the
+ * contended acquires were satisfied. Run with various "cpus" settings
+ * in sys161.conf.
+ */
+
+#define NBENCHTHREADS	8
+#define NBENCHLOOPS	2000
+#define BENCHHOLD	20
+
+static struct lock *benchlock;
+static struct semaphore *benchdone;
+
+static
+void
+lockbenchthread(void *junk, unsigned long num)
+{
+	volatile int j;
+	int i;
+
+	(void)junk;
+
+	/* If there's no such cpu, just run wherever. */
+	thread_setaffinity(1U << (num % 32));
+
+	for (i=0; i<NBENCHLOOPS; i++) {
+		lock_acquire(benchlock);
+		testval1++;
+		for (j=0; j<BENCHHOLD; j++);
+		lock_release(benchlock);
+	}
+	V(benchdone);
+}
+
+int
+lockbench(int nargs, char **args)
+{
+	time_t secs1, secs2;
+	uint32_t nsecs1, nsecs2;
+	unsigned long ms;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting lock contention benchmark...\n");
+
+	benchlock = lock_create("benchlock");
+	benchdone = sem_create("benchdone", 0);
+	if (benchlock == NULL || benchdone == NULL) {
+		panic("lockbench: out of memory\n");
+	}
+	testval1 = 0;
+
+	gettime(&secs1, &nsecs1);
+	for (i=0; i<NBENCHTHREADS; i++) {
+		result = thread_fork("lockbench", NULL, lockbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("lockbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NBENCHTHREADS; i++) {
+		P(benchdone);
+	}
+	gettime(&secs2, &nsecs2);
+
+	KASSERT(testval1 == NBENCHTHREADS * NBENCHLOOPS);
+	ms = (secs2 - secs1) * 1000 + nsecs2 / 1000000 - nsecs1 / 1000000;
+	if (ms == 0) {
+		ms = 1;
+	}
+	kprintf("%d threads x %d acquires: %lu ms, %lu acquires/ms\n",
+		NBENCHTHREADS, NBENCHLOOPS, ms,
+		(unsigned long)benchlock->lk_acquires / ms);
+	kprintf("contended %u, won by spinning %u, sleeps %u\n",
+		benchlock->lk_contended, benchlock->lk_spinwins,
+		benchlock->lk_sleeps);
+
+	lock_destroy(benchlock);
+	sem_destroy(benchdone);
+	kprintf("Lock contention benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Spinlock contention benchmark. One thread per cpu (up to
+ * NSPINTHREADS) takes and releases a spinlock as fast as it can for
+ * SPINBENCHSECS seconds, first with a test-and-set lock and then with
+ * a ticket lock. The total shows throughput, and the gap between the
+ * busiest and least busy cpu shows fairness. This is done on 2, 4, 8
+ * ... cpus and then all of them, so one boot with "cpus" set to 8 in
+ * sys161.conf shows how each lock scales.
+ */
+
+#define NSPINTHREADS	8
+#define SPINBENCHSECS	2
+#define SPINHOLD	10
+
+static struct spinlock benchspin;
+static volatile bool spinstop;
+static bool spinpresent[NSPINTHREADS];
+static unsigned long spincounts[NSPINTHREADS];
+
+static
+void
+spinbenchthread(void *junk, unsigned long num)
+{
+	volatile int j;
+	unsigned long n;
+
+	(void)junk;
+
+	n = 0;
+	spinpresent[num] = (thread_setaffinity(1U << num) == 0);
+	if (spinpresent[num]) {
+		while (!spinstop) {
+			spinlock_acquire(&benchspin);
+			for (j=0; j<SPINHOLD; j++);
+			spinlock_release(&benchspin);
+			n++;
+		}
+	}
+	spincounts[num] = n;
+	V(benchdone);
+}
+
+static
+void
+spinbench_run(bool ticket, unsigned nthreads)
+{
+	unsigned long total, min, max;
+	unsigned i, ncpus;
+	int result;
+
+	if (ticket) {
+		spinlock_init_ticket(&benchspin);
+	}
+	else {
+		spinlock_init(&benchspin);
+	}
+	spinstop = false;
+
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinbench", NULL, spinbenchthread,
+				     NULL, i);
+		if (result) {
+			panic("spinbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	clocksleep(SPINBENCHSECS);
+	spinstop = true;
+	for (i=0; i<nthreads; i++) {
+		P(benchdone);
+	}
+	spinlock_cleanup(&benchspin);
+
+	ncpus = 0;
+	total = max = 0;
+	min = (unsigned long)-1;
+	for (i=0; i<nthreads; i++) {
+		if (!spinpresent[i]) {
+			continue;
+		}
+		ncpus++;
+		total += spincounts[i];
+		if (spincounts[i] < min) {
+			min = spincounts[i];
+		}
+		if (spincounts[i] > max) {
+			max = spincounts[i];
+		}
+	}
+	kprintf("%-13s %u cpus: %lu acquires/s, per cpu min %lu max %lu\n",
+		ticket ? "ticket:" : "test-and-set:", ncpus,
+		total / SPINBENCHSECS, min, max);
+}
+
+int
+spinbench(int nargs, char **args)
+{
+	unsigned oldaffinity, mask, ncpus, n;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting spinlock contention benchmark...\n");
+
+	benchdone = sem_create("benchdone", 0);
+	if (benchdone == NULL) {
+		panic("spinbench: sem_create failed\n");
+	}
+
+	oldaffinity = thread_getaffinity();
+	thread_setaffinity(~0U);
+	ncpus = 0;
+	for (mask = thread_getaffinity(); mask != 0; mask &= mask - 1) {
+		ncpus++;
+	}
+	thread_setaffinity(oldaffinity);
+	if (ncpus > NSPINTHREADS) {
+		ncpus = NSPINTHREADS;
+	}
+
+	for (n=2; n<ncpus; n*=2) {
+		spinbench_run(false, n);
+		spinbench_run(true, n);
+	}
+	spinbench_run(false, ncpus);
+	spinbench_run(true, ncpus);
+
+	sem_destroy(benchdone);
+	kprintf("Spinlock contention benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Milliseconds since SECS1/NSECS1, as read from gettime; for the
+ * priority inversion and timed wait tests.
+ */
+static
+unsigned long
+ms_since(time_t secs1, uint32_t nsecs1)
+{
+	time_t secs2;
+	uint32_t nsecs2;
+
+	gettime(&secs2, &nsecs2);
+	return (secs2 - secs1) * 1000 + nsecs2 / 1000000 - nsecs1 / 1000000;
+}
+
+/*
+ * Priority inversion test. Three threads share cpu 0. A low-priority
+ * thread (cpu-bound, so at the bottom level) takes a lock and does
+ * about PI_HOLDMS of work holding it. Then a hog arrives, which as a
+ * new thread starts above the holder, and a high-priority thread that
+ * waits for the lock. Without priority inheritance the holder gets
+ * the cpu only once the hog has sunk to its level, and then only half
+ * of it, so the wait is well over twice the work. With it, the holder
+ * runs at the waiter's priority and the wait is no longer than the
+ * work itself. The test fails if the wait is more than half as long
+ * again.
+ */
+
+#if OPT_MLFQ
+#define PI_CALLOOPS	1000000
+#define PI_HOLDMS	500
+
+static struct lock *pilock;
+static struct semaphore *piheld;
+static volatile bool pistop;
+static unsigned long piloops;
+static unsigned long piwaitms;
+
+static
+void
+pi_work(unsigned long loops)
+{
+	volatile unsigned long i;
+
+	for (i=0; i<loops; i++);
+}
+
+static
+void
+pilowthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	/* Use up our time slices so we're at the bottom level. */
+	pi_work(piloops);
+
+	lock_acquire(pilock);
+	V(piheld);
+	pi_work(piloops);
+	lock_release(pilock);
+	V(benchdone);
+}
+
+static
+void
+pihogthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!pistop) {
+		pi_work(1000);
+	}
+	V(benchdone);
+}
+
+static
+void
+pihighthread(void *junk, unsigned long num)
+{
+	time_t secs;
+	uint32_t nsecs;
+
+	(void)junk;
+	(void)num;
+
+	gettime(&secs, &nsecs);
+	lock_acquire(pilock);
+	piwaitms = ms_since(secs, nsecs);
+	lock_release(pilock);
+
+	pistop = true;
+	V(benchdone);
+}
+
+static
+void
+pi_fork(const char *name, void (*func)(void *, unsigned long))
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+#endif /* OPT_MLFQ */
+
+int
+pitest(int nargs, char **args)
+{
+#if OPT_MLFQ
+	time_t secs;
+	uint32_t nsecs;
+	unsigned long calms;
+	unsigned oldmask;
+	int i;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting priority inversion test...\n");
+
+	pilock = lock_create("pilock");
+	piheld = sem_create("piheld", 0);
+	benchdone = sem_create("benchdone", 0);
+	if (pilock == NULL || piheld == NULL || benchdone == NULL) {
+		panic("pitest: out of memory\n");
+	}
+	pistop = false;
+
+	/* Everyone runs on cpu 0; the threads inherit our mask. */
+	oldmask = thread_getaffinity();
+	thread_setaffinity(1);
+
+	gettime(&secs, &nsecs);
+	pi_work(PI_CALLOOPS);
+	calms = ms_since(secs, nsecs);
+	if (calms == 0) {
+		calms = 1;
+	}
+	piloops = (unsigned long)PI_CALLOOPS * PI_HOLDMS / calms;
+
+	pi_fork("pilow", pilowthread);
+	P(piheld);
+	pi_fork("pihog", pihogthread);
+	pi_fork("pihigh", pihighthread);
+	for (i=0; i<3; i++) {
+		P(benchdone);
+	}
+
+	thread_setaffinity(oldmask);
+	lock_destroy(pilock);
+	sem_destroy(piheld);
+	sem_destroy(benchdone);
+
+	kprintf("Lock held for about %d ms; high-priority thread waited "
+		"%lu ms\n", PI_HOLDMS, piwaitms);
+	if (piwaitms > PI_HOLDMS * 3 / 2) {
+		kprintf("Test failed: waited too long\n");
+	}
+	else {
+		kprintf("Priority inversion test done.\n");
+	}
+#else
+	(void)nargs;
+	(void)args;
+
+	kprintf("pitest: needs the mlfq kernel option\n");
+#endif
+	return 0;
+}
+
+/*
+ * Timers and timed waits. Checks that sem_timed_P and cv_timedwait
+ * time out no sooner than asked and return promptly when woken, that a
+ * stopped timer doesn't go off, and that timers due at different times
+ * (some more than one turn of the timer wheel away) go off in order.
+ */
+
+#define TW_WAITMS	200
+#define TW_NTIMERS	16
+
+static struct semaphore *twsem;
+static volatile unsigned twfired;
+static volatile unsigned twlast;
+static volatile bool twbadorder;
+
+static
+void
+tw_poster(void *junk, unsigned long ms)
+{
+	(void)junk;
+
+	clocksleep_ticks(MSTOTICKS(ms));
+	V(twsem);
+}
+
+/* Timer function; DATA is how many ticks it was started with. */
+static
+void
+tw_fire(void *data)
+{
+	unsigned ticks = (uintptr_t)data;
+
+	if (ticks < twlast) {
+		twbadorder = true;
+	}
+	twlast = ticks;
+	twfired++;
+}
+
+int
+timedwaittest(int nargs, char **args)
+{
+	struct timer timers[TW_NTIMERS], stopped;
+	struct lock *lk;
+	struct cv *cv;
+	time_t secs;
+	uint32_t nsecs;
+	unsigned long ms;
+	unsigned i;
+	bool ok = true;
+	int result, spl;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting timed wait test...\n");
+
+	twsem = sem_create("twsem", 0);
+	lk = lock_create("twlock");
+	cv = cv_create("twcv");
+	if (twsem == NULL || lk == NULL || cv == NULL) {
+		panic("timedwaittest: out of memory\n");
+	}
+
+	gettime(&secs, &nsecs);
+	result = sem_timed_P(twsem, MSTOTICKS(TW_WAITMS));
+	ms = ms_since(secs, nsecs);
+	kprintf("sem_timed_P with no V: %s after %lu ms\n",
+		strerror(result), ms);
+	if (result != ETIMEDOUT || ms < TW_WAITMS) {
+		ok = false;
+	}
+
+	result = thread_fork("twposter", NULL, tw_poster, NULL, TW_WAITMS / 4);
+	if (result) {
+		panic("timedwaittest: thread_fork failed: %s\n",
+		      strerror(result));
+	}
+	gettime(&secs, &nsecs);
+	result = sem_timed_P(twsem, MSTOTICKS(TW_WAITMS * 10));
+	ms = ms_since(secs, nsecs);
+	kprintf("sem_timed_P with V after %d ms: %s after %lu ms\n",
+		TW_WAITMS / 4, result ? strerror(result) : "ok", ms);
+	if (result != 0 || ms >= TW_WAITMS * 10) {
+		ok = false;
+	}
+
+	lock_acquire(lk);
+	gettime(&secs, &nsecs);
+	result = cv_timedwait(cv, lk, MSTOTICKS(TW_WAITMS));
+	ms = ms_since(secs, nsecs);
+	kprintf("cv_timedwait with no signal: %s after %lu ms\n",
+		strerror(result), ms);
+	if (result != ETIMEDOUT || ms < TW_WAITMS || !lock_do_i_hold(lk)) {
+		ok = false;
+	}
+	lock_release(lk);
+
+	/* Start them all in the same tick, latest first. */
+	twfired = 0;
+	twlast = 0;
+	twbadorder = false;
+	timer_init(&stopped, tw_fire, (void *)0);
+	spl = splhigh();
+	for (i=0; i<TW_NTIMERS; i++) {
+		timer_init(&timers[i], tw_fire,
+			   (void *)(uintptr_t)((TW_NTIMERS - i) * 37));
+		timer_start(&timers[i], (TW_NTIMERS - i) * 37);
+	}
+	timer_start(&stopped, 10);
+	splx(spl);
+	if (!timer_stop(&stopped)) {
+		kprintf("timer_stop: timer had already gone off\n");
+		ok = false;
+	}
+	clocksleep_ticks(TW_NTIMERS * 37 + 2);
+	for (i=0; i<TW_NTIMERS; i++) {
+		timer_stop(&timers[i]);
+	}
+	kprintf("%u of %d timers went off%s\n", twfired, TW_NTIMERS,
+		twbadorder ? ", out of order" : "");
+	if (twfired != TW_NTIMERS || twbadorder) {
+		ok = false;
+	}
+
+	sem_destroy(twsem);
+	lock_destroy(lk);
+	cv_destroy(cv);
+
+	kprintf("Timed wait test %s.\n", ok ? "done" : "FAILED");
+	return 0;
+}
+
+/*
+ * Atomic counter benchmark. One thread per cpu (up to NSPINTHREADS)
+ * bumps a shared counter as fast as it can for SPINBENCHSECS seconds,
+ * first under a spinlock and then with atomic_add. Each thread also
+ * counts its own increments; the test fails if the shared counter
+ * doesn't come out as their sum.
+ */
+
+static struct atomic benchcount;
+static unsigned long benchcount_locked;
+
+static
+void
+atomicbenchthread(void *junk, unsigned long num)
+{
+	bool useatomic = (junk != NULL);
+	unsigned long n;
+
+	n = 0;
+	spinpresent[num] = (thread_setaffinity(1U << num) == 0);
+	if (spinpresent[num]) {
+		while (!spinstop) {
+			if (useatomic) {
+				atomic_add(&benchcount, 1);
+			}
+			else {
+				spinlock_acquire(&benchspin);
+				benchcount_locked++;
+				spinlock_release(&benchspin);
+			}
+			n++;
+		}
+	}
+	spincounts[num] = n;
+	V(benchdone);
+}
+
+static
+bool
+atomicbench_run(bool useatomic)
+{
+	unsigned long total, count;
+	unsigned ncpus;
+	int i, result;
+
+	spinlock_init(&benchspin);
+	atomic_store(&benchcount, 0);
+	benchcount_locked = 0;
+	spinstop = false;
+
+	for (i=0; i<NSPINTHREADS; i++) {
+		result = thread_fork("atomicbench", NULL, atomicbenchthread,
+				     useatomic ? &benchcount : NULL, i);
+		if (result) {
+			panic("atomicbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	clocksleep(SPINBENCHSECS);
+	spinstop = true;
+	for (i=0; i<NSPINTHREADS; i++) {
+		P(benchdone);
+	}
+	spinlock_cleanup(&benchspin);
+
+	ncpus = 0;
+	total = 0;
+	for (i=0; i<NSPINTHREADS; i++) {
+		if (spinpresent[i]) {
+			ncpus++;
+			total += spincounts[i];
+		}
+	}
+	count = useatomic ? (unsigned long)atomic_load(&benchcount)
+		: benchcount_locked;
+	kprintf("%-9s %u cpus: %lu increments/s\n",
+		useatomic ? "atomic:" : "spinlock:", ncpus,
+		total / SPINBENCHSECS);
+	if (count != total) {
+		kprintf("%s: counter is %lu, should be %lu\n",
+			useatomic ? "atomic" : "spinlock", count, total);
+		return false;
+	}
+	return true;
+}
+
+int
+atomicbench(int nargs, char **args)
+{
+	bool ok = true;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting atomic counter benchmark...\n");
+
+	benchdone = sem_create("benchdone", 0);
+	if (benchdone == NULL) {
+		panic("atomicbench: sem_create failed\n");
+	}
+
+	if (!atomicbench_run(false)) {
+		ok = false;
+	}
+	if (!atomicbench_run(true)) {
+		ok = false;
+	}
+
+	sem_destroy(benchdone);
+	kprintf("Atomic counter benchmark %s.\n", ok ? "done" : "FAILED");
+
+	return 0;
+}
+
+/*
+ * Reader-writer lock benchmark. One thread per cpu (up to
+ * NSPINTHREADS) takes a lock, does a short lookup's worth of work
+ * holding it, and lets it go, as fast as it can for SPINBENCHSECS
+ * seconds: first with a plain lock, as the process table used to be,
+ * then reading an rwlock, and then reading an rwlock that cpu 0's
+ * thread writes instead. Readers should scale where lock holders
+ * don't, and the writer should still get in.
+ */
+
+#define RWHOLD		100
+
+enum rwbenchmode { RWB_LOCK, RWB_READ, RWB_WRITER };
+
+static struct rwlock *benchrw;
+
+static
+void
+rwbenchthread(void *junk, unsigned long num)
+{
+	enum rwbenchmode mode = *(enum rwbenchmode *)junk;
+	volatile int j;
+	unsigned long n;
+
+	n = 0;
+	spinpresent[num] = (thread_setaffinity(1U << num) == 0);
+	if (spinpresent[num]) {
+		while (!spinstop) {
+			if (mode == RWB_LOCK) {
+				lock_acquire(benchlock);
+			}
+			else if (mode == RWB_WRITER && num == 0) {
+				rwlock_acquire_write(benchrw);
+			}
+			else {
+				rwlock_acquire_read(benchrw);
+			}
+			for (j=0; j<RWHOLD; j++);
+			if (mode == RWB_LOCK) {
+				lock_release(benchlock);
+			}
+			else {
+				rwlock_release(benchrw);
+			}
+			n++;
+		}
+	}
+	spincounts[num] = n;
+	V(benchdone);
+}
+
+static
+void
+rwbench_run(enum rwbenchmode mode)
+{
+	static const char *const names[] = {
+		"lock:", "rwlock:", "rwlock+writer:"
+	};
+	unsigned long total;
+	unsigned ncpus;
+	int i, result;
+
+	spinstop = false;
+
+	for (i=0; i<NSPINTHREADS; i++) {
+		result = thread_fork("rwbench", NULL, rwbenchthread,
+				     &mode, i);
+		if (result) {
+			panic("rwbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	clocksleep(SPINBENCHSECS);
+	spinstop = true;
+	for (i=0; i<NSPINTHREADS; i++) {
+		P(benchdone);
+	}
+
+	ncpus = 0;
+	total = 0;
+	for (i=0; i<NSPINTHREADS; i++) {
+		if (spinpresent[i]) {
+			ncpus++;
+			total += spincounts[i];
+		}
+	}
+	if (mode == RWB_WRITER) {
+		total -= spincounts[0];
+	}
+	kprintf("%-15s %u cpus: %lu reads/s", names[mode], ncpus,
+		total / SPINBENCHSECS);
+	if (mode == RWB_WRITER) {
+		kprintf(", %lu writes/s", spincounts[0] / SPINBENCHSECS);
+	}
+	kprintf("\n");
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting reader-writer lock benchmark...\n");
+
+	benchlock = lock_create("benchlock");
+	benchrw = rwlock_create("benchrw");
+	benchdone = sem_create("benchdone", 0);
+	if (benchlock == NULL || benchrw == NULL || benchdone == NULL) {
+		panic("rwbench: create failed\n");
+	}
+
+	rwbench_run(RWB_LOCK);
+	rwbench_run(RWB_READ);
+	rwbench_run(RWB_WRITER);
+
+	lock_destroy(benchlock);
+	rwlock_destroy(benchrw);
+	sem_destroy(benchdone);
+	kprintf("Reader-writer lock benchmark done.\n");
+
+	return 0;
+}
@@ -34,6 +34,7 @@
 #include <lib.h>
 #include <thread.h>
 #include <synch.h>
+#include <clock.h>
 #include <test.h>
 
 #define NTHREADS  8
@@ -144,3 +145,324 @@ threadtest2(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * Wakeup latency: how long from V() until the thread sleeping in P()
+ * is running again. The waker is pinned to cpu 0 and the sleeper last
+ * ran on cpu 1, so each wakeup crosses cpus (with one cpu, both share
+ * it). The waker pauses before each V so the sleeper's cpu has time to
+ * go idle, which is the case polling idle is for. Then it goes again
+ * with a hog spinning on cpu 1, and the sleeper free to run anywhere
+ * once woken: the case wakeup placement sends to another, idle, cpu
+ * rather than queueing behind the hog. That needs a cpu 1.
+ */
+
+#define NWAKEUPS 200
+
+static struct semaphore *wakesem, *acksem;
+static volatile time_t wake_secs;
+static volatile uint32_t wake_nsecs;
+static uint32_t lat_total, lat_min, lat_max;	/* in microseconds */
+static volatile bool lat_hogging;
+
+static
+void
+lathog(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	thread_setaffinity(1U << 1);
+	V(acksem);
+	while (lat_hogging);
+	V(acksem);
+}
+
+static
+void
+latsleeper(void *junk, unsigned long nwakeups)
+{
+	time_t secs;
+	uint32_t nsecs, us;
+	unsigned long i;
+
+	(void)junk;
+
+	for (i=0; i<nwakeups; i++) {
+		/* Stay wherever we are if there's no cpu 1. */
+		thread_setaffinity(1U << 1);
+		if (lat_hogging) {
+			thread_setaffinity(~0U);
+		}
+		V(acksem);
+		P(wakesem);
+		gettime(&secs, &nsecs);
+		us = (secs - wake_secs) * 1000000
+			+ (nsecs / 1000) - (wake_nsecs / 1000);
+		lat_total += us;
+		if (i == 0 || us < lat_min) {
+			lat_min = us;
+		}
+		if (us > lat_max) {
+			lat_max = us;
+		}
+	}
+	V(acksem);
+}
+
+static
+void
+latrun(bool hog)
+{
+	volatile int j;
+	time_t secs;
+	uint32_t nsecs;
+	int i, result;
+
+	lat_total = lat_min = lat_max = 0;
+	lat_hogging = hog;
+
+	if (hog) {
+		result = thread_fork("lathog", NULL, lathog, NULL, 0);
+		if (result) {
+			panic("threadtest4: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+		P(acksem);
+	}
+
+	result = thread_fork("latsleeper", NULL, latsleeper, NULL, NWAKEUPS);
+	if (result) {
+		panic("threadtest4: thread_fork failed %s)\n",
+		      strerror(result));
+	}
+
+	for (i=0; i<NWAKEUPS; i++) {
+		P(acksem);
+		for (j=0; j<20000; j++);
+		gettime(&secs, &nsecs);
+		wake_secs = secs;
+		wake_nsecs = nsecs;
+		V(wakesem);
+	}
+	P(acksem);
+
+	if (hog) {
+		lat_hogging = false;
+		P(acksem);
+	}
+
+	kprintf("%d wakeups%s: average %u us, min %u us, max %u us\n",
+		NWAKEUPS, hog ? ", cpu 1 busy" : "", lat_total / NWAKEUPS,
+		lat_min, lat_max);
+}
+
+int
+threadtest4(int nargs, char **args)
+{
+	unsigned oldaffinity;
+	bool havecpu1;
+
+	(void)nargs;
+	(void)args;
+
+	kprintf("Starting wakeup latency test...\n");
+
+	wakesem = sem_create("wakesem", 0);
+	acksem = sem_create("acksem", 0);
+	if (wakesem == NULL || acksem == NULL) {
+		panic("threadtest4: sem_create failed\n");
+	}
+
+	oldaffinity = thread_getaffinity();
+	havecpu1 = thread_setaffinity(1U << 1) == 0;
+	thread_setaffinity(1U << 0);
+
+	latrun(false);
+	if (havecpu1) {
+		latrun(true);
+	}
+
+	thread_setaffinity(oldaffinity);
+	sem_destroy(wakesem);
+	sem_destroy(acksem);
+
+	kprintf("Wakeup latency test done.\n");
+
+	return 0;
+}
+
+/*
+ * Thread creation rate: how long a thread_fork and the thread_exit
+ * that follows take together. Threads are made one at a time, each
+ * finishing before the next is made, and then NTHREADS at a time.
+ * "ss" shows how many of their stacks were reused.
+ */
+
+#define NCREATES 1000
+
+static struct semaphore *createsem;
+
+static
+void
+createthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(createsem);
+}
+
+static
+void
+createrate(unsigned ncreates, unsigned batch)
+{
+	time_t secs, secs2;
+	uint32_t nsecs, nsecs2;
+	unsigned long us;
+	unsigned i, j;
+	int result;
+
+	gettime(&secs, &nsecs);
+	for (i=0; i<ncreates; i += batch) {
+		for (j=0; j<batch; j++) {
+			result = thread_fork("createthread", NULL,
+					     createthread, NULL, j);
+			if (result) {
+				panic("threadtest5: thread_fork failed %s)\n",
+				      strerror(result));
+			}
+		}
+		for (j=0; j<batch; j++) {
+			P(createsem);
+		}
+	}
+	gettime(&secs2, &nsecs2);
+
+	us = (secs2 - secs) * 1000000 + (nsecs2 / 1000) - (nsecs / 1000);
+	kprintf("%u threads, %u at a time: %lu us, %lu us each\n",
+		i, batch, us, us / i);
+}
+
+int
+threadtest5(int nargs, char **args)
+{
+	unsigned ncreates;
+
+	ncreates = NCREATES;
+	if (nargs > 1 && atoi(args[1]) > 0) {
+		ncreates = atoi(args[1]);
+	}
+
+	kprintf("Starting thread creation benchmark...\n");
+
+	createsem = sem_create("createsem", 0);
+	if (createsem == NULL) {
+		panic("threadtest5: sem_create failed\n");
+	}
+
+	createrate(ncreates, 1);
+	createrate(ncreates, NTHREADS);
+
+	sem_destroy(createsem);
+	kprintf("Thread creation benchmark done.\n");
+
+	return 0;
+}
+
+/*
+ * Load balancing: NTHREADS cpu-bound threads are made on cpu 0, and
+ * each one, when it first runs, lets itself run anywhere and yields.
+ * They don't sleep, so wakeup placement never moves them; only other
+ * cpus stealing them does. Reports how long they take against one of
+ * them running alone, i.e. the speedup over one cpu, and then the
+ * scheduler stats, which show who stole what.
+ */
+
+#define SPINLOOPS 1000000
+
+static struct semaphore *spinsem;
+
+static
+void
+spinthread(void *junk, unsigned long num)
+{
+	volatile unsigned long i;
+
+	(void)junk;
+	(void)num;
+
+	thread_setaffinity(~0U);
+	thread_yield();
+	for (i=0; i<SPINLOOPS; i++);
+	V(spinsem);
+}
+
+static
+unsigned long
+spinrate(unsigned nthreads)
+{
+	time_t secs, secs2;
+	uint32_t nsecs, nsecs2;
+	unsigned i;
+	int result;
+
+	gettime(&secs, &nsecs);
+	for (i=0; i<nthreads; i++) {
+		result = thread_fork("spinthread", NULL, spinthread, NULL, i);
+		if (result) {
+			panic("threadtest6: thread_fork failed %s)\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<nthreads; i++) {
+		P(spinsem);
+	}
+	gettime(&secs2, &nsecs2);
+
+	return (secs2 - secs) * 1000 + (nsecs2 / 1000000) - (nsecs / 1000000);
+}
+
+int
+threadtest6(int nargs, char **args)
+{
+	unsigned oldaffinity, mask, ncpus, nthreads;
+	unsigned long onems, ms;
+
+	nthreads = NTHREADS;
+	if (nargs > 1 && atoi(args[1]) > 0) {
+		nthreads = atoi(args[1]);
+	}
+
+	kprintf("Starting load balancing benchmark...\n");
+
+	spinsem = sem_create("spinsem", 0);
+	if (spinsem == NULL) {
+		panic("threadtest6: sem_create failed\n");
+	}
+
+	oldaffinity = thread_getaffinity();
+	thread_setaffinity(~0U);
+	ncpus = 0;
+	for (mask = thread_getaffinity(); mask != 0; mask &= mask - 1) {
+		ncpus++;
+	}
+	thread_setaffinity(1U << 0);
+
+	onems = spinrate(1);
+	ms = spinrate(nthreads);
+
+	thread_setaffinity(oldaffinity);
+	sem_destroy(spinsem);
+
+	if (ms == 0) {
+		ms = 1;
+	}
+	kprintf("1 thread: %lu ms; %u threads on %u cpus: %lu ms, "
+		"speedup %lu.%02lu\n", onems, nthreads, ncpus, ms,
+		nthreads * onems / ms, nthreads * onems * 100 / ms % 100);
+	thread_printstats();
+	kprintf("Load balancing benchmark done.\n");
+
+	return 0;
+}
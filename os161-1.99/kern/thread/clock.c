@@ -32,15 +32,16 @@
 #include <cpu.h>
 #include <wchan.h>
 #include <clock.h>
+#include <timer.h>
 #include <thread.h>
 #include <current.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * This is pretty primitive. Callbacks at specific points in the
+ * future are handled by the timers in timer.c, with a resolution of
+ * one hardclock.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -68,6 +69,7 @@ hardclock_bootstrap(void)
 	if (lbolt == NULL) {
 		panic("Couldn't create lbolt\n");
 	}
+	timer_bootstrap();
 }
 
 /*
@@ -83,7 +85,8 @@ timerclock(void)
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code, except while the processor has stopped it; see
+ * thread_consider_tickless.
  */
 void
 hardclock(void)
@@ -93,13 +96,15 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	timer_hardclock();
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	thread_consider_tickless();
+	thread_timeslice();
 }
 
 /*
@@ -114,3 +119,24 @@ clocksleep(int num_secs)
 		num_secs--;
 	}
 }
+
+/*
+ * Suspend execution for TICKS hardclocks.
+ */
+void
+clocksleep_ticks(unsigned ticks)
+{
+	struct wchan wc;
+	struct wchan_timeout wt;
+
+	wchan_init(&wc, "clocksleep");
+	wchan_timeout_start(&wt, &wc, ticks);
+	wchan_lock(&wc);
+	while (!wt.wt_expired) {
+		wchan_sleep(&wc);
+		wchan_lock(&wc);
+	}
+	wchan_unlock(&wc);
+	wchan_timeout_stop(&wt);
+	wchan_cleanup(&wc);
+}
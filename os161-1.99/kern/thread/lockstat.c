@@ -0,0 +1,402 @@
+/*
+ * Lock contention profiler (see <lockstat.h>).
+ *
+ * Each cpu has an open-addressed hash table of LOCKSTAT_NLOCKS
+ * entries, keyed on the lock's address or, for sleep locks, its name.
+ * Locks that don't fit are counted as untracked. Nothing here may
+ * take a lock: it is called from inside spinlock_acquire.
+ *
+ * lockstat_clear can't safely zero another cpu's table, so it bumps
+ * lockstat_gen instead, and each cpu empties its own table the next
+ * time it records something. Printing skips tables not yet emptied.
+ *
+ * The tables are read unlocked when printing, while other cpus may be
+ * adding to them, so the numbers printed can be slightly off.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <current.h>
+#include <clock.h>
+#include <lockstat.h>
+#include <platform/maxcpus.h>
+
+#define LOCKSTAT_NLOCKS		128	/* per cpu; must be a power of 2 */
+#define LOCKSTAT_NAMELEN	16
+
+struct lockstat {
+	const void *ls_lock;		/* NULL if slot unused */
+	char ls_name[LOCKSTAT_NAMELEN];	/* sleep lock's name; "" if none */
+	vaddr_t ls_pc;			/* where first acquired */
+	unsigned ls_acquires;
+	unsigned ls_contended;		/* acquires that had to wait */
+	unsigned ls_spins;		/* spin iterations while waiting */
+	unsigned ls_sleeps;		/* acquires that slept */
+	uint64_t ls_waittime;		/* ns spent waiting */
+	uint64_t ls_holdtime;		/* ns spent holding */
+};
+
+struct lockstat_cpu {
+	unsigned lc_gen;		/* lockstat_gen when last emptied */
+	unsigned lc_nused;
+	unsigned lc_untracked;		/* acquires not recorded */
+	struct lockstat lc_locks[LOCKSTAT_NLOCKS];
+};
+
+static struct lockstat_cpu *lockstat_cpus[MAXCPUS];
+static volatile unsigned lockstat_gen;
+
+#define LOCKSTAT_TOP		10
+
+////////////////////////////////////////////////////////////
+//
+// Tables
+
+static
+bool
+lockstat_named(const char *name)
+{
+	return name != NULL && name[0] != 0;
+}
+
+static
+unsigned
+lockstat_hash(const void *lock, const char *name)
+{
+	unsigned h, i;
+
+	if (lockstat_named(name)) {
+		h = 5381;
+		for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+			h = h * 33 + (unsigned char)name[i];
+		}
+	}
+	else {
+		h = (uintptr_t)lock;
+		h ^= h >> 16;
+		h *= 0x45d9f3b;
+		h ^= h >> 16;
+	}
+	return h;
+}
+
+/*
+ * Compare NAME against a (possibly truncated) stored name.
+ */
+static
+bool
+lockstat_samename(const char *stored, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKSTAT_NAMELEN-1; i++) {
+		if (stored[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+/*
+ * Find or add the entry for a lock in a table of SIZE entries, with
+ * NUSED of them in use. Returns NULL if it isn't there and the table
+ * is full.
+ */
+static
+struct lockstat *
+lockstat_find(struct lockstat *table, unsigned size, unsigned *nused,
+	      const void *lock, const char *name)
+{
+	struct lockstat *ls;
+	unsigned i;
+	bool named;
+
+	named = lockstat_named(name);
+	i = lockstat_hash(lock, name) & (size - 1);
+	while (table[i].ls_lock != NULL) {
+		ls = &table[i];
+		if (named ? lockstat_samename(ls->ls_name, name)
+		    : (ls->ls_name[0] == 0 && ls->ls_lock == lock)) {
+			return ls;
+		}
+		i = (i + 1) & (size - 1);
+	}
+	if (*nused >= size * 3 / 4) {
+		return NULL;
+	}
+
+	ls = &table[i];
+	bzero(ls, sizeof(*ls));
+	ls->ls_lock = lock;
+	if (named) {
+		for (i=0; i<LOCKSTAT_NAMELEN-1 && name[i] != 0; i++) {
+			ls->ls_name[i] = name[i];
+		}
+		ls->ls_name[i] = 0;
+	}
+	(*nused)++;
+	return ls;
+}
+
+/*
+ * Get this cpu's table, emptying it first if lockstat_clear has been
+ * called since it was last used. Returns NULL if there isn't one.
+ */
+static
+struct lockstat_cpu *
+lockstat_mycpu(void)
+{
+	struct lockstat_cpu *lc;
+
+	if (!CURCPU_EXISTS()) {
+		return NULL;
+	}
+	lc = lockstat_cpus[curcpu->c_number];
+	if (lc != NULL && lc->lc_gen != lockstat_gen) {
+		bzero(lc->lc_locks, sizeof(lc->lc_locks));
+		lc->lc_nused = 0;
+		lc->lc_untracked = 0;
+		lc->lc_gen = lockstat_gen;
+	}
+	return lc;
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+void
+lockstat_cpu_init(unsigned cpunum)
+{
+	struct lockstat_cpu *lc;
+
+	KASSERT(cpunum < MAXCPUS);
+
+	lc = kmalloc(sizeof(*lc));
+	if (lc == NULL) {
+		kprintf("lockstat: no memory for cpu%u's table\n", cpunum);
+		return;
+	}
+	bzero(lc, sizeof(*lc));
+	lc->lc_gen = lockstat_gen;
+	lockstat_cpus[cpunum] = lc;
+}
+
+uint64_t
+lockstat_acquired(const void *lock, const char *name, vaddr_t pc,
+		  unsigned spins, bool contended, bool slept, uint64_t start)
+{
+	struct lockstat_cpu *lc;
+	struct lockstat *ls;
+	uint64_t now;
+
+	now = gettime_ns();
+
+	lc = lockstat_mycpu();
+	if (lc == NULL) {
+		return now;
+	}
+	ls = lockstat_find(lc->lc_locks, LOCKSTAT_NLOCKS, &lc->lc_nused,
+			   lock, name);
+	if (ls == NULL) {
+		lc->lc_untracked++;
+		return now;
+	}
+
+	if (ls->ls_pc == 0) {
+		ls->ls_pc = pc;
+	}
+	ls->ls_acquires++;
+	ls->ls_spins += spins;
+	if (contended) {
+		ls->ls_contended++;
+		if (start != 0 && now > start) {
+			ls->ls_waittime += now - start;
+		}
+	}
+	if (slept) {
+		ls->ls_sleeps++;
+	}
+	return now;
+}
+
+void
+lockstat_released(const void *lock, const char *name, uint64_t stamp)
+{
+	struct lockstat_cpu *lc;
+	struct lockstat *ls;
+	uint64_t now;
+
+	if (stamp == 0) {
+		/* No clock when it was acquired. */
+		return;
+	}
+
+	lc = lockstat_mycpu();
+	if (lc == NULL) {
+		return;
+	}
+	/* A sleep lock may be released on another cpu than it was got on. */
+	ls = lockstat_find(lc->lc_locks, LOCKSTAT_NLOCKS, &lc->lc_nused,
+			   lock, name);
+	if (ls == NULL) {
+		return;
+	}
+
+	now = gettime_ns();
+	if (now > stamp) {
+		ls->ls_holdtime += now - stamp;
+	}
+}
+
+void
+lockstat_clear(void)
+{
+	lockstat_gen++;
+}
+
+/*
+ * Fill TOP with the indexes of the (up to) N entries in TABLE with the
+ * most wait time, or failing that the most contended acquires.
+ * Returns how many.
+ */
+static
+unsigned
+lockstat_top(struct lockstat *table, unsigned size, unsigned *top,
+	     unsigned n)
+{
+	unsigned i, j, found = 0;
+	bool taken;
+	int besti;
+
+	while (found < n) {
+		besti = -1;
+		for (i=0; i<size; i++) {
+			if (table[i].ls_lock == NULL) {
+				continue;
+			}
+			taken = false;
+			for (j=0; j<found; j++) {
+				if (top[j] == i) {
+					taken = true;
+				}
+			}
+			if (taken) {
+				continue;
+			}
+			if (besti < 0 ||
+			    table[i].ls_waittime > table[besti].ls_waittime ||
+			    (table[i].ls_waittime == table[besti].ls_waittime &&
+			     table[i].ls_contended > table[besti].ls_contended)) {
+				besti = i;
+			}
+		}
+		if (besti < 0) {
+			break;
+		}
+		top[found++] = besti;
+	}
+	return found;
+}
+
+void
+lockstat_print(unsigned n)
+{
+	struct lockstat *merged, *ls, *from;
+	struct lockstat_cpu *lc;
+	unsigned size, nused, untracked, ncpus;
+	unsigned i, j, ntop;
+	unsigned *top;
+	char label[LOCKSTAT_NAMELEN];
+
+	if (n == 0) {
+		n = LOCKSTAT_TOP;
+	}
+
+	/* Big enough for all the locks of a few busy cpus. */
+	size = LOCKSTAT_NLOCKS * 2;
+	if (n > size) {
+		/* there can't be more than that to show */
+		n = size;
+	}
+	merged = kmalloc(size * sizeof(*merged));
+	top = kmalloc(n * sizeof(*top));
+	if (merged == NULL || top == NULL) {
+		kprintf("lockstat: out of memory\n");
+		kfree(merged);
+		kfree(top);
+		return;
+	}
+	bzero(merged, size * sizeof(*merged));
+
+	nused = 0;
+	untracked = 0;
+	ncpus = 0;
+	for (i=0; i<MAXCPUS; i++) {
+		lc = lockstat_cpus[i];
+		if (lc == NULL || lc->lc_gen != lockstat_gen) {
+			continue;
+		}
+		ncpus++;
+		untracked += lc->lc_untracked;
+		for (j=0; j<LOCKSTAT_NLOCKS; j++) {
+			from = &lc->lc_locks[j];
+			if (from->ls_lock == NULL) {
+				continue;
+			}
+			ls = lockstat_find(merged, size, &nused, from->ls_lock,
+					   from->ls_name);
+			if (ls == NULL) {
+				untracked += from->ls_acquires;
+				continue;
+			}
+			if (ls->ls_pc == 0) {
+				ls->ls_pc = from->ls_pc;
+			}
+			ls->ls_acquires += from->ls_acquires;
+			ls->ls_contended += from->ls_contended;
+			ls->ls_spins += from->ls_spins;
+			ls->ls_sleeps += from->ls_sleeps;
+			ls->ls_waittime += from->ls_waittime;
+			ls->ls_holdtime += from->ls_holdtime;
+		}
+	}
+
+	ntop = lockstat_top(merged, size, top, n);
+	kprintf("Lock contention: %u locks on %u cpus, by wait time\n",
+		nused, ncpus);
+	kprintf("  %-15s %9s %9s %10s %7s %10s %10s %10s\n", "lock",
+		"acquires", "contended", "spins", "sleeps", "wait us",
+		"hold us", "site");
+	for (i=0; i<ntop; i++) {
+		ls = &merged[top[i]];
+		if (ls->ls_name[0] != 0) {
+			strcpy(label, ls->ls_name);
+		}
+		else {
+			snprintf(label, sizeof(label), "0x%08lx",
+				 (unsigned long)ls->ls_lock);
+		}
+		kprintf("  %-15s %9u %9u %10u %7u %10llu %10llu 0x%08lx\n",
+			label, ls->ls_acquires, ls->ls_contended,
+			ls->ls_spins, ls->ls_sleeps, ls->ls_waittime / 1000,
+			ls->ls_holdtime / 1000, (unsigned long)ls->ls_pc);
+	}
+
+	if (untracked > 0) {
+		kprintf("  (%u acquires not counted; tables full)\n",
+			untracked);
+	}
+	kprintf("To symbolize: sys161-addr2line -f -e kernel");
+	for (i=0; i<ntop; i++) {
+		kprintf(" 0x%lx", (unsigned long)merged[top[i]].ls_pc);
+	}
+	kprintf("\n");
+
+	kfree(top);
+	kfree(merged);
+}
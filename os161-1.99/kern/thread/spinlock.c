@@ -36,6 +36,8 @@
 #include <spl.h>
 #include <spinlock.h>
 #include <current.h>	/* for curcpu */
+#include <clock.h>
+#include <lockstat.h>
 
 /*
  * Spinlocks.
@@ -49,7 +51,19 @@ void
 spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+	lk->lk_ticket = false;
+#if OPT_LOCKSTAT
+	lk->lk_stamp = 0;
+#endif
+}
+
+void
+spinlock_init_ticket(struct spinlock *lk)
+{
+	spinlock_init(lk);
+	lk->lk_ticket = true;
 }
 
 /*
@@ -59,9 +73,25 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	if (lk->lk_ticket) {
+		KASSERT(spinlock_data_get(&lk->lk_lock) ==
+			spinlock_data_get(&lk->lk_serving));
+	}
+	else {
+		KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	}
 }
 
+#if OPT_LOCKSTAT
+/*
+ * Count a spin while waiting; the wait starts with the first one.
+ */
+#define LOCKSTAT_SPIN() \
+	do { if (spins++ == 0) start = gettime_ns(); } while (0)
+#else
+#define LOCKSTAT_SPIN()
+#endif
+
 /*
  * Get the lock.
  *
@@ -73,6 +103,10 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+#if OPT_LOCKSTAT
+	unsigned spins = 0;
+	uint64_t start = 0;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +121,49 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
-	while (1) {
+	if (lk->lk_ticket) {
+		spinlock_data_t ticket;
+
 		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
+		 * Take a number and wait to be served. The counters
+		 * wrap, which is fine as we only compare for equality.
 		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		ticket = spinlock_data_fetchadd(&lk->lk_lock, 1);
+		while (spinlock_data_get(&lk->lk_serving) != ticket) {
+			/* spin */
+			LOCKSTAT_SPIN();
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+	}
+	else {
+		while (1) {
+			/*
+			 * Do test-test-and-set, that is, read first before
+			 * doing test-and-set, to reduce bus contention.
+			 *
+			 * Test-and-set is a machine-level atomic operation
+			 * that writes 1 into the lock word and returns the
+			 * previous value. If that value was 0, the lock was
+			 * previously unheld and we now own it. If it was 1,
+			 * we don't.
+			 */
+			if (spinlock_data_get(&lk->lk_lock) != 0) {
+				LOCKSTAT_SPIN();
+				continue;
+			}
+			if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+				LOCKSTAT_SPIN();
+				continue;
+			}
+			break;
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKSTAT
+	lk->lk_stamp = lockstat_acquired(lk, NULL,
+			(vaddr_t)__builtin_return_address(0),
+			spins, spins > 0, false, start);
+#endif
 }
 
 /*
@@ -121,8 +177,18 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	lockstat_released(lk, NULL, lk->lk_stamp);
+#endif
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	if (lk->lk_ticket) {
+		/* Only the holder changes lk_serving, so no LL/SC needed. */
+		spinlock_data_set(&lk->lk_serving,
+				  spinlock_data_get(&lk->lk_serving) + 1);
+	}
+	else {
+		spinlock_data_set(&lk->lk_lock, 0);
+	}
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
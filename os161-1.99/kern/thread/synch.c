@@ -33,58 +33,90 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <kmem_cache.h>
+#include <clock.h>
+#include <lockstat.h>
+#include "opt-mlfq.h"
+
+/*
+ * Adaptive spinning in lock_acquire: while the holder is running on
+ * another cpu, spin in rounds of LOCK_SPIN_LOOPS checks of the lock,
+ * for at most LOCK_SPIN_ROUNDS rounds, before sleeping.
+ */
+#define LOCK_SPIN_LOOPS		100
+#define LOCK_SPIN_ROUNDS	8
+
+/*
+ * Semaphores, locks, CVs and rwlocks made by X_create come from object
+ * caches. X_create does what X_init does, and also copies the name;
+ * nothing else is allocated, since the wait channels are part of the
+ * objects.
+ */
 
 ////////////////////////////////////////////////////////////
 //
 // Semaphore.
 
+static struct kmem_cache sem_cache =
+	KMEM_CACHE_INITIALIZER("semaphore", sizeof(struct semaphore),
+			       NULL, NULL);
+
+void
+sem_init(struct semaphore *sem, const char *name, int initial_count)
+{
+        KASSERT(initial_count >= 0);
+
+	sem->sem_name = name;
+	wchan_init(&sem->sem_wchan, name);
+	spinlock_init(&sem->sem_lock);
+        sem->sem_count = initial_count;
+}
+
+void
+sem_cleanup(struct semaphore *sem)
+{
+        KASSERT(sem != NULL);
+
+	/* wchan_cleanup would assert if anyone was waiting on it */
+	KASSERT(wchan_isempty(&sem->sem_wchan));
+	spinlock_cleanup(&sem->sem_lock);
+	wchan_cleanup(&sem->sem_wchan);
+}
+
 struct semaphore *
 sem_create(const char *name, int initial_count)
 {
         struct semaphore *sem;
+	char *copy;
 
-        KASSERT(initial_count >= 0);
-
-        sem = kmalloc(sizeof(struct semaphore));
+        sem = kmem_cache_alloc(&sem_cache);
         if (sem == NULL) {
                 return NULL;
         }
 
-        sem->sem_name = kstrdup(name);
-        if (sem->sem_name == NULL) {
-                kfree(sem);
+        copy = kstrdup(name);
+        if (copy == NULL) {
+                kmem_cache_free(&sem_cache, sem);
                 return NULL;
         }
 
-	sem->sem_wchan = wchan_create(sem->sem_name);
-	if (sem->sem_wchan == NULL) {
-		kfree(sem->sem_name);
-		kfree(sem);
-		return NULL;
-	}
-
-	spinlock_init(&sem->sem_lock);
-        sem->sem_count = initial_count;
-
+	sem_init(sem, copy, initial_count);
         return sem;
 }
 
 void
 sem_destroy(struct semaphore *sem)
 {
-        KASSERT(sem != NULL);
-
-	/* wchan_cleanup will assert if anyone's waiting on it */
-	spinlock_cleanup(&sem->sem_lock);
-	wchan_destroy(sem->sem_wchan);
-        kfree(sem->sem_name);
-        kfree(sem);
+	sem_cleanup(sem);
+        kfree((char *)sem->sem_name);
+        kmem_cache_free(&sem_cache, sem);
 }
 
 void 
@@ -118,15 +150,53 @@ P(struct semaphore *sem)
 		 * Exercise: how would you implement strict FIFO
 		 * ordering?
 		 */
-		wchan_lock(sem->sem_wchan);
+		wchan_lock(&sem->sem_wchan);
+		spinlock_release(&sem->sem_lock);
+                wchan_sleep(&sem->sem_wchan);
+
+		spinlock_acquire(&sem->sem_lock);
+        }
+        KASSERT(sem->sem_count > 0);
+        sem->sem_count--;
+	spinlock_release(&sem->sem_lock);
+}
+
+int
+sem_timed_P(struct semaphore *sem, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	bool started = false;
+
+        KASSERT(sem != NULL);
+        KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&sem->sem_lock);
+        while (sem->sem_count == 0) {
+		if (!started) {
+			wchan_timeout_start(&wt, &sem->sem_wchan, ticks);
+			started = true;
+		}
+		/* As in P; the timeout is checked with the wchan locked. */
+		wchan_lock(&sem->sem_wchan);
+		if (wt.wt_expired) {
+			wchan_unlock(&sem->sem_wchan);
+			spinlock_release(&sem->sem_lock);
+			wchan_timeout_stop(&wt);
+			return ETIMEDOUT;
+		}
 		spinlock_release(&sem->sem_lock);
-                wchan_sleep(sem->sem_wchan);
+                wchan_sleep(&sem->sem_wchan);
 
 		spinlock_acquire(&sem->sem_lock);
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
 	spinlock_release(&sem->sem_lock);
+
+	if (started) {
+		wchan_timeout_stop(&wt);
+	}
+	return 0;
 }
 
 void
@@ -138,7 +208,7 @@ V(struct semaphore *sem)
 
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	wchan_wakeone(&sem->sem_wchan);
 
 	spinlock_release(&sem->sem_lock);
 }
@@ -147,64 +217,314 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+#if OPT_MLFQ
+/*
+ * Priority inheritance.
+ *
+ * A thread that sleeps waiting for a lock lends its priority to the
+ * holder, so that a low-priority holder isn't kept off the cpu by
+ * middling threads while a high-priority one waits for it. If the
+ * holder is itself asleep waiting for another lock, the loan is passed
+ * on to that lock's holder, and so on down the chain.
+ *
+ * Each lock counts its sleeping waiters at each level, and each thread
+ * keeps a list of the locks it holds, so what a thread has inherited
+ * (t_boost) is the best level waiting on any lock it holds. That is
+ * worked out again whenever it might change: when a waiter starts or
+ * stops waiting, and when the holder gets or gives up a lock. Giving up
+ * a lock thus gives up whatever came through it.
+ *
+ * All of this belongs to pi_lock rather than to each lock's lk_lock,
+ * so chains can be followed without taking lock after lock. pi_lock is
+ * taken with lk_lock held, never the other way round. Since holders
+ * change only with pi_lock held, a holder found while holding it can't
+ * release the lock, and so can't exit, until we let go. PI_MAXDEPTH
+ * stops us going round a deadlocked cycle forever.
+ */
+#define PI_MAXDEPTH	16
+
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/* The best level with a waiter on any lock T holds. */
+static
+unsigned
+pi_inherited(struct thread *t)
+{
+	struct lock *lock;
+	unsigned level, best;
+
+	best = MLFQ_NLEVELS;
+	for (lock = t->t_locksheld; lock != NULL; lock = lock->lk_nextheld) {
+		for (level = 0; level < best; level++) {
+			if (lock->lk_waiters[level] > 0) {
+				best = level;
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+/*
+ * Work out again what LOCK's holder inherits. If that changes the
+ * level it is waiting at itself, do the same for the lock it's
+ * waiting for, and so on.
+ */
+static
+void
+pi_update(struct lock *lock)
+{
+	struct thread *t;
+	unsigned depth, boost, level;
+
+	KASSERT(spinlock_do_i_hold(&pi_lock));
+
+	for (depth = 0; depth < PI_MAXDEPTH; depth++) {
+		t = lock->holder;
+		if (t == NULL) {
+			return;
+		}
+		boost = pi_inherited(t);
+		if (boost == t->t_boost) {
+			return;
+		}
+		thread_setboost(t, boost);
+
+		lock = t->t_blockedon;
+		if (lock == NULL) {
+			return;
+		}
+		level = thread_priority(t);
+		if (level == t->t_donation) {
+			return;
+		}
+		lock->lk_waiters[t->t_donation]--;
+		lock->lk_waiters[level]++;
+		t->t_donation = level;
+	}
+}
+
+/* The current thread is about to sleep waiting for LOCK. */
+static
+void
+pi_wait(struct lock *lock)
+{
+	struct thread *cur = curthread;
+
+	spinlock_acquire(&pi_lock);
+	KASSERT(cur->t_blockedon == NULL);
+	cur->t_blockedon = lock;
+	cur->t_donation = thread_priority(cur);
+	lock->lk_waiters[cur->t_donation]++;
+	pi_update(lock);
+	spinlock_release(&pi_lock);
+}
+
+/* The current thread has woken up and is no longer waiting. */
+static
+void
+pi_endwait(struct lock *lock)
+{
+	struct thread *cur = curthread;
+
+	spinlock_acquire(&pi_lock);
+	KASSERT(cur->t_blockedon == lock);
+	KASSERT(lock->lk_waiters[cur->t_donation] > 0);
+	lock->lk_waiters[cur->t_donation]--;
+	cur->t_blockedon = NULL;
+	cur->t_donation = MLFQ_NLEVELS;
+	pi_update(lock);
+	spinlock_release(&pi_lock);
+}
+
+/* The current thread now holds LOCK; inherit from anyone waiting. */
+static
+void
+pi_take(struct lock *lock)
+{
+	struct thread *cur = curthread;
+
+	spinlock_acquire(&pi_lock);
+	lock->holder = cur;
+	lock->lk_nextheld = cur->t_locksheld;
+	cur->t_locksheld = lock;
+	pi_update(lock);
+	spinlock_release(&pi_lock);
+}
+
+/* The current thread is letting go of LOCK, and what it lent us. */
+static
+void
+pi_give(struct lock *lock)
+{
+	struct thread *cur = curthread;
+	struct lock **lp;
+
+	spinlock_acquire(&pi_lock);
+	for (lp = &cur->t_locksheld; *lp != lock; lp = &(*lp)->lk_nextheld) {
+		KASSERT(*lp != NULL);
+	}
+	*lp = lock->lk_nextheld;
+	lock->lk_nextheld = NULL;
+	pi_update(lock);
+	lock->holder = NULL;
+	spinlock_release(&pi_lock);
+}
+#else
+/* No priorities, so nothing to inherit. */
+static
+void
+pi_wait(struct lock *lock)
+{
+	(void)lock;
+}
+
+static
+void
+pi_endwait(struct lock *lock)
+{
+	(void)lock;
+}
+
+static
+void
+pi_take(struct lock *lock)
+{
+	lock->holder = curthread;
+}
+
+static
+void
+pi_give(struct lock *lock)
+{
+	lock->holder = NULL;
+}
+#endif
+
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock), NULL, NULL);
+
+void
+lock_init(struct lock *lock, const char *name)
+{
+	lock->lk_name = name;
+	wchan_init(&lock->lk_wchan, name);
+	spinlock_init(&lock->lk_lock);
+        lock->locked = false;
+	lock->holder = NULL;
+	lock->lk_acquires = lock->lk_contended = 0;
+	lock->lk_spinwins = lock->lk_sleeps = 0;
+#if OPT_MLFQ
+	bzero(lock->lk_waiters, sizeof(lock->lk_waiters));
+	lock->lk_nextheld = NULL;
+#endif
+#if OPT_LOCKSTAT
+	lock->lk_stamp = 0;
+#endif
+}
+
+void
+lock_cleanup(struct lock *lock)
+{
+        KASSERT(lock != NULL);
+	KASSERT(lock->holder == NULL);
+
+	/* wchan_cleanup would assert if anyone was waiting on it */
+	KASSERT(wchan_isempty(&lock->lk_wchan));
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_cleanup(&lock->lk_wchan);
+}
+
 struct lock *
 lock_create(const char *name)
 {
         struct lock *lock;
+	char *copy;
 
-        lock = kmalloc(sizeof(struct lock));
+        lock = kmem_cache_alloc(&lock_cache);
         if (lock == NULL) {
                 return NULL;
         }
 
-        lock->lk_name = kstrdup(name);
-        if (lock->lk_name == NULL) {
-                kfree(lock);
+        copy = kstrdup(name);
+        if (copy == NULL) {
+                kmem_cache_free(&lock_cache, lock);
                 return NULL;
         }
- 
-	lock->lk_wchan = wchan_create(lock->lk_name);
-	if (lock->lk_wchan == NULL) {
-		kfree(lock->lk_name);
-		kfree(lock);
-		return NULL;
-	}
-
-	spinlock_init(&lock->lk_lock);
-        lock->locked = false;
-	lock->holder = NULL;
 
+	lock_init(lock, copy);
         return lock;
 }
 
 void
 lock_destroy(struct lock *lock)
 {
-        KASSERT(lock != NULL);
-	KASSERT(lock->holder == NULL);
-
-	/* wchan_cleanup will assert if anyone's waiting on it */
-	spinlock_cleanup(&lock->lk_lock);
-	wchan_destroy(lock->lk_wchan); 
-        kfree(lock->lk_name);
-        kfree(lock);
+	lock_cleanup(lock);
+        kfree((char *)lock->lk_name);
+        kmem_cache_free(&lock_cache, lock);
 }
 
+/*
+ * The holder can't let go of the lock, and so can't exit, while we
+ * have lk_lock, so it's safe to look at it then. Between rounds we
+ * drop lk_lock (so it can let go) and watch only the locked flag.
+ */
 void
 lock_acquire(struct lock *lock)
 {
+	unsigned rounds, i;
+	bool slept;
+#if OPT_LOCKSTAT
+	unsigned spins = 0;
+	uint64_t start = 0;
+#endif
+
         KASSERT(lock != NULL);
 
 	spinlock_acquire(&lock->lk_lock);
 
+	if (lock->locked) {
+		lock->lk_contended++;
+#if OPT_LOCKSTAT
+		start = gettime_ns();
+#endif
+	}
+	rounds = 0;
+	slept = false;
         while (lock->locked) {
-		wchan_lock(lock->lk_wchan);
+		if (rounds < LOCK_SPIN_ROUNDS &&
+		    thread_isrunning(lock->holder)) {
+			rounds++;
+			spinlock_release(&lock->lk_lock);
+			for (i=0; i<LOCK_SPIN_LOOPS && lock->locked; i++) {
+				/* spin */
+			}
+#if OPT_LOCKSTAT
+			spins += i;
+#endif
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
+		lock->lk_sleeps++;
+		slept = true;
+		pi_wait(lock);
+		wchan_lock(&lock->lk_wchan);
 		spinlock_release(&lock->lk_lock);
-                wchan_sleep(lock->lk_wchan);
+                wchan_sleep(&lock->lk_wchan);
 		spinlock_acquire(&lock->lk_lock);
+		pi_endwait(lock);
         }
+	if (rounds > 0 && !slept) {
+		lock->lk_spinwins++;
+	}
         lock->locked = true;
-	lock->holder = curthread;
+	pi_take(lock);
+	lock->lk_acquires++;
+#if OPT_LOCKSTAT
+	lock->lk_stamp = lockstat_acquired(lock, lock->lk_name,
+			(vaddr_t)__builtin_return_address(0),
+			spins, rounds > 0 || slept, slept, start);
+#endif
 
 	spinlock_release(&lock->lk_lock);
 }
@@ -217,9 +537,12 @@ lock_release(struct lock *lock)
 
 	spinlock_acquire(&lock->lk_lock);
 
+#if OPT_LOCKSTAT
+	lockstat_released(lock, lock->lk_name, lock->lk_stamp);
+#endif
         lock->locked = false;
-	lock->holder = NULL;
-	wchan_wakeone(lock->lk_wchan);
+	pi_give(lock);
+	wchan_wakeone(&lock->lk_wchan);
 
 	spinlock_release(&lock->lk_lock);
 }
@@ -237,44 +560,55 @@ lock_do_i_hold(struct lock *lock)
 // CV
 
 
+static struct kmem_cache cv_cache =
+	KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv), NULL, NULL);
+
+void
+cv_init(struct cv *cv, const char *name)
+{
+	cv->cv_name = name;
+	wchan_init(&cv->cv_wchan, name);
+	spinlock_init(&cv->cv_lock);
+}
+
+void
+cv_cleanup(struct cv *cv)
+{
+        KASSERT(cv != NULL);
+
+	/* wchan_cleanup would assert if anyone was waiting on it */
+	KASSERT(wchan_isempty(&cv->cv_wchan));
+	spinlock_cleanup(&cv->cv_lock);
+	wchan_cleanup(&cv->cv_wchan);
+}
+
 struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
+	char *copy;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(&cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
-        cv->cv_name = kstrdup(name);
-        if (cv->cv_name == NULL) {
-                kfree(cv);
+        copy = kstrdup(name);
+        if (copy == NULL) {
+                kmem_cache_free(&cv_cache, cv);
                 return NULL;
         }
-         
-	cv->cv_wchan = wchan_create(cv->cv_name);
-	if (cv->cv_wchan == NULL) {
-		kfree(cv->cv_name);
-		kfree(cv);
-		return NULL;
-	}
-
-	spinlock_init(&cv->cv_lock);
 
+	cv_init(cv, copy);
         return cv;
 }
 
 void
 cv_destroy(struct cv *cv)
 {
-        KASSERT(cv != NULL);
-
-	/* wchan_cleanup will assert if anyone's waiting on it */
-	spinlock_cleanup(&cv->cv_lock);
-	wchan_destroy(cv->cv_wchan); 
-        kfree(cv->cv_name);
-        kfree(cv);
+	cv_cleanup(cv);
+        kfree((char *)cv->cv_name);
+        kmem_cache_free(&cv_cache, cv);
 }
 
 void
@@ -285,14 +619,52 @@ cv_wait(struct cv *cv, struct lock *lock)
 	KASSERT(lock_do_i_hold(lock));
 
 	spinlock_acquire(&cv->cv_lock);
-	wchan_lock(cv->cv_wchan);
+	wchan_lock(&cv->cv_wchan);
 	spinlock_release(&cv->cv_lock);
 
 	lock_release(lock);
-	wchan_sleep(cv->cv_wchan);
+	wchan_sleep(&cv->cv_wchan);
 	lock_acquire(lock);
 }
 
+int
+cv_timedwait(struct cv *cv, struct lock *lock, unsigned ticks)
+{
+	struct wchan_timeout wt;
+	bool timedout = false;
+
+	KASSERT(cv != NULL);
+	KASSERT(lock != NULL);
+	KASSERT(lock_do_i_hold(lock));
+
+	wchan_timeout_start(&wt, &cv->cv_wchan, ticks);
+	spinlock_acquire(&cv->cv_lock);
+	wchan_lock(&cv->cv_wchan);
+	spinlock_release(&cv->cv_lock);
+
+	if (wt.wt_expired) {
+		wchan_unlock(&cv->cv_wchan);
+		timedout = true;
+	}
+	else {
+		lock_release(lock);
+		wchan_sleep(&cv->cv_wchan);
+		lock_acquire(lock);
+	}
+
+	/*
+	 * Once the timeout is stopped wt_woke can't change. If a signal
+	 * took us off the channel first, the timeout didn't wake us and
+	 * we return 0 even if it has expired since, so the signal isn't
+	 * lost.
+	 */
+	wchan_timeout_stop(&wt);
+	if (wt.wt_woke) {
+		timedout = true;
+	}
+	return timedout ? ETIMEDOUT : 0;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
@@ -300,9 +672,9 @@ cv_signal(struct cv *cv, struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
 
-	if (!wchan_isempty(cv->cv_wchan)) {
+	if (!wchan_isempty(&cv->cv_wchan)) {
 		spinlock_acquire(&cv->cv_lock);
-		wchan_wakeone(cv->cv_wchan);
+		wchan_wakeone(&cv->cv_wchan);
 		spinlock_release(&cv->cv_lock);
 	}
 }
@@ -314,9 +686,148 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	KASSERT(lock != NULL);
 	KASSERT(lock_do_i_hold(lock));
 
-	if (!wchan_isempty(cv->cv_wchan)) {
+	if (!wchan_isempty(&cv->cv_wchan)) {
 		spinlock_acquire(&cv->cv_lock);
-		wchan_wakeall(cv->cv_wchan);
+		wchan_wakeall(&cv->cv_wchan);
 		spinlock_release(&cv->cv_lock);
 	}
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+static struct kmem_cache rwlock_cache =
+	KMEM_CACHE_INITIALIZER("rwlock", sizeof(struct rwlock), NULL, NULL);
+
+void
+rwlock_init(struct rwlock *rw, const char *name)
+{
+	rw->rw_name = name;
+	wchan_init(&rw->rw_readwchan, name);
+	wchan_init(&rw->rw_writewchan, name);
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writerswaiting = 0;
+	rw->rw_writer = NULL;
+}
+
+void
+rwlock_cleanup(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0 && rw->rw_writer == NULL);
+
+	/* wchan_cleanup would assert if anyone was waiting on it */
+	KASSERT(wchan_isempty(&rw->rw_readwchan));
+	KASSERT(wchan_isempty(&rw->rw_writewchan));
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_cleanup(&rw->rw_writewchan);
+	wchan_cleanup(&rw->rw_readwchan);
+}
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+	char *copy;
+
+	rw = kmem_cache_alloc(&rwlock_cache);
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	copy = kstrdup(name);
+	if (copy == NULL) {
+		kmem_cache_free(&rwlock_cache, rw);
+		return NULL;
+	}
+
+	rwlock_init(rw, copy);
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	rwlock_cleanup(rw);
+	kfree((char *)rw->rw_name);
+	kmem_cache_free(&rwlock_cache, rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	while (rw->rw_writer != NULL || rw->rw_writerswaiting > 0) {
+		wchan_lock(&rw->rw_readwchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(&rw->rw_readwchan);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	rw->rw_readers++;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writerswaiting++;
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		wchan_lock(&rw->rw_writewchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(&rw->rw_writewchan);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	rw->rw_writerswaiting--;
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+/*
+ * When the lock comes free, a waiting writer gets it ahead of any
+ * waiting readers; the readers are all let go together once no
+ * writers are left.
+ */
+void
+rwlock_release(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	if (rw->rw_writer != NULL) {
+		KASSERT(rw->rw_writer == curthread);
+		KASSERT(rw->rw_readers == 0);
+		rw->rw_writer = NULL;
+	}
+	else {
+		KASSERT(rw->rw_readers > 0);
+		rw->rw_readers--;
+	}
+
+	if (rw->rw_readers == 0) {
+		if (rw->rw_writerswaiting > 0) {
+			wchan_wakeone(&rw->rw_writewchan);
+		}
+		else {
+			wchan_wakeall(&rw->rw_readwchan);
+		}
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	return (curthread == rw->rw_writer);
+}
@@ -44,33 +44,72 @@
 #include <thread.h>
 #include <threadlist.h>
 #include <threadprivate.h>
+#include <mpscq.h>
 #include <proc.h>
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <vm.h>
+#include <kmem_cache.h>
+#include <timer.h>
+#include <clock.h>
+#include <lockstat.h>
 
 #include "opt-synchprobs.h"
+#include "opt-A3.h"
+#include "opt-mlfq.h"
+#include "opt-idlepoll.h"
+#include "opt-tickless.h"
+#include "opt-schedstats.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
 #define THREAD_STACK_MAGIC 0xbaadf00d
 
-/* Wait channel. */
-struct wchan {
-	const char *wc_name;		/* name for this channel */
-	struct threadlist wc_threads;	/* list of waiting threads */
-	struct spinlock wc_lock;	/* lock for mutual exclusion */
+#if OPT_IDLEPOLL
+/*
+ * How many times an idle cpu checks its run queue before halting in
+ * cpu_idle(). Threads queued meanwhile are picked up without an IPI.
+ */
+#define IDLE_POLL_LOOPS	1000
+#endif
+
+#if OPT_MLFQ
+/*
+ * Time slice, in hardclocks, for each MLFQ level. Lower levels hold
+ * the CPU-bound threads, so they run less often but for longer.
+ */
+static const unsigned mlfq_quantum[MLFQ_NLEVELS] = { 1, 2, 4, 8 };
+
+/* Threads queued this many hardclocks are moved up a level. */
+#define MLFQ_AGE_HARDCLOCKS	50
+
+/* Lowest set bit of each 4-bit value, for picking the top level. */
+static const unsigned char mlfq_firstbit[16] = {
+	0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0,
 };
+#endif
 
+/*
+ * Exited threads are kept, stack and all, for thread_fork to reuse;
+ * freeing a kseg2 stack costs a TLB shootdown on every cpu. Each cpu
+ * keeps up to THREAD_MAXSPARES, unless fewer than THREAD_SPARE_LOWMEM
+ * frames are free, in which case they're given back.
+ */
+#define THREAD_MAXSPARES	4
+#define THREAD_SPARE_LOWMEM	64
+
+/* Wait channel. */
 /* Master array of CPUs. */
 DECLARRAY(cpu);
 DEFARRAY(cpu, /*no inline*/ );
 static struct cpuarray allcpus;
 
 /* Used to wait for secondary CPUs to come online. */
-static struct semaphore *cpu_startup_sem;
+static struct semaphore cpu_startup_sem =
+	SEMAPHORE_INITIALIZER(cpu_startup_sem, "cpu_hatch", 0);
 
 ////////////////////////////////////////////////////////////
 
@@ -112,45 +151,100 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Thread structures come from an object cache; the list nodes, which
+ * point back at their thread, only need setting up once.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_ctor(void *obj)
 {
-	struct thread *thread;
+	struct thread *thread = obj;
 
-	DEBUGASSERT(name != NULL);
+	threadlistnode_init(&thread->t_listnode, thread);
+	mpscq_node_init(&thread->t_inboxnode, thread);
+	return 0;
+}
 
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
-	}
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread),
+			       thread_ctor, NULL);
+
+/*
+ * Set up a thread fresh from the cache or the spare list. Everything
+ * but the stack is (re)initialized. Returns ENOMEM if the name can't be
+ * copied.
+ */
+static
+int
+thread_init(struct thread *thread, const char *name)
+{
+	DEBUGASSERT(name != NULL);
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+		return ENOMEM;
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
-	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_affinity = ~0U;
+	thread->t_migrations = 0;
+	thread->t_forwarded = false;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+#if OPT_MLFQ
+	/* New threads start at the top and work their way down. */
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_readysince = 0;
+	thread->t_level = MLFQ_NLEVELS;
+	thread->t_boost = MLFQ_NLEVELS;
+	thread->t_locksheld = NULL;
+	thread->t_blockedon = NULL;
+	thread->t_donation = MLFQ_NLEVELS;
+#endif
+#if OPT_SCHEDSTATS
+	bzero(&thread->t_stats, sizeof(thread->t_stats));
+	thread->t_stamp = 0;
+	thread->t_wakeup = false;
+	thread->t_lastran = NULL;
+#endif
+
 	/* If you add to struct thread, be sure to initialize here */
 
+	return 0;
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	thread = kmem_cache_alloc(&thread_cache);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_init(thread, name)) {
+		kmem_cache_free(&thread_cache, thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+
 	return thread;
 }
 
@@ -179,11 +273,41 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_spares);
+	c->c_sparesreused = 0;
+	c->c_stacksmade = 0;
+	threadlist_init(&c->c_leaving);
 	c->c_hardclocks = 0;
 
 	c->c_isidle = false;
+#if OPT_MLFQ
+	{
+		unsigned i;
+
+		for (i=0; i<MLFQ_NLEVELS; i++) {
+			threadlist_init(&c->c_runqueue[i]);
+		}
+	}
+	c->c_runbitmap = 0;
+	c->c_runcount = 0;
+#else
 	threadlist_init(&c->c_runqueue);
-	spinlock_init(&c->c_runqueue_lock);
+#endif
+	spinlock_init_ticket(&c->c_runqueue_lock);
+	c->c_stolenfrom = 0;
+	c->c_inboxed = 0;
+	c->c_stolen = 0;
+	mpscq_init(&c->c_inbox);
+#if OPT_SCHEDSTATS
+	bzero(&c->c_stats, sizeof(c->c_stats));
+#endif
+#if OPT_IDLEPOLL
+	c->c_polling = false;
+#endif
+#if OPT_TICKLESS
+	c->c_tickless = false;
+	c->c_tickstops = 0;
+#endif
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
@@ -193,6 +317,9 @@ cpu_create(unsigned hardware_number)
 	if (result != 0) {
 		panic("cpu_create: array_add: %s\n", strerror(result));
 	}
+#if OPT_LOCKSTAT
+	lockstat_cpu_init(c->c_number);
+#endif
 
 	snprintf(namebuf, sizeof(namebuf), "<boot #%d>", c->c_number);
 	c->c_curthread = thread_create(namebuf);
@@ -228,7 +355,8 @@ cpu_create(unsigned hardware_number)
 }
 
 /*
- * Destroy a thread.
+ * Destroy a thread. This tears down everything but the stack and the
+ * structure itself, which are freed by thread_free or kept as a spare.
  *
  * This function cannot be called in the victim thread's own context.
  * Nor can it be called on a running thread.
@@ -249,24 +377,58 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
-	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	thread->t_name = NULL;
+}
+
+/*
+ * Give back a destroyed thread's stack and structure.
+ */
+static
+void
+thread_free(struct thread *thread)
+{
+	if (thread->t_stack != NULL) {
+#if OPT_A3
+		vfree(thread->t_stack);
+#else
+		kfree(thread->t_stack);
+#endif
+	}
+	threadlistnode_cleanup(&thread->t_listnode);
+	kmem_cache_free(&thread_cache, thread);
+}
+
+/*
+ * True if memory is tight enough that spare threads should be freed
+ * rather than kept.
+ */
+static
+bool
+thread_lowmem(void)
+{
+#if OPT_A3
+	return vm_freepages() < THREAD_SPARE_LOWMEM;
+#else
+	return false;
+#endif
 }
 
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) Ones with a stack are
+ * put on the spare list if there's room; the rest are freed.
+ *
+ * Since this runs on every context switch, it is also where the spare
+ * list gets trimmed when memory runs low.
  *
- * The list of zombies is per-cpu.
+ * The lists of zombies and spares are per-cpu. This is called with
+ * interrupts off, which is what protects them.
  */
 static
 void
@@ -277,10 +439,77 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
+		thread_checkstack(z);
 		thread_destroy(z);
+		if (z->t_stack != NULL &&
+		    curcpu->c_spares.tl_count < THREAD_MAXSPARES &&
+		    !thread_lowmem()) {
+			z->t_wchan_name = "SPARE";
+			threadlist_addhead(&curcpu->c_spares, z);
+		}
+		else {
+			thread_free(z);
+		}
+	}
+
+	while (curcpu->c_spares.tl_count > 0 && thread_lowmem()) {
+		thread_free(threadlist_remtail(&curcpu->c_spares));
 	}
 }
 
+/*
+ * Get a thread for thread_fork, with a stack. Spares are taken most
+ * recently freed first, as their stacks are the likeliest to still be
+ * in the cache.
+ */
+static
+struct thread *
+thread_create_withstack(const char *name)
+{
+	struct thread *thread;
+	void *stack;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_spares);
+	if (thread != NULL) {
+		curcpu->c_sparesreused++;
+	}
+	else {
+		curcpu->c_stacksmade++;
+	}
+	splx(spl);
+
+	if (thread != NULL) {
+		stack = thread->t_stack;
+		if (thread_init(thread, name)) {
+			thread_free(thread);
+			return NULL;
+		}
+		thread->t_stack = stack;
+		return thread;
+	}
+
+	thread = thread_create(name);
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	/* Allocate a stack */
+#if OPT_A3
+	/* In kseg2, with a guard page below it */
+	thread->t_stack = vmalloc(STACK_SIZE);
+#else
+	thread->t_stack = kmalloc(STACK_SIZE);
+#endif
+	if (thread->t_stack == NULL) {
+		thread_destroy(thread);
+		thread_free(thread);
+		return NULL;
+	}
+	return thread;
+}
+
 /*
  * On panic, stop the thread system (as much as is reasonably
  * possible) to make sure we don't end up letting any other threads
@@ -303,9 +532,23 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
+#if OPT_MLFQ
+	{
+		unsigned i;
+
+		for (i=0; i<MLFQ_NLEVELS; i++) {
+			curcpu->c_runqueue[i].tl_count = 0;
+			curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+			curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+		}
+	}
+	curcpu->c_runbitmap = 0;
+	curcpu->c_runcount = 0;
+#else
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = NULL;
 	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+#endif
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -402,7 +645,7 @@ cpu_hatch(unsigned software_number)
 
 	kprintf("cpu%u: %s\n", software_number, cpu_identify());
 
-	V(cpu_startup_sem);
+	V(&cpu_startup_sem);
 	thread_exit();
 }
 
@@ -416,52 +659,677 @@ thread_start_cpus(void)
 
 	kprintf("cpu0: %s\n", cpu_identify());
 
-	cpu_startup_sem = sem_create("cpu_hatch", 0);
 	mainbus_start_cpus();
 	
 	for (i=0; i<cpuarray_num(&allcpus) - 1; i++) {
-		P(cpu_startup_sem);
+		P(&cpu_startup_sem);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Run queue operations. The caller must hold the cpu's run queue
+ * lock.
+ *
+ * With the MLFQ scheduler there is one queue per priority level, and
+ * threads are taken from the highest nonempty level. Otherwise there
+ * is a single round-robin queue. A thread is queued at its priority
+ * including anything inherited (see thread_priority); t_level
+ * remembers where, so it can be found again if that changes while it
+ * waits, and is MLFQ_NLEVELS when the thread isn't queued.
+ */
+
+#if OPT_MLFQ
+/* The highest nonempty level, or MLFQ_NLEVELS if none. */
+static
+unsigned
+runqueue_toplevel(struct cpu *c)
+{
+	if (c->c_runbitmap == 0) {
+		return MLFQ_NLEVELS;
+	}
+	return mlfq_firstbit[c->c_runbitmap];
+}
+
+static
+struct thread *
+runqueue_remlevel(struct cpu *c, unsigned level, bool tail)
+{
+	struct thread *t;
+
+	t = tail ? threadlist_remtail(&c->c_runqueue[level])
+		: threadlist_remhead(&c->c_runqueue[level]);
+	if (t == NULL) {
+		return NULL;
+	}
+	if (threadlist_isempty(&c->c_runqueue[level])) {
+		c->c_runbitmap &= ~(1U << level);
+	}
+	c->c_runcount--;
+	t->t_level = MLFQ_NLEVELS;
+	return t;
+}
+#endif
+
+#if OPT_TICKLESS
+/*
+ * Restart C's hardclock. If C isn't us, that has to be done on C, so
+ * send it an IPI; IPI_UNIDLE restarts the timer as well as waking an
+ * idle cpu. Call with C's run queue lock held.
+ */
+static
+void
+runqueue_starttick(struct cpu *c)
+{
+	KASSERT(c->c_tickless);
+	c->c_tickless = false;
+	if (c == curcpu->c_self) {
+		mainbus_hardclock_start();
+	}
+	else {
+		ipi_send(c, IPI_UNIDLE);
+	}
+}
+#endif
+
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+#if OPT_TICKLESS
+	if (c->c_tickless) {
+		/* There's something to time-slice again. */
+		runqueue_starttick(c);
+	}
+#endif
+#if OPT_MLFQ
+	unsigned level;
+
+	level = thread_priority(t);
+	KASSERT(level < MLFQ_NLEVELS);
+	KASSERT(t->t_level == MLFQ_NLEVELS);
+	t->t_readysince = c->c_hardclocks;
+	t->t_level = level;
+	threadlist_addtail(&c->c_runqueue[level], t);
+	c->c_runbitmap |= 1U << level;
+	c->c_runcount++;
+#else
+	threadlist_addtail(&c->c_runqueue, t);
+#endif
+}
+
+/* Take the next thread to run. */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+#if OPT_MLFQ
+	unsigned level;
+
+	level = runqueue_toplevel(c);
+	if (level == MLFQ_NLEVELS) {
+		return NULL;
+	}
+	return runqueue_remlevel(c, level, false);
+#else
+	return threadlist_remhead(&c->c_runqueue);
+#endif
+}
+
+/* Remove a particular thread from the run queue. */
+static
+void
+runqueue_remove(struct cpu *c, struct thread *t)
+{
+#if OPT_MLFQ
+	KASSERT(t->t_level < MLFQ_NLEVELS);
+	threadlist_remove(&c->c_runqueue[t->t_level], t);
+	if (threadlist_isempty(&c->c_runqueue[t->t_level])) {
+		c->c_runbitmap &= ~(1U << t->t_level);
+	}
+	c->c_runcount--;
+	t->t_level = MLFQ_NLEVELS;
+#else
+	threadlist_remove(&c->c_runqueue, t);
+#endif
+}
+
+static
+unsigned
+runqueue_count(struct cpu *c)
+{
+#if OPT_MLFQ
+	return c->c_runcount;
+#else
+	return c->c_runqueue.tl_count;
+#endif
+}
+
+#if OPT_IDLEPOLL
+/*
+ * Spin until something is put on our run queue or posted to our
+ * inbox, for at most IDLE_POLL_LOOPS checks. Called without the run
+ * queue lock, so the count has to be reread from memory each time.
+ */
+static
+void
+runqueue_poll(struct cpu *c)
+{
+	volatile unsigned *count;
+	unsigned i;
+
+#if OPT_MLFQ
+	count = &c->c_runcount;
+#else
+	count = &c->c_runqueue.tl_count;
+#endif
+	for (i=0; i<IDLE_POLL_LOOPS && *count == 0 &&
+		     mpscq_isempty(&c->c_inbox); i++) {
+		/* nothing */
+	}
+}
+#endif
+
+/*
+ * True if a thread that has just given up the cpu voluntarily (and
+ * is therefore still runnable) should go back on the run queue rather
+ * than just keep running.
+ */
+static
+bool
+runqueue_shouldyield(struct cpu *c, struct thread *cur)
+{
+#if OPT_MLFQ
+	return runqueue_toplevel(c) <= thread_priority(cur);
+#else
+	(void)cur;
+	return !threadlist_isempty(&c->c_runqueue);
+#endif
+}
+
+/*
+ * CPU affinity.
+ *
+ * Each thread has a mask of the cpus it may run on, bit N being cpu
+ * number N. Threads are only ever queued on a cpu in their mask, with
+ * one exception: a thread that changes its own mask keeps running
+ * where it is until it next gives up the cpu (see thread_switch).
+ */
+
+static
+bool
+thread_allowed(struct thread *t, struct cpu *c)
+{
+	return (t->t_affinity & (1U << c->c_number)) != 0;
+}
+
+/* Mask of all the cpus there are. */
+static
+unsigned
+thread_allcpus(void)
+{
+	unsigned numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	if (numcpus >= sizeof(unsigned) * CHAR_BIT) {
+		return ~0U;
+	}
+	return (1U << numcpus) - 1;
+}
+
+/*
+ * True if T, on the run queue of FROM, may be moved to TO. Ordinarily
+ * a cpu's curthread will not appear on its run queue. However, it can
+ * if the thread went to sleep, the cpu went idle (so it remained
+ * curthread, and the cpu is idling on its stack), and it was woken
+ * again before the cpu has fully unidled. Moving it then would run it
+ * on two cpus at once.
+ */
+static
+bool
+thread_canmove(struct thread *t, struct cpu *from, struct cpu *to)
+{
+	return t != from->c_curthread && thread_allowed(t, to);
+}
+
+/*
+ * Find the thread on C's run queue least in need of C that could be
+ * moved to THIEF: the last one on the lowest level.
+ */
+static
+struct thread *
+runqueue_findvictim(struct cpu *c, struct cpu *thief)
+{
+	struct thread *t;
+#if OPT_MLFQ
+	unsigned level;
+
+	for (level = MLFQ_NLEVELS; level-- > 0; ) {
+		if (threadlist_isempty(&c->c_runqueue[level])) {
+			continue;
+		}
+		THREADLIST_FORALL_REV(t, c->c_runqueue[level]) {
+			if (thread_canmove(t, c, thief)) {
+				return t;
+			}
+		}
+	}
+#else
+	if (!threadlist_isempty(&c->c_runqueue)) {
+		THREADLIST_FORALL_REV(t, c->c_runqueue) {
+			if (thread_canmove(t, c, thief)) {
+				return t;
+			}
+		}
+	}
+#endif
+	return NULL;
+}
+
+/*
+ * Choose where a thread that is being woken (or forked, or sent away
+ * by thread_switch) should be queued. If HOME, the last cpu it ran
+ * on, is allowed and idle, stay there. If HOME is busy, an idle cpu
+ * will run the thread soonest, so take one if there is one. Failing
+ * that, stay on HOME if it has fewer than WAKEUP_OVERLOAD threads
+ * waiting, since its cache may still be warm there; otherwise take
+ * the allowed cpu with the fewest waiting, moving off HOME only for
+ * one with at least two fewer. All this is read unlocked, as a hint.
+ */
+#define WAKEUP_OVERLOAD 2
+
+static
+struct cpu *
+thread_placement(struct thread *t, struct cpu *home)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus, count, bestcount;
+
+	if (thread_allowed(t, home) && home->c_isidle) {
+		return home;
+	}
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != home && c->c_isidle && thread_allowed(t, c)) {
+			return c;
+		}
+	}
+
+	best = NULL;
+	bestcount = 0;
+	if (thread_allowed(t, home)) {
+		count = runqueue_count(home);
+		if (count < WAKEUP_OVERLOAD) {
+			return home;
+		}
+		best = home;
+		bestcount = count - 1;
+	}
+
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == home || !thread_allowed(t, c)) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (best == NULL || count < bestcount) {
+			best = c;
+			bestcount = count;
+		}
+	}
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Work stealing.
+ *
+ * Take a thread from the back of the run queue of whichever other cpu
+ * has the most threads waiting, provided that is at least MINCOUNT
+ * and one of them may run here.
+ * The queue lengths are read without locking, so they're only a hint;
+ * the victim's count is checked again once its lock is held.
+ *
+ * The caller must not hold any run queue lock. We only ever hold the
+ * victim's, so two cpus stealing from each other can't deadlock. The
+ * stolen thread is on no queue when returned, and its t_cpu is
+ * already curcpu; the caller should run it or queue it.
+ */
+static
+struct thread *
+runqueue_steal(unsigned mincount)
+{
+	struct cpu *c, *victim;
+	struct thread *t;
+	unsigned i, numcpus, count, best;
+
+	KASSERT(mincount > 0);
+
+	victim = NULL;
+	best = mincount - 1;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self) {
+			continue;
+		}
+		count = runqueue_count(c);
+		if (count > best) {
+			best = count;
+			victim = c;
+		}
+	}
+	if (victim == NULL) {
+		return NULL;
+	}
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	t = NULL;
+	if (runqueue_count(victim) >= mincount) {
+		t = runqueue_findvictim(victim, curcpu->c_self);
+	}
+	if (t == NULL) {
+		spinlock_release(&victim->c_runqueue_lock);
+		return NULL;
+	}
+	runqueue_remove(victim, t);
+	t->t_cpu = curcpu->c_self;
+	t->t_migrations++;
+	victim->c_stolenfrom++;
+	spinlock_release(&victim->c_runqueue_lock);
+
+	curcpu->c_stolen++;
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return t;
+}
+
+#if OPT_SCHEDSTATS
+/*
+ * Scheduler statistics (see <kern/schedstats.h>). Timestamps come
+ * from gettime_ns, which on System/161 counts processor cycles; the
+ * on-chip cycle counter can't be used, as the hardclock resets it.
+ * A timestamp of 0 means there was no clock yet, and is ignored.
+ */
+
+/* Histogram bucket for a wakeup latency of NS nanoseconds. */
+static
+unsigned
+schedstats_bucket(uint64_t ns)
+{
+	uint64_t us;
+	unsigned b;
+
+	us = ns / 1000;
+	for (b = 0; us >= 2 && b < SCHEDSTATS_LATBUCKETS - 1; b++) {
+		us >>= 1;
+	}
+	return b;
+}
+
+/*
+ * CUR is being switched out to go to NEWSTATE; charge it and this cpu
+ * for the time it ran.
+ */
+static
+void
+schedstats_switchout(struct thread *cur, threadstate_t newstate, uint64_t now)
+{
+	struct schedstats *cs = &curcpu->c_stats;
+	uint64_t ran;
+
+	if (now != 0 && cur->t_stamp != 0 && now > cur->t_stamp) {
+		ran = now - cur->t_stamp;
+		cur->t_stats.ss_runtime += ran;
+		cs->ss_runtime += ran;
+	}
+	if (newstate == S_READY) {
+		cur->t_stats.ss_nivcsw++;
+		cs->ss_nivcsw++;
+	}
+	else {
+		cur->t_stats.ss_nvcsw++;
+		cs->ss_nvcsw++;
+	}
+}
+
+/*
+ * NEXT is about to run on this cpu; charge the time it was queued,
+ * and if it was woken up, record the latency.
+ */
+static
+void
+schedstats_switchin(struct thread *next, uint64_t now)
+{
+	struct schedstats *cs = &curcpu->c_stats;
+	uint64_t waited;
+	unsigned b;
+
+	if (now != 0 && next->t_stamp != 0 && now > next->t_stamp) {
+		waited = now - next->t_stamp;
+		next->t_stats.ss_waittime += waited;
+		cs->ss_waittime += waited;
+		if (next->t_wakeup) {
+			b = schedstats_bucket(waited);
+			next->t_stats.ss_wakeups++;
+			next->t_stats.ss_lathist[b]++;
+			cs->ss_wakeups++;
+			cs->ss_lathist[b]++;
+		}
+	}
+	if (next->t_lastran != NULL && next->t_lastran != curcpu->c_self) {
+		cs->ss_migrations++;
+	}
+	next->t_lastran = curcpu->c_self;
+	next->t_wakeup = false;
+	next->t_stamp = now;
+}
+#endif /* OPT_SCHEDSTATS */
+
+/*
+ * Remote wakeups.
+ *
+ * Waking a thread that last ran on another cpu doesn't touch that
+ * cpu's run queue lock. The thread is posted to the cpu's inbox, a
+ * lock-free queue, and the cpu takes it in itself, under its own lock:
+ * the next time it goes through thread_switch, or on the IPI. That is
+ * also where thread_placement is run for it (see runqueue_drain), so
+ * when many threads are woken at once (cv_broadcast, lbolt) no run
+ * queue lock bounces between cpus. Only the poster that finds the
+ * inbox empty sends the IPI, so a burst of wakeups costs the other
+ * cpu one interrupt.
+ *
+ * Waking a thread that last ran here takes our own run queue lock as
+ * before; if placement moves it, it is posted on to its new cpu.
+ *
+ * A cpu that is polling (see runqueue_poll) watches its inbox as well
+ * and isn't sent IPIs. The poster looks at c_polling after posting,
+ * and the cpu looks at its inbox after clearing c_polling, each with a
+ * barrier in between, so at least one of them sees the other.
+ */
+static
+void
+runqueue_post(struct cpu *c, struct thread *t)
+{
+	if (!mpscq_push(&c->c_inbox, &t->t_inboxnode)) {
+		/* Whoever found it empty is seeing to it. */
+		return;
+	}
+#if OPT_IDLEPOLL
+	membar_any_any();
+	if (c->c_polling) {
+		return;
+	}
+#endif
+	ipi_send(c, IPI_INBOX);
+}
+
+/*
+ * Send T, which is on no queue and which no cpu is running, to the
+ * inbox of C, which thread_placement chose for it.
+ */
+static
+void
+runqueue_forward(struct thread *t, struct cpu *c)
+{
+	t->t_cpu = c;
+	t->t_migrations++;
+	t->t_forwarded = true;
+	runqueue_post(c, t);
+}
+
+/*
+ * Take in the threads posted to our inbox. Call with the run queue
+ * lock held. Each goes on our run queue, unless thread_placement
+ * finds it a better cpu, in which case it is posted on to that one.
+ *
+ * We hold our run queue lock across every switch, so all the threads
+ * found here have been switched away from and can be moved. The one
+ * exception is our curthread, if we are idling on its stack; it has to
+ * stay (see thread_canmove). A thread another cpu has already placed
+ * stays too, so it can't be passed around indefinitely.
+ */
+static
+void
+runqueue_drain(struct cpu *c)
+{
+	struct mpscq_node *n, *next;
+	struct thread *t;
+	struct cpu *newcpu;
+
+	KASSERT(c == curcpu->c_self);
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	for (n = mpscq_takeall(&c->c_inbox); n != NULL; n = next) {
+		next = n->mn_next;
+		t = n->mn_self;
+		KASSERT(t->t_cpu == c);
+		c->c_inboxed++;
+		if (t->t_forwarded) {
+			t->t_forwarded = false;
+		}
+		else if (t != c->c_curthread) {
+			newcpu = thread_placement(t, c);
+			if (newcpu != c) {
+				runqueue_forward(t, newcpu);
+				continue;
+			}
+		}
+		runqueue_add(c, t);
 	}
-	sem_destroy(cpu_startup_sem);
-	cpu_startup_sem = NULL;
 }
 
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * targetcpu might be curcpu; it might not be, too. If it isn't, the
+ * thread is posted to it (see runqueue_post) and that cpu decides
+ * where it runs.
+ *
+ * Otherwise, unless the caller already holds the lock (in which case
+ * the thread stays put), the thread may be moved to another cpu first;
+ * see thread_placement.
  */
 static
 void
 thread_make_runnable(struct thread *target, bool already_have_lock)
 {
-	struct cpu *targetcpu;
-	bool isidle;
+	struct cpu *targetcpu, *newcpu;
+	int spl;
 
-	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
+#if OPT_SCHEDSTATS
+	/* Start the wait-time clock. */
+	target->t_stamp = gettime_ns();
+#endif
+
+	/* Stay on this cpu while deciding whether it's ours. */
+	spl = splhigh();
+
 	if (already_have_lock) {
 		/* The target thread's cpu should be already locked. */
 		KASSERT(spinlock_do_i_hold(&targetcpu->c_runqueue_lock));
 	}
+	else if (targetcpu != curcpu->c_self) {
+		/* It may still be switching away from the thread. */
+		runqueue_post(targetcpu, target);
+		splx(spl);
+		return;
+	}
 	else {
+		/* Lock the run queue of the target thread's cpu. */
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+		if (target != targetcpu->c_curthread) {
+			newcpu = thread_placement(target, targetcpu);
+			if (newcpu != targetcpu) {
+				runqueue_forward(target, newcpu);
+				spinlock_release(&targetcpu->c_runqueue_lock);
+				splx(spl);
+				return;
+			}
+		}
 	}
 
-	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
-	if (isidle) {
-		/*
-		 * Other processor is idle; send interrupt to make
-		 * sure it unidles.
-		 */
-		ipi_send(targetcpu, IPI_UNIDLE);
-	}
+	/*
+	 * This is our own run queue. If we're idle, we're in an
+	 * interrupt handler, and cpu_idle will return when it's done,
+	 * so there's no one to send an IPI to.
+	 */
+	KASSERT(targetcpu == curcpu->c_self);
+	runqueue_add(targetcpu, target);
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
 	}
+	splx(spl);
+}
+
+/*
+ * Requeue the threads thread_switch left on curcpu's leaving list
+ * because their affinity no longer includes this cpu. Called after
+ * switching away from them, so their contexts are saved, with
+ * interrupts off.
+ */
+static
+void
+thread_sendoff(void)
+{
+	struct thread *t;
+
+	while ((t = threadlist_remhead(&curcpu->c_leaving)) != NULL) {
+		thread_make_runnable(t, false);
+	}
+}
+
+/*
+ * Set the current thread's cpu affinity. Threads forked afterwards
+ * inherit it. If the current cpu isn't in MASK we move at once, unless
+ * there is nothing else for this cpu to do, in which case we move when
+ * we next yield or sleep. Cpus in MASK that don't exist are ignored;
+ * if that leaves none, fails with EINVAL.
+ */
+int
+thread_setaffinity(unsigned mask)
+{
+	mask &= thread_allcpus();
+	if (mask == 0) {
+		return EINVAL;
+	}
+	curthread->t_affinity = mask;
+	if (!thread_allowed(curthread, curcpu)) {
+		thread_yield();
+	}
+	return 0;
+}
+
+unsigned
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
 }
 
 /*
@@ -487,17 +1355,10 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	newthread = thread_create_withstack(name);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
-
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
 	thread_checkstack_init(newthread);
 
 	/*
@@ -506,6 +1367,7 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -513,8 +1375,9 @@ thread_fork(const char *name,
 	}
 	result = proc_addthread(proc, newthread);
 	if (result) {
-		/* thread_destroy will clean up the stack */
+		/* thread_free will clean up the stack */
 		thread_destroy(newthread);
+		thread_free(newthread);
 		return result;
 	}
 
@@ -549,6 +1412,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
 	int spl;
+#if OPT_SCHEDSTATS
+	uint64_t now, idlestart;
+#endif
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
 	DEBUGASSERT(curthread->t_cpu == curcpu->c_self);
@@ -570,25 +1436,62 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
-	/* Lock the run queue. */
+	/* Lock the run queue, and take in anything posted to us. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
+	runqueue_drain(curcpu->c_self);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. If we're
+	 * no longer allowed on this cpu but there's nothing else to run
+	 * here, we also have to stay; we can't idle on our own stack
+	 * while another cpu runs us.
+	 */
+	if (newstate == S_READY &&
+	    (thread_allowed(cur, curcpu) ? !runqueue_shouldyield(curcpu, cur)
+	     : runqueue_count(curcpu) == 0)) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
 	}
 
+#if OPT_SCHEDSTATS
+	now = gettime_ns();
+	schedstats_switchout(cur, newstate, now);
+	idlestart = 0;
+#endif
+
 	/* Put the thread in the right place. */
 	switch (newstate) {
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (thread_allowed(cur, curcpu)) {
+			thread_make_runnable(cur, true /*have lock*/);
+		}
+		else {
+			/*
+			 * Our affinity changed. Other cpus can't take
+			 * us until our context is saved, so we're sent
+			 * off after the switch by thread_sendoff.
+			 */
+			threadlist_addtail(&curcpu->c_leaving, cur);
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
+#if OPT_MLFQ
+		/*
+		 * Giving up the cpu to wait is what interactive
+		 * threads do; move up a level so we get the cpu back
+		 * promptly when woken. Doing it here rather than in
+		 * wchan_wake* means only we ever touch our priority
+		 * while we're not queued.
+		 */
+		if (cur->t_priority > 0) {
+			cur->t_priority--;
+		}
+		cur->t_ticks = 0;
+#endif
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -627,20 +1530,70 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * Note that c_isidle becomes true briefly even if we don't go
 	 * idle. However, because one is supposed to hold the runqueue
 	 * lock to look at it, this should not be visible or matter.
+	 *
+	 * Before idling, try to steal work from a busier cpu. That has
+	 * to be done without our own run queue lock held; see
+	 * runqueue_steal.
+	 *
+	 * With the idlepoll option we then watch the run queue for a
+	 * while before calling cpu_idle(). While c_polling is set,
+	 * runqueue_post doesn't send us IPIs, so it must be cleared,
+	 * and the queue and inbox looked at once more, with the lock
+	 * held: anyone who posts a thread after that sees it clear and
+	 * interrupts us, and the interrupt stays pending until
+	 * cpu_idle() lets it in.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		runqueue_drain(curcpu->c_self);
+		next = runqueue_remhead(curcpu);
 		if (next == NULL) {
+#if OPT_SCHEDSTATS
+			if (idlestart == 0) {
+				idlestart = now;
+			}
+#endif
+#if OPT_IDLEPOLL
+			curcpu->c_polling = true;
+#endif
+			spinlock_release(&curcpu->c_runqueue_lock);
+			next = runqueue_steal(1);
+			if (next != NULL) {
+				spinlock_acquire(&curcpu->c_runqueue_lock);
+#if OPT_IDLEPOLL
+				curcpu->c_polling = false;
+				membar_any_any();
+				runqueue_drain(curcpu->c_self);
+#endif
+				break;
+			}
+#if OPT_IDLEPOLL
+			runqueue_poll(curcpu);
+			spinlock_acquire(&curcpu->c_runqueue_lock);
+			curcpu->c_polling = false;
+			membar_any_any();
+			if (runqueue_count(curcpu) > 0 ||
+			    !mpscq_isempty(&curcpu->c_inbox)) {
+				continue;
+			}
 			spinlock_release(&curcpu->c_runqueue_lock);
+#endif
 			cpu_idle();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+#if OPT_SCHEDSTATS
+	if (idlestart != 0) {
+		now = gettime_ns();
+		curcpu->c_stats.ss_idletime += now - idlestart;
+	}
+	schedstats_switchin(next, now);
+#endif
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -651,6 +1604,11 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	curcpu->c_curthread = next;
 	curthread = next;
 
+#if OPT_A3
+	/* The stack we switch onto must not take TLB misses. */
+	vm_wire_kstack(next->t_stack);
+#endif
+
 	/* do the switch (in assembler in switch.S) */
 	switchframe_switch(&cur->t_context, &next->t_context);
 
@@ -708,6 +1666,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Unlock the run queue. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Move threads that can't stay here to another cpu. */
+	thread_sendoff();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
@@ -741,6 +1702,9 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Release the runqueue lock acquired in thread_switch. */
 	spinlock_release(&curcpu->c_runqueue_lock);
 
+	/* Move threads that can't stay here to another cpu. */
+	thread_sendoff();
+
 	/* Activate our address space in the MMU. */
 	as_activate();
 
@@ -808,6 +1772,16 @@ thread_exit(void)
 	panic("The zombie walks!\n");
 }
 
+/*
+ * Check whether a thread is on a cpu. t_state is S_RUN from when the
+ * thread is switched to until it next switches away.
+ */
+bool
+thread_isrunning(const struct thread *t)
+{
+	return *(volatile const threadstate_t *)&t->t_state == S_RUN;
+}
+
 /*
  * Yield the cpu to another process, but stay runnable.
  */
@@ -824,23 +1798,141 @@ thread_yield(void)
  *
  * This is called periodically from hardclock(). It should reshuffle
  * the current CPU's run queue by job priority.
+ *
+ * With the MLFQ scheduler, threads are demoted a level each time they
+ * use a whole time slice (see thread_timeslice) and promoted a level
+ * each time they sleep. That alone would let a steady stream of
+ * interactive threads starve the bottom levels forever, so here we
+ * age threads: any thread that has sat on the run queue for
+ * MLFQ_AGE_HARDCLOCKS is moved up a level. Each queue is in the order
+ * threads were added, so only the threads at the front need looking
+ * at.
  */
 
 void
 schedule(void)
 {
+#if OPT_MLFQ
+	struct threadlist *tl;
+	struct thread *t;
+	unsigned level, now;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	now = curcpu->c_hardclocks;
+	for (level = 1; level < MLFQ_NLEVELS; level++) {
+		tl = &curcpu->c_runqueue[level];
+		while (!threadlist_isempty(tl)) {
+			t = tl->tl_head.tln_next->tln_self;
+			if (now - t->t_readysince < MLFQ_AGE_HARDCLOCKS) {
+				/* Everyone behind it is younger. */
+				break;
+			}
+			runqueue_remlevel(curcpu, level, false);
+			t->t_priority = level - 1;
+			t->t_ticks = 0;
+			runqueue_add(curcpu, t);
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+#else
 	/*
 	 * You can write this. If we do nothing, threads will run in
 	 * round-robin fashion.
 	 */
+#endif
+}
+
+/*
+ * Time slicing.
+ *
+ * This is called on every hardclock(). Without the MLFQ scheduler,
+ * every thread gets one hardclock at a time. With it, the current
+ * thread keeps the cpu until it has used the time slice for its
+ * level, at which point it is demoted, or until a thread at a higher
+ * level becomes runnable.
+ */
+void
+thread_timeslice(void)
+{
+#if OPT_MLFQ
+	struct thread *cur;
+	bool preempt;
+
+	cur = curthread;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (curcpu->c_isidle) {
+		/* curthread is whoever went to sleep; don't charge it. */
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+	cur->t_ticks++;
+	if (cur->t_ticks >= mlfq_quantum[cur->t_priority]) {
+		if (cur->t_priority < MLFQ_NLEVELS - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		preempt = true;
+	}
+	else {
+		preempt = runqueue_toplevel(curcpu) < thread_priority(cur);
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (preempt) {
+		thread_yield();
+	}
+#else
+	thread_yield();
+#endif
+}
+
+#if OPT_MLFQ
+/*
+ * Priority inheritance support. The caller (in synch.c) serializes
+ * calls to thread_setboost and makes sure T can't go away meanwhile.
+ */
+unsigned
+thread_priority(const struct thread *t)
+{
+	return t->t_boost < t->t_priority ? t->t_boost : t->t_priority;
+}
+
+/*
+ * Set T's inherited level. If T is sitting on a run queue, move it to
+ * the level it now belongs at. If it isn't, or is on its way from one
+ * cpu's queue to another's (in which case t_cpu may change under us),
+ * whoever queues it next will see the new value.
+ */
+void
+thread_setboost(struct thread *t, unsigned boost)
+{
+	struct cpu *c;
+
+	KASSERT(boost <= MLFQ_NLEVELS);
+	t->t_boost = boost;
+
+	c = t->t_cpu;
+	if (c == NULL) {
+		/* Not started yet. */
+		return;
+	}
+	spinlock_acquire(&c->c_runqueue_lock);
+	if (t->t_cpu == c && t->t_level < MLFQ_NLEVELS &&
+	    t->t_level != thread_priority(t)) {
+		runqueue_remove(c, t);
+		runqueue_add(c, t);
+	}
+	spinlock_release(&c->c_runqueue_lock);
 }
+#endif
 
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * This is also called periodically from hardclock(). If other CPUs
+ * are busier than the current one, it should move threads across
+ * from them.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -851,110 +1943,227 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * Work moves by pulling rather than pushing: an idle cpu steals
+ * straight away from thread_switch, and here a cpu that is merely
+ * less busy than another takes threads until the difference is at
+ * most one.
  */
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
 	struct thread *t;
+#if OPT_TICKLESS
+	struct cpu *c;
+	unsigned i, numcpus, count;
+#endif
+
+	while ((t = runqueue_steal(runqueue_count(curcpu) + 2)) != NULL) {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		runqueue_add(curcpu, t);
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
 
-	my_count = total_count = 0;
+#if OPT_TICKLESS
+	/*
+	 * Cpus without a hardclock don't come here, so they don't look
+	 * for work. If we have some they would take (see above and
+	 * thread_switch), restart one of them so it does.
+	 */
+	count = runqueue_count(curcpu);
+	if (count == 0) {
+		return;
+	}
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || !c->c_tickless ||
+		    (count < 2 && !c->c_isidle)) {
+			continue;
+		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+		if (c->c_tickless) {
+			runqueue_starttick(c);
+			spinlock_release(&c->c_runqueue_lock);
+			return;
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
+#endif
+}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+/*
+ * Tickless operation.
+ *
+ * This is called from hardclock(). If nothing is waiting to run on
+ * this cpu, either because it is idle or because only the current
+ * thread is runnable here, nothing hardclock does until something is
+ * queued can make a difference: there is nobody to time-slice with or
+ * to age, and pulling work from other cpus is left to idle cpus in
+ * thread_switch and to busy cpus waking us up (above). So stop the
+ * hardclock, unless timers are pending here. runqueue_add and
+ * thread_starttick start it again.
+ *
+ * timerclock() runs off a separate timer, so lbolt is unaffected.
+ */
+void
+thread_consider_tickless(void)
+{
+#if OPT_TICKLESS
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (!curcpu->c_tickless && runqueue_count(curcpu) == 0 &&
+	    mpscq_isempty(&curcpu->c_inbox) && timer_npending() == 0) {
+		curcpu->c_tickless = true;
+		curcpu->c_tickstops++;
+		mainbus_hardclock_stop();
 	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+#endif
+}
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
+/*
+ * Make sure this cpu's hardclock is running. Called by timer_start,
+ * with interrupts off.
+ */
+void
+thread_starttick(void)
+{
+#if OPT_TICKLESS
 	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	if (curcpu->c_tickless) {
+		runqueue_starttick(curcpu->c_self);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
+#endif
+}
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
+/*
+ * Print per-cpu scheduler statistics.
+ */
+void
+thread_printstats(void)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	kprintf("Scheduler:\n");
+	kprintf("  %-5s %10s %7s %8s %8s %8s %6s %8s %8s\n", "cpu",
+		"hardclocks", "queued", "stolen", "stolenby", "posted",
+		"spares", "reused", "stacks");
+	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+		kprintf("  %-5u %10u %7u %8u %8u %8u %6u %8u %8u\n",
+			c->c_number, c->c_hardclocks, runqueue_count(c),
+			c->c_stolen, c->c_stolenfrom, c->c_inboxed,
+			c->c_spares.tl_count, c->c_sparesreused,
+			c->c_stacksmade);
+		spinlock_release(&c->c_runqueue_lock);
+	}
+#if OPT_TICKLESS
+	kprintf("  hardclock stopped:");
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		kprintf(" cpu%u %u%s", c->c_number, c->c_tickstops,
+			c->c_tickless ? " (now)" : "");
+	}
+	kprintf("\n");
+#endif
+#if OPT_SCHEDSTATS
+	kprintf("  %-5s %10s %10s %10s %8s %8s %6s %8s\n", "cpu", "run ms",
+		"idle ms", "wait ms", "vcsw", "ivcsw", "migr", "wakeups");
+	for (i=0; i<numcpus; i++) {
+		struct schedstats ss;
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
-		}
+		c = cpuarray_get(&allcpus, i);
+		spinlock_acquire(&c->c_runqueue_lock);
+		ss = c->c_stats;
 		spinlock_release(&c->c_runqueue_lock);
+		kprintf("  %-5u %10llu %10llu %10llu %8u %8u %6u %8u\n",
+			c->c_number, ss.ss_runtime / 1000000,
+			ss.ss_idletime / 1000000, ss.ss_waittime / 1000000,
+			ss.ss_nvcsw, ss.ss_nivcsw, ss.ss_migrations,
+			ss.ss_wakeups);
 	}
+#endif
+}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+/*
+ * Print per-cpu histograms of wakeup latency.
+ */
+void
+thread_printlatency(void)
+{
+#if OPT_SCHEDSTATS
+	struct cpu *c;
+	unsigned i, b, numcpus;
+	uint32_t total;
+	char label[24];
+
+	numcpus = cpuarray_num(&allcpus);
+	kprintf("Wakeup latency:\n");
+	kprintf("  %-16s", "");
+	for (i=0; i<numcpus; i++) {
+		kprintf(" %7s%-2u", "cpu", i);
+	}
+	kprintf(" %9s\n", "total");
+
+	for (b=0; b<SCHEDSTATS_LATBUCKETS; b++) {
+		if (b == 0) {
+			snprintf(label, sizeof(label), "< 2 us");
 		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+		else if (b == SCHEDSTATS_LATBUCKETS - 1) {
+			snprintf(label, sizeof(label), ">= %u us", 1U << b);
+		}
+		else {
+			snprintf(label, sizeof(label), "%u-%u us",
+				 1U << b, 2U << b);
+		}
+		kprintf("  %-16s", label);
+		total = 0;
+		for (i=0; i<numcpus; i++) {
+			c = cpuarray_get(&allcpus, i);
+			/* Unlocked; a count may be one behind. */
+			kprintf(" %9u", c->c_stats.ss_lathist[b]);
+			total += c->c_stats.ss_lathist[b];
+		}
+		kprintf(" %9u\n", total);
 	}
+#else
+	kprintf("Scheduler statistics are not compiled in "
+		"(options schedstats)\n");
+#endif
+}
+
+/*
+ * Copy out the scheduler statistics of cpu CPU, or of the current
+ * thread if CPU is SCHEDSTATS_SELF.
+ */
+int
+thread_getschedstats(int cpu, struct schedstats *ss)
+{
+#if OPT_SCHEDSTATS
+	struct cpu *c;
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	if (cpu == SCHEDSTATS_SELF) {
+		*ss = curthread->t_stats;
+		ss->ss_migrations = curthread->t_migrations;
+		return 0;
+	}
+	if (cpu < 0 || (unsigned)cpu >= cpuarray_num(&allcpus)) {
+		return EINVAL;
+	}
+	c = cpuarray_get(&allcpus, cpu);
+	spinlock_acquire(&c->c_runqueue_lock);
+	*ss = c->c_stats;
+	spinlock_release(&c->c_runqueue_lock);
+	return 0;
+#else
+	(void)cpu;
+	(void)ss;
+	return ENOSYS;
+#endif
 }
 
 ////////////////////////////////////////////////////////////
@@ -980,9 +2189,7 @@ wchan_create(const char *name)
 	if (wc == NULL) {
 		return NULL;
 	}
-	spinlock_init(&wc->wc_lock);
-	threadlist_init(&wc->wc_threads);
-	wc->wc_name = name;
+	wchan_init(wc, name);
 	return wc;
 }
 
@@ -992,10 +2199,34 @@ wchan_create(const char *name)
  */
 void
 wchan_destroy(struct wchan *wc)
+{
+	wchan_cleanup(wc);
+	kfree(wc);
+}
+
+/*
+ * Set up and tear down a wait channel the caller has allocated, for
+ * instance as part of a lock.
+ */
+void
+wchan_init(struct wchan *wc, const char *name)
+{
+	spinlock_init(&wc->wc_lock);
+	threadlist_init(&wc->wc_threads);
+	wc->wc_name = name;
+}
+
+void
+wchan_cleanup(struct wchan *wc)
 {
 	spinlock_cleanup(&wc->wc_lock);
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+}
+
+void
+wchan_setname(struct wchan *wc, const char *name)
+{
+	wc->wc_name = name;
 }
 
 /*
@@ -1028,6 +2259,20 @@ wchan_sleep(struct wchan *wc)
 	thread_switch(S_SLEEP, wc);
 }
 
+/*
+ * Make a thread just taken off a wait channel runnable.
+ */
+static
+void
+wchan_waketarget(struct thread *target)
+{
+#if OPT_SCHEDSTATS
+	/* Its wait on the run queue counts as wakeup latency. */
+	target->t_wakeup = true;
+#endif
+	thread_make_runnable(target, false);
+}
+
 /*
  * Wake up one thread sleeping on a wait channel.
  */
@@ -1050,7 +2295,7 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
-	thread_make_runnable(target, false);
+	wchan_waketarget(target);
 }
 
 /*
@@ -1079,17 +2324,74 @@ wchan_wakeall(struct wchan *wc)
 	spinlock_release(&wc->wc_lock);
 
 	/*
-	 * We could conceivably sort by cpu first to cause fewer lock
-	 * ops and fewer IPIs, but for now at least don't bother. Just
-	 * make each thread runnable.
+	 * Just make each thread runnable. Threads moving to other cpus
+	 * are posted to their inboxes, which sends each cpu at most one
+	 * IPI (see runqueue_post), so there is little to gain by sorting
+	 * them by cpu first.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		wchan_waketarget(target);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Timeout for a timed sleep: wake the sleeping thread if it is still
+ * on the channel. Runs in the timer interrupt. The thread can only be
+ * found by looking through the channel, but this happens once per
+ * timeout rather than once per wakeup.
+ */
+static
+void
+wchan_timeout_expire(void *data)
+{
+	struct wchan_timeout *wt = data;
+	struct wchan *wc = wt->wt_wchan;
+	struct thread *t, *target;
+
+	target = NULL;
+	spinlock_acquire(&wc->wc_lock);
+	wt->wt_expired = true;
+	THREADLIST_FORALL(t, wc->wc_threads) {
+		if (t == wt->wt_thread) {
+			target = t;
+			break;
+		}
+	}
+	if (target != NULL) {
+		threadlist_remove(&wc->wc_threads, target);
+		wt->wt_woke = true;
+	}
+	spinlock_release(&wc->wc_lock);
+
+	if (target != NULL) {
+		wchan_waketarget(target);
+	}
+}
+
+void
+wchan_timeout_start(struct wchan_timeout *wt, struct wchan *wc,
+		    unsigned ticks)
+{
+	timer_init(&wt->wt_timer, wchan_timeout_expire, wt);
+	wt->wt_wchan = wc;
+	wt->wt_thread = curthread;
+	wt->wt_expired = false;
+	wt->wt_woke = false;
+	if (ticks == 0) {
+		wt->wt_expired = true;
+		return;
+	}
+	timer_start(&wt->wt_timer, ticks);
+}
+
+void
+wchan_timeout_stop(struct wchan_timeout *wt)
+{
+	timer_stop(&wt->wt_timer);
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1162,6 +2464,27 @@ ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 	spinlock_release(&target->c_ipi_lock);
 }
 
+/*
+ * Send a TLB shootdown to every cpu but this one. Returns a mask of
+ * the cpus it went to, bit N being cpu number N.
+ */
+unsigned
+ipi_tlbshootdown_broadcast(const struct tlbshootdown *mapping)
+{
+	unsigned i, mask;
+	struct cpu *c;
+
+	mask = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != curcpu->c_self) {
+			ipi_tlbshootdown(c, mapping);
+			mask |= 1U << c->c_number;
+		}
+	}
+	return mask;
+}
+
 void
 interprocessor_interrupt(void)
 {
@@ -1189,8 +2512,14 @@ interprocessor_interrupt(void)
 	if (bits & (1U << IPI_UNIDLE)) {
 		/*
 		 * The cpu has already unidled itself to take the
-		 * interrupt; don't need to do anything else.
+		 * interrupt; don't need to do anything else, except
+		 * that this is also how runqueue_starttick tells us to
+		 * restart our hardclock. (If it was running anyway,
+		 * this just makes the next tick a little late.)
 		 */
+#if OPT_TICKLESS
+		mainbus_hardclock_start();
+#endif
 	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
@@ -1206,4 +2535,15 @@ interprocessor_interrupt(void)
 
 	curcpu->c_ipi_pending = 0;
 	spinlock_release(&curcpu->c_ipi_lock);
+
+	if (bits & (1U << IPI_INBOX)) {
+		/*
+		 * Threads have been posted to us. This has to wait
+		 * until the IPI lock is released, since it comes after
+		 * the run queue lock.
+		 */
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		runqueue_drain(curcpu->c_self);
+		spinlock_release(&curcpu->c_runqueue_lock);
+	}
 }
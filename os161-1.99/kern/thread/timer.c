@@ -0,0 +1,183 @@
+/*
+ * Kernel timers (see <timer.h>).
+ *
+ * A timer due at tick T is on slot T % TIMER_SLOTS of its wheel, along
+ * with any timers due whole turns of the wheel later. Each hardclock
+ * advances the wheel one tick and fires the timers on the new slot
+ * that are due now, leaving the later ones for another turn.
+ *
+ * Expired timers are moved to a local list and run one at a time with
+ * the wheel unlocked, so their functions can start timers and other
+ * cpus can stop them. tw_running is what timer_stop waits on.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <current.h>
+#include <thread.h>
+#include <timer.h>
+#include <platform/maxcpus.h>
+
+#define TIMER_SLOTS	256	/* must be a power of 2 */
+
+struct timerwheel {
+	struct spinlock tw_lock;
+	unsigned tw_now;		/* ticks so far */
+	unsigned tw_count;		/* timers pending */
+	struct timer *tw_running;	/* timer whose function is running */
+	struct timer *tw_slots[TIMER_SLOTS];
+};
+
+static struct timerwheel wheels[MAXCPUS];
+
+static
+void
+timer_link(struct timer **list, struct timer *t)
+{
+	t->tm_next = *list;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_pprev = &t->tm_next;
+	}
+	t->tm_pprev = list;
+	*list = t;
+}
+
+static
+void
+timer_unlink(struct timer *t)
+{
+	*t->tm_pprev = t->tm_next;
+	if (t->tm_next != NULL) {
+		t->tm_next->tm_pprev = t->tm_pprev;
+	}
+	t->tm_next = NULL;
+	t->tm_pprev = NULL;
+}
+
+void
+timer_bootstrap(void)
+{
+	struct timerwheel *w;
+	unsigned i, j;
+
+	for (i=0; i<MAXCPUS; i++) {
+		w = &wheels[i];
+		spinlock_init(&w->tw_lock);
+		w->tw_now = 0;
+		w->tw_count = 0;
+		w->tw_running = NULL;
+		for (j=0; j<TIMER_SLOTS; j++) {
+			w->tw_slots[j] = NULL;
+		}
+	}
+}
+
+void
+timer_init(struct timer *t, void (*func)(void *data), void *data)
+{
+	t->tm_next = NULL;
+	t->tm_pprev = NULL;
+	t->tm_wheel = NULL;
+	t->tm_expires = 0;
+	t->tm_func = func;
+	t->tm_data = data;
+}
+
+void
+timer_start(struct timer *t, unsigned ticks)
+{
+	struct timerwheel *w;
+	int spl;
+
+	KASSERT(t->tm_pprev == NULL);
+	KASSERT(ticks > 0);
+
+	/* Stay on this cpu until the hardclock is sure to be running. */
+	spl = splhigh();
+	w = &wheels[curcpu->c_number];
+
+	spinlock_acquire(&w->tw_lock);
+	t->tm_wheel = w;
+	t->tm_expires = w->tw_now + ticks;
+	timer_link(&w->tw_slots[t->tm_expires % TIMER_SLOTS], t);
+	w->tw_count++;
+	spinlock_release(&w->tw_lock);
+
+	thread_starttick();
+	splx(spl);
+}
+
+bool
+timer_stop(struct timer *t)
+{
+	struct timerwheel *w;
+
+	w = t->tm_wheel;
+	if (w == NULL) {
+		/* Never started. */
+		return false;
+	}
+
+	spinlock_acquire(&w->tw_lock);
+	if (t->tm_pprev != NULL) {
+		timer_unlink(t);
+		w->tw_count--;
+		spinlock_release(&w->tw_lock);
+		return true;
+	}
+	while (w->tw_running == t) {
+		spinlock_release(&w->tw_lock);
+		/* spin */
+		spinlock_acquire(&w->tw_lock);
+	}
+	spinlock_release(&w->tw_lock);
+	return false;
+}
+
+void
+timer_hardclock(void)
+{
+	struct timerwheel *w;
+	struct timer *t, *next, *expired;
+	struct timer **slot;
+
+	w = &wheels[curcpu->c_number];
+	expired = NULL;
+
+	spinlock_acquire(&w->tw_lock);
+	w->tw_now++;
+	slot = &w->tw_slots[w->tw_now % TIMER_SLOTS];
+	for (t = *slot; t != NULL; t = next) {
+		next = t->tm_next;
+		if (t->tm_expires == w->tw_now) {
+			timer_unlink(t);
+			timer_link(&expired, t);
+		}
+	}
+
+	/*
+	 * Still pending (and counted) while on the expired list, so
+	 * timer_stop can take them off it.
+	 */
+	while ((t = expired) != NULL) {
+		timer_unlink(t);
+		w->tw_count--;
+		w->tw_running = t;
+		spinlock_release(&w->tw_lock);
+
+		t->tm_func(t->tm_data);
+
+		spinlock_acquire(&w->tw_lock);
+		w->tw_running = NULL;
+	}
+	spinlock_release(&w->tw_lock);
+}
+
+unsigned
+timer_npending(void)
+{
+	return wheels[curcpu->c_number].tw_count;
+}
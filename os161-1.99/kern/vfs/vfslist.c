@@ -88,7 +88,8 @@ DEFARRAY(knowndev, /*no inline*/);
 static struct knowndevarray *knowndevs;
 
 /* The big lock for all FS ops. Remove for filesystem assignment. */
-static struct lock *vfs_biglock;
+static struct lock vfs_biglock =
+	LOCK_INITIALIZER(vfs_biglock, "vfs_biglock");
 static unsigned vfs_biglock_depth;
 
 
@@ -103,10 +104,6 @@ vfs_bootstrap(void)
 		panic("vfs: Could not create knowndevs array\n");
 	}
 
-	vfs_biglock = lock_create("vfs_biglock");
-	if (vfs_biglock==NULL) {
-		panic("vfs: Could not create vfs big lock\n");
-	}
 	vfs_biglock_depth = 0;
 
 	devnull_create();
@@ -122,8 +119,8 @@ vfs_bootstrap(void)
 void
 vfs_biglock_acquire(void)
 {
-	if (!lock_do_i_hold(vfs_biglock)) {
-		lock_acquire(vfs_biglock);
+	if (!lock_do_i_hold(&vfs_biglock)) {
+		lock_acquire(&vfs_biglock);
 	}
 	vfs_biglock_depth++;
 }
@@ -131,18 +128,18 @@ vfs_biglock_acquire(void)
 void
 vfs_biglock_release(void)
 {
-	KASSERT(lock_do_i_hold(vfs_biglock));
+	KASSERT(lock_do_i_hold(&vfs_biglock));
 	KASSERT(vfs_biglock_depth > 0);
 	vfs_biglock_depth--;
 	if (vfs_biglock_depth == 0) {
-		lock_release(vfs_biglock);
+		lock_release(&vfs_biglock);
 	}
 }
 
 bool
 vfs_biglock_do_i_hold(void)
 {
-	return lock_do_i_hold(vfs_biglock);
+	return lock_do_i_hold(&vfs_biglock);
 }
 
 /*
@@ -33,6 +33,7 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
+#include <atomic.h>
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
@@ -49,7 +50,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	KASSERT(ops!=NULL);
 
 	vn->vn_ops = ops;
-	vn->vn_refcount = 1;
+	atomic_store(&vn->vn_refcount, 1);
 	vn->vn_opencount = 0;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
@@ -63,11 +64,11 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 void
 vnode_cleanup(struct vnode *vn)
 {
-	KASSERT(vn->vn_refcount==1);
+	KASSERT(atomic_load(&vn->vn_refcount)==1);
 	KASSERT(vn->vn_opencount==0);
 
 	vn->vn_ops = NULL;
-	vn->vn_refcount = 0;
+	atomic_store(&vn->vn_refcount, 0);
 	vn->vn_opencount = 0;
 	vn->vn_fs = NULL;
 	vn->vn_data = NULL;
@@ -77,44 +78,54 @@ vnode_cleanup(struct vnode *vn)
 /*
  * Increment refcount.
  * Called by VOP_INCREF.
+ *
+ * The refcount is atomic, so this doesn't need the big lock. Callers
+ * either hold a reference already or, like the filesystems' loadvnode
+ * functions, hold the big lock, which keeps VOP_RECLAIM away.
  */
 void
 vnode_incref(struct vnode *vn)
 {
 	KASSERT(vn != NULL);
 
-	vfs_biglock_acquire();
-
-	vn->vn_refcount++;
-
-	vfs_biglock_release();
+	atomic_add(&vn->vn_refcount, 1);
 }
 
 /*
  * Decrement refcount.
  * Called by VOP_DECREF.
  * Calls VOP_RECLAIM if the refcount hits zero.
+ *
+ * Dropping a reference that isn't the last is a compare-and-swap.
+ * For the last one we take the big lock and call VOP_RECLAIM, which
+ * must check the refcount again under the big lock: a loadvnode may
+ * have picked the vnode up meanwhile. If so it drops our reference
+ * and returns EBUSY.
  */
 void
 vnode_decref(struct vnode *vn)
 {
-	int result;
+	int result, old, found;
 
 	KASSERT(vn != NULL);
 
+	old = atomic_load(&vn->vn_refcount);
+	while (old > 1) {
+		found = atomic_cas(&vn->vn_refcount, old, old - 1);
+		if (found == old) {
+			return;
+		}
+		old = found;
+	}
+	KASSERT(old == 1);
+
 	vfs_biglock_acquire();
 
-	KASSERT(vn->vn_refcount>0);
-	if (vn->vn_refcount>1) {
-		vn->vn_refcount--;
-	}
-	else {
-		result = VOP_RECLAIM(vn);
-		if (result != 0 && result != EBUSY) {
-			// XXX: lame.
-			kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
-				strerror(result));
-		}
+	result = VOP_RECLAIM(vn);
+	if (result != 0 && result != EBUSY) {
+		// XXX: lame.
+		kprintf("vfs: Warning: VOP_RECLAIM: %s\n",
+			strerror(result));
 	}
 
 	vfs_biglock_release();
@@ -173,6 +184,8 @@ vnode_decopen(struct vnode *vn)
 void
 vnode_check(struct vnode *v, const char *opstr)
 {
+	int refcount;
+
 	vfs_biglock_acquire();
 
 	if (v == NULL) {
@@ -202,16 +215,17 @@ vnode_check(struct vnode *v, const char *opstr)
 		panic("vnode_check: vop_%s: deadbeef fs pointer\n", opstr);
 	}
 
-	if (v->vn_refcount < 0) {
+	refcount = atomic_load(&v->vn_refcount);
+	if (refcount < 0) {
 		panic("vnode_check: vop_%s: negative refcount %d\n", opstr,
-		      v->vn_refcount);
+		      refcount);
 	}
-	else if (v->vn_refcount == 0 && strcmp(opstr, "reclaim")) {
+	else if (refcount == 0 && strcmp(opstr, "reclaim")) {
 		panic("vnode_check: vop_%s: zero refcount\n", opstr);
 	}
-	else if (v->vn_refcount > 0x100000) {
+	else if (refcount > 0x100000) {
 		kprintf("vnode_check: vop_%s: warning: large refcount %d\n", 
-			opstr, v->vn_refcount);
+			opstr, refcount);
 	}
 
 	if (v->vn_opencount < 0) {
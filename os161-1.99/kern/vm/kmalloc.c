@@ -29,14 +29,21 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
+#include "opt-A3.h"
+#include "opt-kmprof.h"
 
 /*
  * Kernel malloc.
  */
 
 
+#if !OPT_NOASSERTS
 static
 void
 fill_deadbeef(void *vptr, size_t len)
@@ -48,6 +55,7 @@ fill_deadbeef(void *vptr, size_t len)
 		ptr[i] = 0xdeadbeef;
 	}
 }
+#endif
 
 ////////////////////////////////////////////////////////////
 //
@@ -101,9 +109,16 @@ struct freelist {
 	struct freelist *next;
 };
 
+/*
+ * sizebases[] lists only the pages that still have a free block, so
+ * kmalloc can take the first one; full pages are on allbase alone.
+ * Both lists are doubly linked so a page can leave either in O(1).
+ */
 struct pageref {
 	struct pageref *next_samesize;
+	struct pageref **pprev_samesize;	/* NULL if page is full */
 	struct pageref *next_all;
+	struct pageref **pprev_all;
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -118,45 +133,54 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * This is cheesy. 
+ * Pagerefs live in pages of their own, chained together. The first
+ * page is in the kernel BSS so the allocator works before the VM
+ * system is up; more are fetched with alloc_kpages when it fills,
+ * which lets the subpage heap grow past 1M when there is RAM for it.
  *
- * The problem is not that it's wasteful - we can only allocate whole
- * pages of pageref structures at a time anyway. The problem is that
- * we really ought to be able to have more than one of these pages.
- *
- * However, for the time being, one page worth of pagerefs gives us
- * 256 pagerefs; this lets us manage 256 * 4k = 1M of kernel heap.
- * That would be twice as much memory as we get for *everything*.
- * Thus, we will cheat and not allow any mechanism for having a second
- * page of pageref structs.
- *
- * Then, since the size is fixed at one page, we'll simplify a bit
- * further by allocating the page in the kernel BSS instead of calling
- * alloc_kpages to get it.
+ * Pageref pages are never given back. They cost one page per 169
+ * pages of heap, and the next burst of allocation would only want
+ * them again.
  */
 
-#define NPAGEREFS (PAGE_SIZE / sizeof(struct pageref))
-static struct pageref pagerefs[NPAGEREFS];
+#define INUSE_WORDS ((PAGE_SIZE / sizeof(struct pageref) + 31) / 32)
+#define NPAGEREFS ((PAGE_SIZE - sizeof(void *) - sizeof(unsigned) \
+		    - INUSE_WORDS * sizeof(uint32_t)) / sizeof(struct pageref))
+
+struct pagerefpage {
+	struct pagerefpage *next;
+	unsigned nused;
+	uint32_t inuse[INUSE_WORDS];
+	struct pageref refs[NPAGEREFS];
+};
 
-#define INUSE_WORDS (NPAGEREFS/32)
-static uint32_t pagerefs_inuse[INUSE_WORDS];
+static struct pagerefpage firstpagerefpage;
+static struct pagerefpage *pagerefpages = &firstpagerefpage;
+static unsigned npagerefpages = 1;
 
 static
 struct pageref *
 allocpageref(void)
 {
+	struct pagerefpage *prp;
 	unsigned i,j;
 	uint32_t k;
 
-	for (i=0; i<INUSE_WORDS; i++) {
-		if (pagerefs_inuse[i]==0xffffffff) {
+	for (prp = pagerefpages; prp != NULL; prp = prp->next) {
+		if (prp->nused == NPAGEREFS) {
 			/* full */
 			continue;
 		}
-		for (k=1,j=0; k!=0; k<<=1,j++) {
-			if ((pagerefs_inuse[i] & k)==0) {
-				pagerefs_inuse[i] |= k;
-				return &pagerefs[i*32 + j];
+		for (i=0; i<INUSE_WORDS; i++) {
+			if (prp->inuse[i]==0xffffffff) {
+				continue;
+			}
+			for (k=1,j=0; k!=0 && i*32+j<NPAGEREFS; k<<=1,j++) {
+				if ((prp->inuse[i] & k)==0) {
+					prp->inuse[i] |= k;
+					prp->nused++;
+					return &prp->refs[i*32 + j];
+				}
 			}
 		}
 		KASSERT(0);
@@ -170,15 +194,23 @@ static
 void
 freepageref(struct pageref *p)
 {
+	struct pagerefpage *prp;
 	size_t i, j;
 	uint32_t k;
 
-	j = p-pagerefs;
-	KASSERT(j < NPAGEREFS);  /* note: j is unsigned, don't test < 0 */
+	for (prp = pagerefpages; prp != NULL; prp = prp->next) {
+		if (p >= prp->refs && p < prp->refs + NPAGEREFS) {
+			break;
+		}
+	}
+	KASSERT(prp != NULL);
+
+	j = p-prp->refs;
 	i = j/32;
 	k = ((uint32_t)1) << (j%32);
-	KASSERT((pagerefs_inuse[i] & k) != 0);
-	pagerefs_inuse[i] &= ~k;
+	KASSERT((prp->inuse[i] & k) != 0);
+	prp->inuse[i] &= ~k;
+	prp->nused--;
 }
 
 ////////////////////////////////////////
@@ -199,6 +231,39 @@ static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
 
 ////////////////////////////////////////
 
+/*
+ * Add a fresh page of pagerefs. Called without kmalloc_spinlock, like
+ * every other call to alloc_kpages in here. The page comes straight
+ * from alloc_kpages, so this never recurses into the subpage
+ * allocator. Returns -1 if no page could be had.
+ */
+static
+int
+growpagerefs(void)
+{
+	struct pagerefpage *prp;
+	vaddr_t page;
+
+	KASSERT(sizeof(struct pagerefpage) <= PAGE_SIZE);
+
+	page = alloc_kpages(1);
+	if (page == 0) {
+		return -1;
+	}
+	prp = (struct pagerefpage *)page;
+	bzero(prp, sizeof(*prp));
+
+	spinlock_acquire(&kmalloc_spinlock);
+	prp->next = pagerefpages;
+	pagerefpages = prp;
+	npagerefpages++;
+	spinlock_release(&kmalloc_spinlock);
+
+	return 0;
+}
+
+////////////////////////////////////////
+
 /* SLOWER implies SLOW */
 #ifdef SLOWER
 #ifndef SLOW
@@ -260,18 +325,18 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < NPAGEREFS);
+			KASSERT(sc < npagerefpages * NPAGEREFS);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < NPAGEREFS);
+		KASSERT(ac < npagerefpages * NPAGEREFS);
 		ac++;
 	}
 
-	KASSERT(sc==ac);
+	KASSERT(sc<=ac);
 }
 #else
 #define checksubpages() 
@@ -330,6 +395,10 @@ dumpsubpage(struct pageref *pr)
 	kprintf("\n");
 }
 
+#if OPT_A3
+static void kmcache_printstats(void);
+#endif
+
 void
 kheap_printstats(void)
 {
@@ -345,33 +414,101 @@ kheap_printstats(void)
 	}
 
 	spinlock_release(&kmalloc_spinlock);
+
+#if OPT_A3
+	kmcache_printstats();
+#endif
 }
 
 ////////////////////////////////////////
 
 static
 void
-remove_lists(struct pageref *pr, int blktype)
+add_samesize(struct pageref *pr, int blktype)
 {
-	struct pageref **guy;
-
 	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(pr->pprev_samesize == NULL);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	pr->next_samesize = sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = &pr->next_samesize;
 	}
+	pr->pprev_samesize = &sizebases[blktype];
+	sizebases[blktype] = pr;
+}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
+static
+void
+remove_samesize(struct pageref *pr)
+{
+	KASSERT(pr->pprev_samesize != NULL);
+
+	*pr->pprev_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->pprev_samesize = pr->pprev_samesize;
+	}
+	pr->next_samesize = NULL;
+	pr->pprev_samesize = NULL;
+}
+
+static
+void
+add_all(struct pageref *pr)
+{
+	pr->next_all = allbase;
+	if (pr->next_all != NULL) {
+		pr->next_all->pprev_all = &pr->next_all;
+	}
+	pr->pprev_all = &allbase;
+	allbase = pr;
+}
+
+static
+void
+remove_all(struct pageref *pr)
+{
+	*pr->pprev_all = pr->next_all;
+	if (pr->next_all != NULL) {
+		pr->next_all->pprev_all = pr->pprev_all;
+	}
+}
+
+/*
+ * Find the pageref for the subpage page containing ADDR, or NULL if
+ * ADDR isn't on one. Normally this is the coremap's slot for the page;
+ * only pages the coremap doesn't know about need the list search.
+ */
+static
+struct pageref *
+findpageref(vaddr_t addr)
+{
+	struct pageref *pr;
+	vaddr_t prpage;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+#if OPT_A3
+	void *ref;
+
+	if (vm_kpage_getref(addr, &ref)) {
+		pr = ref;
+		KASSERT(pr == NULL || PR_PAGEADDR(pr) == (addr & PAGE_FRAME));
+		return pr;
+	}
+#endif
+
+	for (pr = allbase; pr; pr = pr->next_all) {
+		prpage = PR_PAGEADDR(pr);
+
+		/* check for corruption */
+		KASSERT(PR_BLOCKTYPE(pr)<NSIZES);
+		checksubpage(pr);
+
+		if (addr >= prpage && addr < prpage + PAGE_SIZE) {
 			break;
 		}
 	}
+	return pr;
 }
 
 static
@@ -413,41 +550,42 @@ subpage_kmalloc(size_t sz)
 
 	checksubpages();
 
-	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
+	pr = sizebases[blktype];
+	if (pr != NULL) {
 
 		/* check for corruption */
 		KASSERT(PR_BLOCKTYPE(pr) == blktype);
 		checksubpage(pr);
+		KASSERT(pr->nfree > 0);
 
-		if (pr->nfree > 0) {
+	doalloc: /* comes here after getting a whole fresh page */
 
-		doalloc: /* comes here after getting a whole fresh page */
-
-			KASSERT(pr->freelist_offset < PAGE_SIZE);
-			prpage = PR_PAGEADDR(pr);
-			fla = prpage + pr->freelist_offset;
-			fl = (struct freelist *)fla;
+		KASSERT(pr->freelist_offset < PAGE_SIZE);
+		prpage = PR_PAGEADDR(pr);
+		fla = prpage + pr->freelist_offset;
+		fl = (struct freelist *)fla;
 
-			retptr = fl;
-			fl = fl->next;
-			pr->nfree--;
+		retptr = fl;
+		fl = fl->next;
+		pr->nfree--;
 
-			if (fl != NULL) {
-				KASSERT(pr->nfree > 0);
-				fla = (vaddr_t)fl;
-				KASSERT(fla - prpage < PAGE_SIZE);
-				pr->freelist_offset = fla - prpage;
-			}
-			else {
-				KASSERT(pr->nfree == 0);
-				pr->freelist_offset = INVALID_OFFSET;
-			}
+		if (fl != NULL) {
+			KASSERT(pr->nfree > 0);
+			fla = (vaddr_t)fl;
+			KASSERT(fla - prpage < PAGE_SIZE);
+			pr->freelist_offset = fla - prpage;
+		}
+		else {
+			KASSERT(pr->nfree == 0);
+			pr->freelist_offset = INVALID_OFFSET;
+			/* full; no longer a candidate for kmalloc */
+			remove_samesize(pr);
+		}
 
-			checksubpages();
+		checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
-			return retptr;
-		}
+		spinlock_release(&kmalloc_spinlock);
+		return retptr;
 	}
 
 	/*
@@ -469,12 +607,17 @@ subpage_kmalloc(size_t sz)
 	spinlock_acquire(&kmalloc_spinlock);
 
 	pr = allocpageref();
-	if (pr==NULL) {
-		/* Couldn't allocate accounting space for the new page. */
+	while (pr==NULL) {
+		/* Out of pagerefs; chain on another page of them. */
 		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-		kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
-		return NULL;
+		if (growpagerefs()) {
+			/* Couldn't allocate accounting space for the new page. */
+			free_kpages(prpage);
+			kprintf("kmalloc: Subpage allocator couldn't get pageref\n"); 
+			return NULL;
+		}
+		spinlock_acquire(&kmalloc_spinlock);
+		pr = allocpageref();
 	}
 
 	pr->pageaddr_and_blocktype = MKPAB(prpage, blktype);
@@ -498,11 +641,12 @@ subpage_kmalloc(size_t sz)
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	pr->pprev_samesize = NULL;
+	add_samesize(pr, blktype);
+	add_all(pr);
+#if OPT_A3
+	vm_kpage_setref(prpage, pr);
+#endif
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -526,25 +670,20 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = findpageref(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -552,11 +691,14 @@ subpage_kfree(void *ptr)
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
+#if !OPT_NOASSERTS
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
-	 * uses of dangling pointers.
+	 * uses of dangling pointers. Like the assertions, this is left
+	 * out of kernels built with "options noasserts".
 	 */
 	fill_deadbeef(ptr, sizes[blktype]);
+#endif
 
 	/*
 	 * We probably ought to check for free twice by seeing if the block
@@ -572,11 +714,19 @@ subpage_kfree(void *ptr)
 	}
 	pr->freelist_offset = offset;
 	pr->nfree++;
+	if (pr->nfree == 1) {
+		/* was full; kmalloc can use it again */
+		add_samesize(pr, blktype);
+	}
 
 	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
-		remove_lists(pr, blktype);
+		remove_samesize(pr);
+		remove_all(pr);
+#if OPT_A3
+		vm_kpage_setref(prpage, NULL);
+#endif
 		freepageref(pr);
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
@@ -595,11 +745,614 @@ subpage_kfree(void *ptr)
 	return 0;
 }
 
+#if OPT_A3
+////////////////////////////////////////////////////////////
+//
+// Per-CPU magazine layer.
+//
+//    Each CPU keeps two magazines (small stacks of free blocks) per
+//    size class, "loaded" and "previous", and serves kmalloc and kfree
+//    from them with nothing more than interrupts off. When both are
+//    empty, or both full, it trades one with the depot, a global list
+//    of full and empty magazines for each class. Only the trade takes
+//    a lock; if the depot has nothing to offer, the request falls
+//    through to the subpage allocator above. (This is the scheme from
+//    Bonwick and Adams, "Magazines and Vmem", USENIX 2001.)
+//
+//    Blocks in magazines still count as allocated in their pages, so
+//    those pages stay around. To bound that, big size classes get
+//    short magazines, and the depot keeps at most DEPOT_MAXFULL full
+//    magazines per class; past that, a full magazine is emptied back
+//    into its pages. Likewise it keeps at most DEPOT_MAXEMPTY empty
+//    ones, and frees the rest.
+//
+//    Making, emptying, and freeing magazines goes through the subpage
+//    allocator, which can block for pages, so that is always done after
+//    interrupts are back on.
+//
+//    kfree finds the size class of a block through the pageref in the
+//    coremap, which is fixed as long as the block is allocated, so that
+//    lookup needs no lock either.
+//
+
+#define MAGSIZE 14
+#define DEPOT_MAXFULL 4
+#define DEPOT_MAXEMPTY 4
+
+struct magazine {
+	struct magazine *next;		/* on a depot list */
+	unsigned nrounds;
+	void *rounds[MAGSIZE];
+};
+
+struct kmcpu {
+	struct magazine *loaded[NSIZES];
+	struct magazine *previous[NSIZES];
+	unsigned allocs[NSIZES];	/* kmallocs seen */
+	unsigned allochits[NSIZES];	/* ...served from magazines */
+	unsigned frees[NSIZES];		/* kfrees seen */
+	unsigned freehits[NSIZES];	/* ...put in magazines */
+};
+
+struct kmdepot {
+	struct magazine *full;
+	struct magazine *empty;
+	unsigned nfull;
+	unsigned nempty;
+};
+
+static struct kmcpu kmcpus[MAXCPUS];
+static struct kmdepot kmdepots[NSIZES];
+static struct spinlock kmdepot_spinlock = SPINLOCK_INITIALIZER;
+
+/*
+ * Rounds per magazine for a size class: no more than half a page's
+ * worth of blocks.
+ */
+static
+unsigned
+magcapacity(int blktype)
+{
+	unsigned n = PAGE_SIZE / sizes[blktype] / 2;
+
+	return n < MAGSIZE ? n : MAGSIZE;
+}
+
+/*
+ * Take a block of size class BLKTYPE from this CPU's magazines, or
+ * return NULL if neither they nor the depot have one.
+ */
+static
+void *
+kmcache_alloc(int blktype)
+{
+	struct kmcpu *kc;
+	struct kmdepot *kd = &kmdepots[blktype];
+	struct magazine *mag, *full, *extra = NULL;
+	void *ret;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* too early in boot to know which cpu we are */
+		return NULL;
+	}
+
+	spl = splhigh();
+	kc = &kmcpus[curcpu->c_number];
+	kc->allocs[blktype]++;
+
+	mag = kc->loaded[blktype];
+	if (mag == NULL || mag->nrounds == 0) {
+		if (kc->previous[blktype] != NULL &&
+		    kc->previous[blktype]->nrounds > 0) {
+			kc->loaded[blktype] = kc->previous[blktype];
+			kc->previous[blktype] = mag;
+		}
+		else {
+			/* Give the depot our empty previous for a full one. */
+			spinlock_acquire(&kmdepot_spinlock);
+			full = kd->full;
+			if (full != NULL) {
+				kd->full = full->next;
+				kd->nfull--;
+				extra = kc->previous[blktype];
+				if (extra != NULL && kd->nempty < DEPOT_MAXEMPTY) {
+					extra->next = kd->empty;
+					kd->empty = extra;
+					kd->nempty++;
+					extra = NULL;
+				}
+				kc->previous[blktype] = mag;
+				kc->loaded[blktype] = full;
+			}
+			spinlock_release(&kmdepot_spinlock);
+		}
+
+		mag = kc->loaded[blktype];
+		if (mag == NULL || mag->nrounds == 0) {
+			splx(spl);
+			return NULL;
+		}
+	}
+
+	ret = mag->rounds[--mag->nrounds];
+	kc->allochits[blktype]++;
+	splx(spl);
+
+	if (extra != NULL) {
+		/* The depot has enough empty magazines already. */
+		subpage_kfree(extra);
+	}
+	return ret;
+}
+
+/*
+ * Put PTR, a block of size class BLKTYPE, in this CPU's magazines.
+ * Returns -1 if there was nowhere to put it.
+ */
+static
+int
+kmcache_free(void *ptr, int blktype)
+{
+	struct kmcpu *kc;
+	struct kmdepot *kd = &kmdepots[blktype];
+	struct magazine *mag, *prev, *empty;
+	struct magazine *spare = NULL, *drain = NULL;
+	unsigned cap = magcapacity(blktype);
+	unsigned i;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		return -1;
+	}
+
+ retry:
+	spl = splhigh();
+	kc = &kmcpus[curcpu->c_number];
+	if (spare == NULL) {
+		/* count each kfree once, not again after a retry */
+		kc->frees[blktype]++;
+	}
+
+	mag = kc->loaded[blktype];
+	if (mag == NULL || mag->nrounds == cap) {
+		prev = kc->previous[blktype];
+		if (prev != NULL && prev->nrounds < cap) {
+			kc->loaded[blktype] = prev;
+			kc->previous[blktype] = mag;
+		}
+		else {
+			/* Get an empty magazine from the depot... */
+			spinlock_acquire(&kmdepot_spinlock);
+			empty = kd->empty;
+			if (empty != NULL) {
+				kd->empty = empty->next;
+				kd->nempty--;
+			}
+			else if (spare != NULL) {
+				empty = spare;
+				spare = NULL;
+			}
+			else {
+				/*
+				 * ...or make one. That can block, so do
+				 * it with interrupts on and start over.
+				 */
+				spinlock_release(&kmdepot_spinlock);
+				splx(spl);
+				spare = subpage_kmalloc(sizeof(struct magazine));
+				if (spare == NULL) {
+					return -1;
+				}
+				spare->nrounds = 0;
+				goto retry;
+			}
+
+			/*
+			 * Retire our full previous to the depot, or if the
+			 * depot is full too, empty it below.
+			 */
+			if (prev != NULL) {
+				if (kd->nfull < DEPOT_MAXFULL) {
+					prev->next = kd->full;
+					kd->full = prev;
+					kd->nfull++;
+				}
+				else {
+					drain = prev;
+				}
+			}
+			spinlock_release(&kmdepot_spinlock);
+
+			kc->previous[blktype] = mag;
+			kc->loaded[blktype] = empty;
+		}
+		mag = kc->loaded[blktype];
+	}
+
+	KASSERT(mag->nrounds < cap);
+	mag->rounds[mag->nrounds++] = ptr;
+	kc->freehits[blktype]++;
+	splx(spl);
+
+	if (spare != NULL) {
+		/* Someone refilled the depot while we made this. */
+		subpage_kfree(spare);
+	}
+	if (drain != NULL) {
+		/* Send the blocks home. */
+		for (i=0; i<drain->nrounds; i++) {
+			subpage_kfree(drain->rounds[i]);
+		}
+		subpage_kfree(drain);
+	}
+	return 0;
+}
+
+/*
+ * kfree front end: if PTR is a subpage block on a page the coremap
+ * knows about, cache it. Returns -1 if the caller should free PTR the
+ * slow way.
+ */
+static
+int
+kmcache_kfree(void *ptr)
+{
+	struct pageref *pr;
+	void *ref;
+	vaddr_t offset;
+	int blktype;
+
+	if (!vm_kpage_getref((vaddr_t)ptr, &ref) || ref == NULL) {
+		return -1;
+	}
+	pr = ref;
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype>=0 && blktype<NSIZES);
+
+	offset = (vaddr_t)ptr - PR_PAGEADDR(pr);
+	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+		panic("kfree: subpage free of invalid addr %p\n", ptr);
+	}
+
+#if !OPT_NOASSERTS
+	fill_deadbeef(ptr, sizes[blktype]);
+#endif
+
+	return kmcache_free(ptr, blktype);
+}
+
+static
+unsigned
+percent(unsigned part, unsigned whole)
+{
+	if (whole == 0) {
+		return 0;
+	}
+	/* avoid overflowing part*100 */
+	if (part > 0xffffffff / 100) {
+		return part / (whole / 100);
+	}
+	return part * 100 / whole;
+}
+
+static
+void
+kmcache_printstats(void)
+{
+	struct kmcpu *kc;
+	unsigned i, j, allocs, allochits, frees, freehits;
+
+	kprintf("Per-CPU magazines (kmalloc hits / kfree hits):\n");
+	for (i=0; i<MAXCPUS; i++) {
+		kc = &kmcpus[i];
+		allocs = allochits = frees = freehits = 0;
+		for (j=0; j<NSIZES; j++) {
+			allocs += kc->allocs[j];
+			allochits += kc->allochits[j];
+			frees += kc->frees[j];
+			freehits += kc->freehits[j];
+		}
+		if (allocs == 0 && frees == 0) {
+			continue;
+		}
+		kprintf("cpu%u: %u/%u (%u%%)  %u/%u (%u%%)\n   ", i,
+			allochits, allocs, percent(allochits, allocs),
+			freehits, frees, percent(freehits, frees));
+		for (j=0; j<NSIZES; j++) {
+			kprintf(" %lu:%u%%", (unsigned long)sizes[j],
+				percent(kc->allochits[j], kc->allocs[j]));
+		}
+		kprintf("\n");
+	}
+
+	spinlock_acquire(&kmdepot_spinlock);
+	kprintf("Depot full/empty magazines:");
+	for (j=0; j<NSIZES; j++) {
+		kprintf(" %lu:%u/%u", (unsigned long)sizes[j],
+			kmdepots[j].nfull, kmdepots[j].nempty);
+	}
+	kprintf("\n");
+	spinlock_release(&kmdepot_spinlock);
+}
+#endif // OPT_A3
+
+#if OPT_KMPROF
+////////////////////////////////////////////////////////////
+//
+// Allocation profiler (options kmprof).
+//
+//    Every live kmalloc block is entered in kmprof_live[], an open-
+//    addressed hash table keyed on the block's address, together with
+//    the call site that allocated it and the bytes it really occupies
+//    (its size class, or its whole pages). Call sites are kept in
+//    kmprof_sites[] with their live, total and peak usage. Both tables
+//    are fixed arrays in the BSS so that recording never allocates;
+//    blocks that don't fit are counted as untracked. Without the option
+//    none of this is compiled and kmalloc/kfree are unchanged.
+//
+//    A call site is kmalloc's return address. kheap_printprofile prints
+//    them in a form addr2line takes, to be run on the host against the
+//    kernel image that was booted. Everything allocated via kstrdup is
+//    charged to kstrdup.
+//
+
+#define KMPROF_NLIVE	2048	/* must be a power of 2 */
+#define KMPROF_NSITES	256	/* must be a power of 2 */
+#define KMPROF_TOP	10
+
+struct kmprof_live {
+	vaddr_t kl_ptr;			/* 0 if slot unused */
+	uint32_t kl_bytes;
+	unsigned kl_site;
+};
+
+struct kmprof_site {
+	vaddr_t ks_pc;			/* 0 if slot unused */
+	unsigned ks_livebytes;
+	unsigned ks_liveblocks;
+	unsigned ks_allocs;
+	unsigned ks_peakbytes;
+};
+
+static struct kmprof_live kmprof_live[KMPROF_NLIVE];
+static struct kmprof_site kmprof_sites[KMPROF_NSITES];
+static unsigned kmprof_nlive, kmprof_nsites;
+static unsigned kmprof_livebytes, kmprof_peakbytes, kmprof_untracked;
+static struct spinlock kmprof_spinlock = SPINLOCK_INITIALIZER;
+
+static
+unsigned
+kmprof_hash(vaddr_t v)
+{
+	v ^= v >> 16;
+	v *= 0x45d9f3b;
+	v ^= v >> 16;
+	return v;
+}
+
+/*
+ * Find or add the site entry for PC. Returns -1 if the table is full.
+ */
+static
+int
+kmprof_site(vaddr_t pc)
+{
+	unsigned i;
+
+	i = kmprof_hash(pc) & (KMPROF_NSITES - 1);
+	while (kmprof_sites[i].ks_pc != 0) {
+		if (kmprof_sites[i].ks_pc == pc) {
+			return i;
+		}
+		i = (i + 1) & (KMPROF_NSITES - 1);
+	}
+	if (kmprof_nsites >= KMPROF_NSITES * 3 / 4) {
+		return -1;
+	}
+	kmprof_sites[i].ks_pc = pc;
+	kmprof_nsites++;
+	return i;
+}
+
+static
+void
+kmprof_alloc(void *ptr, size_t sz, vaddr_t pc)
+{
+	struct kmprof_site *ks;
+	uint32_t bytes;
+	unsigned i;
+	int site;
+
+	if (ptr == NULL) {
+		return;
+	}
+	if (sz >= LARGEST_SUBPAGE_SIZE) {
+		bytes = ROUNDUP(sz, PAGE_SIZE);
+	}
+	else {
+		bytes = sizes[blocktype(sz)];
+	}
+
+	spinlock_acquire(&kmprof_spinlock);
+
+	site = kmprof_site(pc);
+	if (site < 0 || kmprof_nlive >= KMPROF_NLIVE * 3 / 4) {
+		kmprof_untracked++;
+		spinlock_release(&kmprof_spinlock);
+		return;
+	}
+
+	i = kmprof_hash((vaddr_t)ptr) & (KMPROF_NLIVE - 1);
+	while (kmprof_live[i].kl_ptr != 0) {
+		i = (i + 1) & (KMPROF_NLIVE - 1);
+	}
+	kmprof_live[i].kl_ptr = (vaddr_t)ptr;
+	kmprof_live[i].kl_bytes = bytes;
+	kmprof_live[i].kl_site = site;
+	kmprof_nlive++;
+
+	ks = &kmprof_sites[site];
+	ks->ks_livebytes += bytes;
+	ks->ks_liveblocks++;
+	ks->ks_allocs++;
+	if (ks->ks_livebytes > ks->ks_peakbytes) {
+		ks->ks_peakbytes = ks->ks_livebytes;
+	}
+
+	kmprof_livebytes += bytes;
+	if (kmprof_livebytes > kmprof_peakbytes) {
+		kmprof_peakbytes = kmprof_livebytes;
+	}
+
+	spinlock_release(&kmprof_spinlock);
+}
+
+static
+void
+kmprof_free(void *ptr)
+{
+	struct kmprof_site *ks;
+	unsigned i, j, k;
+
+	spinlock_acquire(&kmprof_spinlock);
+
+	i = kmprof_hash((vaddr_t)ptr) & (KMPROF_NLIVE - 1);
+	while (kmprof_live[i].kl_ptr != (vaddr_t)ptr) {
+		if (kmprof_live[i].kl_ptr == 0) {
+			/* untracked block */
+			spinlock_release(&kmprof_spinlock);
+			return;
+		}
+		i = (i + 1) & (KMPROF_NLIVE - 1);
+	}
+
+	ks = &kmprof_sites[kmprof_live[i].kl_site];
+	ks->ks_livebytes -= kmprof_live[i].kl_bytes;
+	ks->ks_liveblocks--;
+	kmprof_livebytes -= kmprof_live[i].kl_bytes;
+	kmprof_nlive--;
+
+	/*
+	 * Delete by shifting back any later entries in the same run that
+	 * would no longer be reachable from their home slot.
+	 */
+	j = i;
+	while (1) {
+		j = (j + 1) & (KMPROF_NLIVE - 1);
+		if (kmprof_live[j].kl_ptr == 0) {
+			break;
+		}
+		k = kmprof_hash(kmprof_live[j].kl_ptr) & (KMPROF_NLIVE - 1);
+		if ((j > i && (k <= i || k > j)) ||
+		    (j < i && (k <= i && k > j))) {
+			kmprof_live[i] = kmprof_live[j];
+			i = j;
+		}
+	}
+	kmprof_live[i].kl_ptr = 0;
+
+	spinlock_release(&kmprof_spinlock);
+}
+
+/*
+ * Fill TOP with the indexes of the (up to) KMPROF_TOP busiest sites,
+ * by live bytes or by number of allocations. Returns how many.
+ */
+static
+unsigned
+kmprof_top(unsigned *top, bool bycount)
+{
+	unsigned i, j, n = 0, key, best;
+	bool taken;
+	int besti;
+
+	while (n < KMPROF_TOP) {
+		besti = -1;
+		best = 0;
+		for (i=0; i<KMPROF_NSITES; i++) {
+			if (kmprof_sites[i].ks_pc == 0) {
+				continue;
+			}
+			key = bycount ? kmprof_sites[i].ks_allocs
+				: kmprof_sites[i].ks_livebytes;
+			taken = false;
+			for (j=0; j<n; j++) {
+				if (top[j] == i) {
+					taken = true;
+				}
+			}
+			if (!taken && (besti < 0 || key > best)) {
+				besti = i;
+				best = key;
+			}
+		}
+		if (besti < 0) {
+			break;
+		}
+		top[n++] = besti;
+	}
+	return n;
+}
+
+static
+void
+kmprof_printsites(const char *what, bool bycount)
+{
+	struct kmprof_site *ks;
+	unsigned top[KMPROF_TOP];
+	unsigned i, n;
+
+	n = kmprof_top(top, bycount);
+	kprintf("Top call sites by %s:\n", what);
+	kprintf("  %-10s %10s %8s %8s %10s\n",
+		"site", "livebytes", "blocks", "allocs", "peakbytes");
+	for (i=0; i<n; i++) {
+		ks = &kmprof_sites[top[i]];
+		kprintf("  0x%08lx %10u %8u %8u %10u\n",
+			(unsigned long)ks->ks_pc, ks->ks_livebytes,
+			ks->ks_liveblocks, ks->ks_allocs, ks->ks_peakbytes);
+	}
+}
+#endif // OPT_KMPROF
+
+void
+kheap_printprofile(void)
+{
+#if OPT_KMPROF
+	unsigned i;
+
+	spinlock_acquire(&kmprof_spinlock);
+
+	kprintf("kmalloc profile: %u bytes in %u blocks live, "
+		"peak %u bytes, %u allocations untracked\n",
+		kmprof_livebytes, kmprof_nlive, kmprof_peakbytes,
+		kmprof_untracked);
+	kmprof_printsites("live bytes", false);
+	kmprof_printsites("allocations", true);
+
+	kprintf("To symbolize: sys161-addr2line -f -e kernel");
+	for (i=0; i<KMPROF_NSITES; i++) {
+		if (kmprof_sites[i].ks_pc != 0 &&
+		    kmprof_sites[i].ks_liveblocks > 0) {
+			kprintf(" 0x%lx", (unsigned long)kmprof_sites[i].ks_pc);
+		}
+	}
+	kprintf("\n");
+
+	spinlock_release(&kmprof_spinlock);
+#else
+	kprintf("kmalloc profiling is not compiled in (options kmprof)\n");
+#endif
+}
+
 //
 ////////////////////////////////////////////////////////////
 
+static
+inline
 void *
-kmalloc(size_t sz)
+kmalloc_common(size_t sz)
 {
 	if (sz>=LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
@@ -608,6 +1361,15 @@ kmalloc(size_t sz)
 		/* Round up to a whole number of pages. */
 		npages = (sz + PAGE_SIZE - 1)/PAGE_SIZE;
 		address = alloc_kpages(npages);
+#if OPT_A3
+		/*
+		 * No run of npages free frames; map scattered ones
+		 * into kseg2 instead.
+		 */
+		if (address==0 && npages > 1) {
+			return vmalloc(sz);
+		}
+#endif
 		if (address==0) {
 			return NULL;
 		}
@@ -615,9 +1377,28 @@ kmalloc(size_t sz)
 		return (void *)address;
 	}
 
+#if OPT_A3
+	void *ptr = kmcache_alloc(blocktype(sz));
+	if (ptr != NULL) {
+		return ptr;
+	}
+#endif
 	return subpage_kmalloc(sz);
 }
 
+void *
+kmalloc(size_t sz)
+{
+#if OPT_KMPROF
+	void *ptr = kmalloc_common(sz);
+
+	kmprof_alloc(ptr, sz, (vaddr_t)__builtin_return_address(0));
+	return ptr;
+#else
+	return kmalloc_common(sz);
+#endif
+}
+
 void
 kfree(void *ptr)
 {
@@ -626,7 +1407,21 @@ kfree(void *ptr)
 	 */
 	if (ptr == NULL) {
 		return;
-	} else if (subpage_kfree(ptr)) {
+	}
+#if OPT_KMPROF
+	kmprof_free(ptr);
+#endif
+#if OPT_A3
+	if (vm_isvmalloc(ptr)) {
+		vfree(ptr);
+		return;
+	}
+	if (kmcache_kfree(ptr) == 0) {
+		/* cached */
+		return;
+	}
+#endif
+	if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
 		free_kpages((vaddr_t)ptr);
 	}
@@ -0,0 +1,385 @@
+/*
+ * Object caches (see <kmem_cache.h>).
+ *
+ * Each slab is one page from alloc_kpages. The page starts with a
+ * struct kmem_slab and is followed by as many objects as fit. The free
+ * list can't be threaded through the objects themselves, since a free
+ * object holds its constructed state, so each object is followed by one
+ * word of link ("bufctl" in Bonwick's paper, "The Slab Allocator",
+ * USENIX 1994). Because slabs are page-aligned, the slab an object
+ * belongs to is just the page it is on.
+ *
+ * Each slab is on one of three lists: partial, full or empty. Objects
+ * are taken from partial slabs first, then empty ones, so as few slabs
+ * as possible are in use. Up to KMEM_MAXEMPTY empty slabs are kept, with
+ * their objects still constructed; beyond that an empty slab's objects
+ * are destroyed and the page is freed.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+#define KMEM_MAXEMPTY	1
+#define KMEM_ALIGN	8
+
+struct kmem_slab {
+	struct kmem_slab *ks_next;
+	struct kmem_slab **ks_pprev;
+	struct kmem_slab **ks_list;	/* which list we're on */
+	struct kmem_cache *ks_cache;
+	void *ks_free;			/* first free object */
+	unsigned ks_nfree;
+};
+
+#define KMEM_HDRSIZE \
+	((sizeof(struct kmem_slab) + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1))
+
+/* List of all caches, for kmem_cache_printstats. */
+static struct kmem_cache *allcaches;
+static struct spinlock allcaches_lock = SPINLOCK_INITIALIZER;
+
+////////////////////////////////////////////////////////////
+//
+// Slab layout
+
+/* Bytes per object including its link word. */
+static
+size_t
+kmem_stride(struct kmem_cache *c)
+{
+	size_t sz = c->kc_size + sizeof(void *);
+
+	return (sz + KMEM_ALIGN - 1) & ~(KMEM_ALIGN - 1);
+}
+
+static
+unsigned
+kmem_objsperslab(struct kmem_cache *c)
+{
+	return (PAGE_SIZE - KMEM_HDRSIZE) / kmem_stride(c);
+}
+
+static
+void **
+kmem_link(struct kmem_cache *c, void *obj)
+{
+	return (void **)((char *)obj + kmem_stride(c) - sizeof(void *));
+}
+
+static
+void *
+kmem_obj(struct kmem_cache *c, struct kmem_slab *s, unsigned i)
+{
+	return (char *)s + KMEM_HDRSIZE + i * kmem_stride(c);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Slab lists
+
+static
+void
+slab_unlink(struct kmem_slab *s)
+{
+	*s->ks_pprev = s->ks_next;
+	if (s->ks_next != NULL) {
+		s->ks_next->ks_pprev = s->ks_pprev;
+	}
+	s->ks_next = NULL;
+	s->ks_pprev = NULL;
+	s->ks_list = NULL;
+}
+
+static
+void
+slab_link(struct kmem_slab **list, struct kmem_slab *s)
+{
+	s->ks_next = *list;
+	if (s->ks_next != NULL) {
+		s->ks_next->ks_pprev = &s->ks_next;
+	}
+	s->ks_pprev = list;
+	s->ks_list = list;
+	*list = s;
+}
+
+/*
+ * Put S on the list matching its free count.
+ */
+static
+void
+slab_relist(struct kmem_cache *c, struct kmem_slab *s)
+{
+	struct kmem_slab **want;
+
+	if (s->ks_nfree == 0) {
+		want = &c->kc_full;
+	}
+	else if (s->ks_nfree == kmem_objsperslab(c)) {
+		want = &c->kc_empty;
+	}
+	else {
+		want = &c->kc_partial;
+	}
+
+	if (s->ks_list == want) {
+		return;
+	}
+	if (s->ks_list == &c->kc_empty) {
+		c->kc_nempty--;
+	}
+	if (s->ks_list != NULL) {
+		slab_unlink(s);
+	}
+	slab_link(want, s);
+	if (want == &c->kc_empty) {
+		c->kc_nempty++;
+	}
+}
+
+////////////////////////////////////////////////////////////
+//
+// Making and freeing slabs. These run without the cache lock held,
+// as constructors and destructors may allocate and free memory.
+
+/*
+ * Destroy the first N objects of S and give its page back.
+ */
+static
+void
+slab_destroy(struct kmem_cache *c, struct kmem_slab *s, unsigned n)
+{
+	unsigned i;
+
+	if (c->kc_dtor != NULL) {
+		for (i=0; i<n; i++) {
+			c->kc_dtor(kmem_obj(c, s, i));
+		}
+	}
+	free_kpages((vaddr_t)s);
+}
+
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *c)
+{
+	struct kmem_slab *s;
+	unsigned i, n;
+	void *obj;
+
+	s = (struct kmem_slab *)alloc_kpages(1);
+	if (s == NULL) {
+		return NULL;
+	}
+
+	n = kmem_objsperslab(c);
+	s->ks_next = NULL;
+	s->ks_pprev = NULL;
+	s->ks_list = NULL;
+	s->ks_cache = c;
+	s->ks_free = NULL;
+	s->ks_nfree = n;
+
+	/* Build the free list backwards so objects come out in order. */
+	for (i=n; i-- > 0; ) {
+		obj = kmem_obj(c, s, i);
+		*kmem_link(c, obj) = s->ks_free;
+		s->ks_free = obj;
+	}
+
+	if (c->kc_ctor != NULL) {
+		for (i=0; i<n; i++) {
+			if (c->kc_ctor(kmem_obj(c, s, i))) {
+				slab_destroy(c, s, i);
+				return NULL;
+			}
+		}
+	}
+
+	return s;
+}
+
+static
+void
+kmem_cache_register(struct kmem_cache *c)
+{
+	spinlock_acquire(&allcaches_lock);
+	if (!c->kc_listed) {
+		c->kc_next = allcaches;
+		allcaches = c;
+		c->kc_listed = true;
+	}
+	spinlock_release(&allcaches_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Interface
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *), void (*dtor)(void *))
+{
+	struct kmem_cache *c;
+
+	c = kmalloc(sizeof(*c));
+	if (c == NULL) {
+		return NULL;
+	}
+
+	c->kc_name = name;
+	c->kc_size = size;
+	c->kc_ctor = ctor;
+	c->kc_dtor = dtor;
+	spinlock_init(&c->kc_lock);
+	c->kc_partial = c->kc_full = c->kc_empty = NULL;
+	c->kc_nempty = 0;
+	c->kc_next = NULL;
+	c->kc_listed = false;
+	c->kc_nslabs = c->kc_inuse = 0;
+	c->kc_allocs = c->kc_frees = 0;
+	c->kc_slabsmade = c->kc_slabsfreed = 0;
+
+	if (kmem_objsperslab(c) == 0) {
+		spinlock_cleanup(&c->kc_lock);
+		kfree(c);
+		return NULL;
+	}
+
+	kmem_cache_register(c);
+	return c;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *c)
+{
+	struct kmem_cache **cp;
+	struct kmem_slab *s;
+
+	KASSERT(c->kc_inuse == 0);
+	KASSERT(c->kc_partial == NULL);
+	KASSERT(c->kc_full == NULL);
+
+	while ((s = c->kc_empty) != NULL) {
+		slab_unlink(s);
+		slab_destroy(c, s, kmem_objsperslab(c));
+	}
+
+	spinlock_acquire(&allcaches_lock);
+	for (cp = &allcaches; *cp != NULL; cp = &(*cp)->kc_next) {
+		if (*cp == c) {
+			*cp = c->kc_next;
+			break;
+		}
+	}
+	spinlock_release(&allcaches_lock);
+
+	spinlock_cleanup(&c->kc_lock);
+	kfree(c);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *c)
+{
+	struct kmem_slab *s, *fresh;
+	void *obj;
+
+	KASSERT(kmem_objsperslab(c) > 0);
+
+	spinlock_acquire(&c->kc_lock);
+	while (1) {
+		s = c->kc_partial != NULL ? c->kc_partial : c->kc_empty;
+		if (s != NULL) {
+			break;
+		}
+
+		/* Nothing free; make a slab without the lock held. */
+		spinlock_release(&c->kc_lock);
+		if (!c->kc_listed) {
+			kmem_cache_register(c);
+		}
+		fresh = slab_create(c);
+		if (fresh == NULL) {
+			return NULL;
+		}
+		spinlock_acquire(&c->kc_lock);
+		slab_relist(c, fresh);
+		c->kc_nslabs++;
+		c->kc_slabsmade++;
+	}
+
+	KASSERT(s->ks_nfree > 0);
+	obj = s->ks_free;
+	s->ks_free = *kmem_link(c, obj);
+	s->ks_nfree--;
+	slab_relist(c, s);
+
+	c->kc_inuse++;
+	c->kc_allocs++;
+	spinlock_release(&c->kc_lock);
+
+	return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+	struct kmem_slab *s;
+
+	if (obj == NULL) {
+		return;
+	}
+
+	s = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+	KASSERT(s->ks_cache == c);
+	KASSERT(((char *)obj - (char *)kmem_obj(c, s, 0))
+		% kmem_stride(c) == 0);
+
+	spinlock_acquire(&c->kc_lock);
+	*kmem_link(c, obj) = s->ks_free;
+	s->ks_free = obj;
+	s->ks_nfree++;
+	KASSERT(s->ks_nfree <= kmem_objsperslab(c));
+	slab_relist(c, s);
+
+	c->kc_inuse--;
+	c->kc_frees++;
+
+	if (s->ks_list == &c->kc_empty && c->kc_nempty > KMEM_MAXEMPTY) {
+		/* Too many idle slabs; give this one back. */
+		slab_unlink(s);
+		c->kc_nempty--;
+		c->kc_nslabs--;
+		c->kc_slabsfreed++;
+		spinlock_release(&c->kc_lock);
+		slab_destroy(c, s, kmem_objsperslab(c));
+		return;
+	}
+	spinlock_release(&c->kc_lock);
+}
+
+void
+kmem_cache_printstats(void)
+{
+	struct kmem_cache *c;
+
+	kprintf("Object caches:\n");
+	kprintf("  %-12s %5s %5s %6s %6s %8s %8s %6s %6s\n", "name",
+		"size", "/slab", "slabs", "inuse", "allocs", "frees",
+		"made", "freed");
+
+	spinlock_acquire(&allcaches_lock);
+	for (c = allcaches; c != NULL; c = c->kc_next) {
+		spinlock_acquire(&c->kc_lock);
+		kprintf("  %-12s %5lu %5u %6u %6u %8u %8u %6u %6u\n",
+			c->kc_name, (unsigned long)c->kc_size,
+			kmem_objsperslab(c), c->kc_nslabs, c->kc_inuse,
+			c->kc_allocs, c->kc_frees, c->kc_slabsmade,
+			c->kc_slabsfreed);
+		spinlock_release(&c->kc_lock);
+	}
+	spinlock_release(&allcaches_lock);
+}
@@ -0,0 +1,35 @@
+#ifndef _SYS_MMAN_H_
+#define _SYS_MMAN_H_
+
+#include <sys/types.h>
+
+/*
+ * Get the PROT_* and MAP_* constants from the kernel.
+ */
+#include <kern/mman.h>
+
+/* Returned by mmap on error (not NULL, since 0 could be a valid address) */
+#define MAP_FAILED ((void *)-1)
+
+/* POSIX names for the madvise() advice values */
+#define POSIX_MADV_NORMAL     MADV_NORMAL
+#define POSIX_MADV_RANDOM     MADV_RANDOM
+#define POSIX_MADV_SEQUENTIAL MADV_SEQUENTIAL
+#define POSIX_MADV_WILLNEED   MADV_WILLNEED
+#define POSIX_MADV_DONTNEED   MADV_DONTNEED
+
+/*
+ * Only anonymous mappings (MAP_ANON, with fd -1 and offset 0) are
+ * supported. munmap must be given exactly a region returned by mmap.
+ */
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset);
+int munmap(void *addr, size_t len);
+
+/*
+ * madvise is the system call; posix_madvise is a libc wrapper that
+ * returns an error number instead of setting errno.
+ */
+int madvise(void *addr, size_t len, int advice);
+int posix_madvise(void *addr, size_t len, int advice);
+
+#endif /* _SYS_MMAN_H_ */
@@ -40,6 +40,7 @@
 #include <kern/fcntl.h>
 #include <kern/ioctl.h>
 #include <kern/reboot.h>
+#include <kern/schedstats.h>
 #include <kern/seek.h>
 #include <kern/time.h>
 #include <kern/unistd.h>
@@ -56,6 +57,9 @@
  *     fstat:    sys/stat.h
  *     lstat:    sys/stat.h
  *     mkdir:    sys/stat.h
+ *     mmap:     sys/mman.h
+ *     munmap:   sys/mman.h
+ *     madvise:  sys/mman.h
  *
  * If this were standard Unix, more prototypes would go in other
  * header files as well, as follows:
@@ -153,7 +157,11 @@ int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *request, struct timespec *remain);
 int __getcwd(char *buf, size_t buflen);
+int setaffinity(unsigned mask);
+unsigned getaffinity(void);
+int schedstats(int cpu, struct schedstats *stats);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
@@ -0,0 +1,23 @@
+#include <sys/mman.h>
+#include <errno.h>
+
+/*
+ * POSIX C function: advise the VM system about the use of a range of
+ * memory. Same as the madvise() system call, except that errors are
+ * returned instead of being reported through errno.
+ */
+
+int
+posix_madvise(void *addr, size_t len, int advice)
+{
+	int saved_errno, result;
+
+	saved_errno = errno;
+	result = madvise(addr, len, advice);
+	if (result < 0) {
+		result = errno;
+		errno = saved_errno;
+		return result;
+	}
+	return 0;
+}
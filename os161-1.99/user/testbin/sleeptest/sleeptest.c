@@ -0,0 +1,75 @@
+/*
+ * sleeptest - check nanosleep.
+ *
+ * Sleeps for a range of times from a millisecond to a second and
+ * reports how long each sleep actually took, as measured by __time.
+ * A sleep shorter than requested is an error; longer is expected, by
+ * up to a couple of timer ticks.
+ *
+ * Also checks that bad requests are refused with EINVAL.
+ *
+ * Usage: sleeptest
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+static const unsigned sleepms[] = { 1, 5, 10, 25, 50, 100, 250, 1000 };
+#define NSLEEPS (sizeof(sleepms) / sizeof(sleepms[0]))
+
+static
+unsigned long
+now_us(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return (unsigned long)secs * 1000000 + nsecs / 1000;
+}
+
+int
+main(void)
+{
+	struct timespec req, rem;
+	unsigned long start, took;
+	unsigned i;
+	int errors = 0;
+
+	for (i=0; i<NSLEEPS; i++) {
+		req.tv_sec = sleepms[i] / 1000;
+		req.tv_nsec = (sleepms[i] % 1000) * 1000000;
+		start = now_us();
+		if (nanosleep(&req, &rem)) {
+			err(1, "nanosleep");
+		}
+		took = now_us() - start;
+		printf("asked for %4u ms, slept %7lu us%s\n", sleepms[i], took,
+		       took < sleepms[i] * 1000UL ? " (too short!)" : "");
+		if (took < sleepms[i] * 1000UL) {
+			errors++;
+		}
+	}
+
+	req.tv_sec = 0;
+	req.tv_nsec = 1000000000;
+	if (nanosleep(&req, NULL) == 0 || errno != EINVAL) {
+		printf("nanosleep with tv_nsec of a second: not EINVAL\n");
+		errors++;
+	}
+	req.tv_sec = -1;
+	req.tv_nsec = 0;
+	if (nanosleep(&req, NULL) == 0 || errno != EINVAL) {
+		printf("nanosleep with negative tv_sec: not EINVAL\n");
+		errors++;
+	}
+
+	if (errors) {
+		errx(1, "%d errors", errors);
+	}
+	printf("sleeptest done.\n");
+	return 0;
+}
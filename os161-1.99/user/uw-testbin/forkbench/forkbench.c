@@ -0,0 +1,73 @@
+/*
+ * forkbench
+ *
+ *	how long does it take to make and reap a process?
+ *
+ *   makes NFORKS children one at a time, each of which _exits at once,
+ *   waiting for each before making the next, and reports the average
+ *   time per fork/_exit/waitpid cycle. Then does the same with NPROCS
+ *   children at a time, so that the parent and its children can run
+ *   on different cpus at once. Each fork also makes a kernel thread,
+ *   so this covers thread creation too; compare with the tt5 menu
+ *   command, which makes bare kernel threads.
+ *
+ *   relies on fork, waitpid, _exit and __time
+ *
+ */
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <err.h>
+
+#define NFORKS 200
+#define NPROCS 4
+
+static
+unsigned long
+now_us(void)
+{
+  time_t secs;
+  unsigned long nsecs;
+
+  __time(&secs, &nsecs);
+  return (unsigned long)secs * 1000000 + nsecs / 1000;
+}
+
+static
+void
+run(int batch)
+{
+  pid_t kids[NPROCS];
+  unsigned long start, us;
+  int i, j, status;
+
+  start = now_us();
+  for (i=0; i<NFORKS; i += batch) {
+    for (j=0; j<batch; j++) {
+      kids[j] = fork();
+      if (kids[j] < 0) {
+	err(1, "fork");
+      }
+      if (kids[j] == 0) {
+	_exit(0);
+      }
+    }
+    for (j=0; j<batch; j++) {
+      if (waitpid(kids[j], &status, 0) < 0) {
+	err(1, "waitpid");
+      }
+    }
+  }
+  us = now_us() - start;
+  printf("%d forks, %d at a time: %lu us, %lu us each\n",
+	 i, batch, us, us / i);
+}
+
+int
+main()
+{
+  run(1);
+  run(NPROCS);
+  return 0;
+}
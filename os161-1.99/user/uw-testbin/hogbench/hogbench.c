@@ -0,0 +1,122 @@
+/*
+ * hogbench
+ *
+ *	how long does a short command take to run while hogs are running?
+ *
+ *   runs /bin/true the way the shell runs a command (fork, execv,
+ *   waitpid) NRUNS times and reports the average and worst time taken,
+ *   first on an idle system and then with NHOGS cpu-bound children
+ *   running, like hogparty's but without the output and running for
+ *   HOGSECS seconds. With round-robin scheduling each command waits
+ *   behind every hog; with the mlfq kernel option (the ASST3-SCHED
+ *   config) it should not.
+ *
+ *   relies on fork, execv, waitpid, _exit and __time
+ *
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+#define NHOGS 3
+#define NRUNS 20
+#define HOGSECS 20
+
+static char *trueargv[2] = { (char *)"true", NULL };
+
+static
+unsigned long
+now_ms(void)
+{
+  time_t secs;
+  unsigned long nsecs;
+
+  __time(&secs, &nsecs);
+  return (unsigned long)secs * 1000 + nsecs / 1000000;
+}
+
+static
+void
+hog(void)
+{
+  volatile int i;
+  time_t end;
+
+  end = time(NULL) + HOGSECS;
+  while (time(NULL) < end) {
+    for (i=0; i<10000; i++)
+      ;
+  }
+  _exit(0);
+}
+
+static
+unsigned long
+runtrue(void)
+{
+  unsigned long start;
+  pid_t pid;
+  int status;
+
+  start = now_ms();
+  pid = fork();
+  switch (pid) {
+  case -1:
+    err(1, "fork");
+  case 0:
+    execv("/bin/true", trueargv);
+    err(1, "/bin/true");
+  default:
+    break;
+  }
+  if (waitpid(pid, &status, 0) < 0) {
+    err(1, "waitpid");
+  }
+  return now_ms() - start;
+}
+
+static
+void
+runmany(const char *what)
+{
+  unsigned long ms, total, worst;
+  int i;
+
+  total = worst = 0;
+  for (i=0; i<NRUNS; i++) {
+    ms = runtrue();
+    total += ms;
+    if (ms > worst) {
+      worst = ms;
+    }
+  }
+  printf("%-12s %d runs, average %lu ms, worst %lu ms\n",
+	 what, NRUNS, total / NRUNS, worst);
+}
+
+int
+main()
+{
+  pid_t hogs[NHOGS];
+  int i, status;
+
+  runmany("idle:");
+
+  for (i=0; i<NHOGS; i++) {
+    hogs[i] = fork();
+    if (hogs[i] < 0) {
+      err(1, "fork");
+    }
+    if (hogs[i] == 0) {
+      hog();
+    }
+  }
+
+  runmany("with hogs:");
+
+  for (i=0; i<NHOGS; i++) {
+    waitpid(hogs[i], &status, 0);
+  }
+  return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * pidbench
+ *
+ *	how many pid lookups can processes make at once?
+ *
+ *   forks 1, then NPROCS, children that each make NCALLS pairs of
+ *   getpid and waitpid calls, and reports the calls per second made by
+ *   all of them together. The waitpid is for our own pid, which is a
+ *   live process but not the child's, so it looks the pid up in the
+ *   kernel's process table and fails with ECHILD without waiting. With
+ *   the table behind a reader-writer lock the lookups can all go ahead
+ *   at once, so the rate should grow with the number of children on a
+ *   multiprocessor.
+ *
+ *   relies on fork, waitpid, getpid, _exit and __time
+ *
+ */
+
+#include <unistd.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NPROCS 4
+#define NCALLS 2000
+
+static
+unsigned long
+now_ms(void)
+{
+  time_t secs;
+  unsigned long nsecs;
+
+  __time(&secs, &nsecs);
+  return (unsigned long)secs * 1000 + nsecs / 1000000;
+}
+
+static
+void
+lookups(pid_t parent)
+{
+  int i, status;
+
+  for (i=0; i<NCALLS; i++) {
+    (void)getpid();
+    if (waitpid(parent, &status, 0) >= 0 || errno != ECHILD) {
+      errx(1, "waitpid on parent did not fail with ECHILD");
+    }
+  }
+  _exit(0);
+}
+
+static
+void
+run(int nprocs)
+{
+  pid_t kids[NPROCS];
+  pid_t parent;
+  unsigned long start, ms;
+  int i, status;
+
+  parent = getpid();
+  start = now_ms();
+  for (i=0; i<nprocs; i++) {
+    kids[i] = fork();
+    if (kids[i] < 0) {
+      err(1, "fork");
+    }
+    if (kids[i] == 0) {
+      lookups(parent);
+    }
+  }
+  for (i=0; i<nprocs; i++) {
+    if (waitpid(kids[i], &status, 0) < 0) {
+      err(1, "waitpid");
+    }
+    if (WEXITSTATUS(status) != 0) {
+      errx(1, "child %d failed", i);
+    }
+  }
+  ms = now_ms() - start;
+  if (ms == 0) {
+    ms = 1;
+  }
+  printf("%d process(es): %d calls in %lu ms, %lu calls/sec\n",
+	 nprocs, nprocs * NCALLS * 2, ms,
+	 (unsigned long)nprocs * NCALLS * 2 * 1000 / ms);
+}
+
+int
+main()
+{
+  run(1);
+  run(NPROCS);
+  return 0;
+}
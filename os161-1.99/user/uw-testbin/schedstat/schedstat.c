@@ -0,0 +1,113 @@
+/*
+ * schedstat
+ *
+ *	print the kernel's scheduler statistics
+ *
+ *   prints run, idle and run-queue wait time, switches, migrations and
+ *   a histogram of wakeup latency (how long a woken thread waits before
+ *   it runs) for each cpu, then does NSLEEPS short sleeps and prints the
+ *   same for itself. Run it after a workload, e.g. with hogs running,
+ *   to see how long wakeups have to wait.
+ *
+ *   needs a kernel built with the schedstats option
+ *
+ *   relies on schedstats, nanosleep and _exit
+ *
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NSLEEPS 20
+
+static
+void
+print_header(void)
+{
+  printf("%-5s %10s %10s %10s %7s %7s %5s %7s\n", "", "run ms", "idle ms",
+	 "wait ms", "vcsw", "ivcsw", "migr", "wakeups");
+}
+
+static
+void
+print_stats(const char *name, const struct schedstats *ss)
+{
+  printf("%-5s %10llu %10llu %10llu %7u %7u %5u %7u\n", name,
+	 ss->ss_runtime / 1000000, ss->ss_idletime / 1000000,
+	 ss->ss_waittime / 1000000, ss->ss_nvcsw, ss->ss_nivcsw,
+	 ss->ss_migrations, ss->ss_wakeups);
+}
+
+static
+void
+print_hist(const char *name, const struct schedstats *ss)
+{
+  unsigned b;
+
+  printf("%s wakeup latency:\n", name);
+  for (b=0; b<SCHEDSTATS_LATBUCKETS; b++) {
+    if (ss->ss_lathist[b] == 0) {
+      continue;
+    }
+    if (b == 0) {
+      printf("  %15s", "< 2 us");
+    }
+    else if (b == SCHEDSTATS_LATBUCKETS - 1) {
+      printf("  >= %9u us", 1U << b);
+    }
+    else {
+      printf("  %6u-%-5u us", 1U << b, 2U << b);
+    }
+    printf(" %7u\n", ss->ss_lathist[b]);
+  }
+}
+
+int
+main(void)
+{
+  struct schedstats ss[32];
+  struct timespec ts;
+  char name[8];
+  int ncpus, i;
+
+  for (ncpus=0; ncpus<32; ncpus++) {
+    if (schedstats(ncpus, &ss[ncpus])) {
+      break;
+    }
+  }
+  if (ncpus == 0) {
+    if (errno == ENOSYS) {
+      errx(1, "kernel not built with options schedstats");
+    }
+    err(1, "schedstats");
+  }
+
+  print_header();
+  for (i=0; i<ncpus; i++) {
+    snprintf(name, sizeof(name), "cpu%d", i);
+    print_stats(name, &ss[i]);
+  }
+  for (i=0; i<ncpus; i++) {
+    snprintf(name, sizeof(name), "cpu%d", i);
+    print_hist(name, &ss[i]);
+  }
+
+  /* Each sleep ends in a wakeup, so the histogram has something in it. */
+  for (i=0; i<NSLEEPS; i++) {
+    ts.tv_sec = 0;
+    ts.tv_nsec = 10000000;
+    if (nanosleep(&ts, NULL)) {
+      err(1, "nanosleep");
+    }
+  }
+  if (schedstats(SCHEDSTATS_SELF, &ss[0])) {
+    err(1, "schedstats");
+  }
+  print_header();
+  print_stats("self", &ss[0]);
+  print_hist("self", &ss[0]);
+
+  _exit(0);
+}